@@ -15,8 +15,8 @@ enum MeshDataFlagsBit {
     MESH_DATA_FLAG_HAS_POINTS,
     MESH_DATA_FLAG_HAS_NORMALS,
     MESH_DATA_FLAG_HAS_TANGENTS,
-    MESH_DATA_FLAG_UNUSED_8, //8
-    MESH_DATA_FLAG_UNUSED_9,
+    MESH_DATA_FLAG_HAS_VERTEX_PATCH, //8
+    MESH_DATA_FLAG_PATCH_BASE, // the receiver keeps this mesh to apply vertex patches to
     MESH_DATA_FLAG_HAS_COLORS,
     MESH_DATA_FLAG_HAS_VELOCITIES,
     MESH_DATA_FLAG_HAS_MATERIAL_IDS,
@@ -44,6 +44,18 @@ struct OSceneCacheSettingsBase
     uint32_t merge_meshes : 1; // todo
     uint32_t strip_normals : 1;
     uint32_t strip_tangents : 1;
+    // quantize vertex arrays to 16 bit before encoding. lossy, but makes cache files much smaller
+    uint32_t quantize_points : 1;
+    uint32_t quantize_normals : 1;
+    uint32_t quantize_tangents : 1;
+    uint32_t quantize_uv : 1;
+    uint32_t quantize_colors : 1;
+    uint32_t quantize_velocities : 1;
+    // store vertex arrays as deltas against the last keyframe. lossless
+    uint32_t temporal_delta : 1;
+    // ZSTD only. train a dictionary from the first scenes and store it right after the file header.
+    // mainly helps small segments (non-geometry objects, small meshes)
+    uint32_t zstd_dictionary : 1;
 
     OSceneCacheSettingsBase();
 };
@@ -53,6 +65,11 @@ struct OSceneCacheSettings : OSceneCacheSettingsBase, SceneImportSettings
     // *not* serialized in cache file
     int max_queue_size = 4;
     int max_scene_segments = 8;
+    bool write_index = true; // append an index of all scenes so that readers can open the cache without scanning it
+    int keyframe_interval = 30; // with temporal_delta. every Nth scene is stored without prediction
+    int dictionary_scenes = 8; // with zstd_dictionary. number of scenes used to train the dictionary
+    int dictionary_size = 112 * 1024; // with zstd_dictionary. max dictionary size in byte
+    int compression_workers = 0; // ZSTD only. > 0 compresses each segment with multiple threads
 };
 
 struct ISceneCacheSettingsBase
@@ -60,6 +77,9 @@ struct ISceneCacheSettingsBase
     uint32_t convert_scenes : 1;
     uint32_t enable_diff : 1;
     uint32_t generate_velocities : 1;
+    // read the cache file through a memory mapping. no file lock and no copy of segments.
+    // off by default: the file must not be rewritten in place (e.g. by an exporter) while it is open, or playback crashes
+    uint32_t memory_map : 1;
     int max_history = 3;
     int preload_length = 1;
 
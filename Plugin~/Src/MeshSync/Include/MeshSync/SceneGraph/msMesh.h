@@ -16,6 +16,8 @@ msDeclStructPtr(BlendShapeData);
 
 namespace ms {
 
+class MeshRefineCache;
+
 enum class Topology : int
 {
     Points,
@@ -102,6 +104,29 @@ public:
 msSerializable(BoneData);
 msDetachable(BoneData);
 
+// sparse update of per-vertex attributes (sculpting etc). the vertices in the ranges are replaced, others are kept.
+// made by Mesh::makeVertexPatch() and applied by Mesh::merge().
+struct MeshVertexPatch
+{
+    // serializable
+    uint64_t base_checksum = 0; // checksumGeom() of the mesh to be patched
+    SharedVector<int> range_offsets;
+    SharedVector<int> range_counts;
+    // vertices in the ranges, packed. empty if the attribute is unchanged
+    SharedVector<mu::float3> points;
+    SharedVector<mu::float3> normals;
+    SharedVector<mu::float4> colors;
+    SharedVector<mu::float3> velocities;
+
+    void serialize(std::ostream& os) const;
+    void deserialize(std::istream& is);
+    void detach();
+    void clear();
+    size_t vertexCount() const;
+};
+msSerializable(MeshVertexPatch);
+msDetachable(MeshVertexPatch);
+
 class Mesh : public Transform
 {
 using super = Transform;
@@ -127,6 +152,8 @@ public:
     SharedVector<SubmeshData> submeshes;
     Bounds bounds{};
 
+    MeshVertexPatch vertex_patch; // valid if MESH_DATA_FLAG_HAS_VERTEX_PATCH is set
+
     // non-serializable
     // *update clear() when add member*
     SharedVector<mu::Weights4>  weights4;
@@ -162,11 +189,15 @@ public:
     uint64_t vertexCount() const override;
     EntityPtr clone(bool detach = false) override;
 
-    void refine();
+    // with a cache, frames of the same entity with unchanged topology skip re-indexing
+    void refine(MeshRefineCache *cache = nullptr);
     void makeDoubleSided();
     void mirrorMesh(const mu::float3& plane_n, float plane_d, bool welding = false);
     void transformMesh(const mu::float4x4& t);
     void mergeMesh(const Mesh& to_be_merged);
+    // replace per-vertex attributes with a patch against base. fails if the topology or other attributes differ,
+    // or more than max_ratio of the vertices are modified.
+    bool makeVertexPatch(const Mesh& base, float max_ratio = 0.25f);
 
     void setupBoneWeights4();
     void setupBoneWeightsVariable();
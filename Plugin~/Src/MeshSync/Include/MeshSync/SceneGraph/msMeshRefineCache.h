@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "MeshUtils/muRawVector.h"
+#include "MeshSync/MeshSyncConstants.h"
+#include "MeshSync/SceneGraph/msMesh.h" //SubmeshData
+
+namespace mu {
+struct MeshConnectionInfo;
+} // namespace mu
+
+namespace ms {
+
+// results of Mesh::refine() kept per entity. when a later frame of the same entity has the same topology,
+// refine() gathers the vertex attributes through the cached tables instead of re-indexing and splitting again.
+// used from multiple threads.
+class MeshRefineCache
+{
+public:
+    struct Record
+    {
+        uint64_t topology_hash = 0; // indices, counts, material ids and the settings that affect re-indexing
+        RawVector<int> new2old_points;  // new vertex to old vertex
+        RawVector<int> old2new_indices; // old index to new vertex in its split. used to check expanded attributes still fit
+        // new vertex to old index, for expanded (per-index) attributes. empty if the attribute was per-vertex
+        RawVector<int> remap_normals;
+        RawVector<int> remap_uv[MeshSyncConstants::MAX_UV];
+        RawVector<int> remap_colors;
+        RawVector<int> indices; // new indices, ordered by submeshes
+        RawVector<SubmeshData> submeshes;
+    };
+    using RecordPtr = std::shared_ptr<const Record>;
+    // vertex to face tables for smooth-angle normals. they only depend on the topology, so later frames reuse them
+    using ConnectionPtr = std::shared_ptr<const mu::MeshConnectionInfo>;
+
+    // returns null if there is no record for the id or the topology differs
+    RecordPtr find(int id, uint64_t topology_hash) const;
+    void store(int id, RecordPtr record);
+    ConnectionPtr findConnection(int id, uint64_t topology_hash) const;
+    void storeConnection(int id, uint64_t topology_hash, ConnectionPtr connection);
+    void erase(int id);
+    void clear();
+    size_t size() const;
+    uint64_t getNumHits() const;
+    void addHit();
+
+private:
+    mutable std::mutex m_mutex;
+    std::map<int, RecordPtr> m_records;
+    std::map<int, std::pair<uint64_t, ConnectionPtr>> m_connections;
+    std::atomic<uint64_t> m_num_hits{ 0 };
+};
+
+} // namespace ms
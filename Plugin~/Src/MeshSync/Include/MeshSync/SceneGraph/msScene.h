@@ -21,6 +21,8 @@ msDeclStructPtr(SceneImportSettings);
 
 namespace ms {
 
+class MeshRefineCache;
+
 struct SceneProfileData {
     uint64_t size_encoded;
     uint64_t size_decoded;
@@ -54,6 +56,7 @@ public:
 
     // non-serializable
     std::list<RawVector<char>> scene_buffers;
+    std::vector<std::shared_ptr<void>> external_buffers; // memory not owned by the scene but shared by its entities (memory-mapped cache file etc)
     std::vector<std::shared_ptr<Scene>> data_sources; // keep references for lerp sources etc
     SceneProfileData profile_data{};
 
@@ -78,7 +81,8 @@ public:
 
     static void sanitizeHierarchyPath(std::string& path);
     static void sanitizeObjectName(std::string& name);
-    void import(const SceneImportSettings& cv);
+    // refine_cache: lets frames of the same meshes with unchanged topology skip re-indexing. can be null
+    void import(const SceneImportSettings& cv, MeshRefineCache *refine_cache = nullptr);
 
     TransformPtr findEntity(const std::string& path) const;
     template<class AssetType> std::vector<std::shared_ptr<AssetType>> getAssets() const;
@@ -3,6 +3,7 @@
 #ifndef msRuntime
 
 #include "msIDGenerator.h"
+#include "msSceneDiffTracker.h"
 #include "MeshSync/MeshSync.h"
 #include "MeshSync/msClient.h"
 #include "MeshSync/SceneCache/msSceneCacheSettings.h"
@@ -53,6 +54,10 @@ class AsyncSceneSender : public AsyncSceneExporter
 public:
     int session_id = InvalidID;
     int message_count = 0;
+    int max_in_flight = 4; // textures and geometries are sent over up to this many connections at a time
+    uint64_t max_batch_size = 1024 * 1024; // messages smaller than this are packed into one request. 0 disables batching
+    bool send_changes_only = false; // skip what is unchanged since the last successful send. see SceneDiffTracker
+    SceneDiffTracker diff_tracker; // call diff_tracker.clear() to send everything in full again
 
     ClientSettings client_settings;
 
@@ -72,6 +77,7 @@ private:
 
     std::future<void> m_future;
     std::string m_error_message;
+    std::unique_ptr<Client> m_client; // kept across kick() to reuse its connections
 };
 
 
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "MeshSync/MeshSync.h" //msDeclClassPtr
+#include "MeshSync/SceneGraph/msIdentifier.h"
+
+msDeclClassPtr(Mesh)
+msDeclClassPtr(Transform)
+
+namespace ms {
+
+// remembers checksums of the entities sent last time (keyed by path) and reduces the next set of entities to
+// what has changed since then:
+// - entities identical to the last sent ones are removed.
+// - entities whose geometry is unchanged but transform is not are replaced by clones without geometry,
+//   flagged with MESH_DATA_FLAG_UNCHANGED etc. the receiver keeps the geometry it has.
+// - if vertex_patches is enabled, meshes with some vertices modified are replaced by MeshVertexPatch.
+// checksums are taken by filter() and remembered by commit(), which should be called after a successful send.
+class SceneDiffTracker
+{
+public:
+    // keeps a copy of each mesh sent and sends meshes modified partially (sculpting etc) as vertex patches.
+    // the receiver keeps the meshes too (see MESH_DATA_FLAG_PATCH_BASE).
+    bool vertex_patches = false;
+    float max_patch_ratio = 0.25f; // meshes with more modified vertices than this are sent in full
+
+    void filter(std::vector<TransformPtr>& entities);
+    void commit();
+    // the filtered entities were not delivered. they are compared with the last commit next time,
+    // or sent in full if vertex_patches is enabled
+    void discard();
+    void forget(const std::vector<Identifier>& entities); // deleted entities are sent in full when they come back
+    void clear(); // the receiver lost its state (reconnected etc). everything is sent in full next time
+
+private:
+    struct Record
+    {
+        uint64_t checksum_trans = 0;
+        uint64_t checksum_geom = 0;
+        MeshPtr patch_base; // the mesh as sent, if vertex_patches is enabled
+    };
+    std::map<std::string, Record> m_records;
+    std::vector<std::pair<std::string, Record>> m_pending;
+};
+
+} // namespace ms
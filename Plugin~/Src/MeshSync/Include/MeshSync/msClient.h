@@ -1,7 +1,16 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
+
 #include "msProtocol.h"
 
+namespace Poco {
+    namespace Net {
+        class HTTPClientSession;
+    }
+}
+
 namespace ms {
 
 struct ClientSettings
@@ -9,29 +18,58 @@ struct ClientSettings
     std::string server = "127.0.0.1";
     uint16_t port = 8080;
     int timeout_ms = 30000;
+    int max_connections = 4; // idle keep-alive connections kept for reuse. 0 disables keep-alive
+    int keep_alive_timeout_ms = 10000; // idle connections older than this are reconnected
+    bool shared_memory = false; // pass large messages through shared memory if the server is on the same machine
+    bool compression = false; // compress large messages with ZSTD if the server accepts it
+    int compression_level = 0; // ZSTD compression level. 0: adapt to the measured speed of the connection
 };
 
 class Client
 {
 public:
     Client(const ClientSettings& settings);
+    ~Client();
 
-    const std::string& getErrorMessage() const;
+    const ClientSettings& getSettings() const;
+    std::string getErrorMessage() const; // a copy. send() may update it from other threads
 
     // if failed, you can get reason by getErrorMessage()
     // (could not reach server, protocol version doesn't match, etc)
+    // also tells whether the server accepts compressed messages.
     bool isServerAvailable(int timeout_ms = 1000);
 
+    // send() can be called from multiple threads. connections are pooled.
     ScenePtr send(const GetMessage& mes);
     bool send(const SetMessage& mes);
     bool send(const DeleteMessage& mes);
     bool send(const FenceMessage& mes);
+    bool send(const BatchMessage& mes);
     ResponseMessagePtr send(const QueryMessage& mes);
     ResponseMessagePtr send(const QueryMessage& mes, int timeout_ms);
 
 private:
+    using SessionPtr = std::unique_ptr<Poco::Net::HTTPClientSession>;
+
+    // a pooled connection if there is a healthy one. otherwise a new one. reused tells which.
+    SessionPtr acquireSession(int timeout_ms, bool& reused);
+    void setErrorMessage(const char *mes);
+    void releaseSession(SessionPtr&& session);
+    template<class Handler>
+    bool post(const char *uri, const Message& mes, int timeout_ms, const Handler& on_response);
+    int getCompressionLevel() const;
+
     ClientSettings m_settings;
-    std::string m_error_message;
+    std::string m_error_message; // guarded by m_session_mutex
+
+    mutable std::mutex m_session_mutex;
+    std::mutex m_negotiation_mutex; // pipelined send()s ask the server about compression only once
+    std::vector<SessionPtr> m_sessions;
+    std::atomic_bool m_shared_memory_available{ true }; // cleared when the server refuses shared memory
+
+    enum class Compression { Unknown, Accepted, Refused };
+    std::atomic<Compression> m_compression{ Compression::Unknown }; // whether the server accepts compressed messages
+    std::atomic<float> m_link_speed{ 0.0f }; // compressed bytes per second the connection takes. 0 until measured
 };
 
 } // namespace ms
@@ -4,6 +4,7 @@
 #define msPluginVersionStr "0.6.1-preview"
 #define msVendor "Unity Technologies"
 #define msProtocolVersion 123
+#define msSceneCacheVersion 124 // layout of scene cache (.sc) files. must increase when the layout changes
 
 //#define msEnableProfiling
 //#define msRuntime
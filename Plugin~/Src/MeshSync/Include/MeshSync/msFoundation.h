@@ -8,7 +8,7 @@
 //Dependency to MeshUtils
 #include "MeshUtils/muRawVector.h" //SharedVector
 #include "MeshUtils/muMath.h" //mu::float4x4
-#include "MeshUtils/muSIMD.h" //SumInt32
+#include "MeshUtils/muSIMD.h" //SumInt32, HashInt32
 #include "MeshUtils/muStream.h" //MemoryStream
 
 #if defined(_MSC_VER)
@@ -78,6 +78,18 @@ inline void write_align(std::ostream& os, size_t written_size)
         os.write((const char*)&zero, 4 - (written_size % 4));
 }
 
+// large arrays are referenced in place instead of copied when serializing into a GatherStream
+inline void write_block(std::ostream& os, const void *data, size_t size)
+{
+    if (size >= mu::GatherStream::min_ref_size) {
+        if (auto *gs = dynamic_cast<mu::GatherStream*>(&os)) {
+            gs->writeRef(data, size);
+            return;
+        }
+    }
+    os.write((const char*)data, size);
+}
+
 template<>
 struct write_impl<bool>
 {
@@ -94,7 +106,7 @@ struct write_impl<SharedVector<T>>
     {
         auto size = (uint32_t)v.size();
         os.write((const char*)&size, sizeof(size));
-        os.write((const char*)v.cdata(), sizeof(T) * size);
+        write_block(os, v.cdata(), sizeof(T) * size);
         write_align(os, sizeof(T) * size); // keep 4 byte alignment
     }
 };
@@ -166,9 +178,14 @@ struct read_impl<SharedVector<T>>
         uint32_t size = 0;
         is.read((char*)&size, sizeof(size));
         if (typeid(is) == typeid(mu::MemoryStream)) {
-            // just share buffer (no copy)
+            // just share buffer (no copy). gskip() throws if size goes past the end of the buffer
             auto& ms = static_cast<mu::MemoryStream&>(is);
-            v.share((T*)ms.gskip(sizeof(T) * size), size);
+            v.share((T*)ms.gskip(sizeof(T) * (size_t)size), size);
+        }
+        else if (typeid(is) == typeid(mu::MemoryViewStream)) {
+            // share external memory (e.g. memory-mapped file). the owner must outlive v
+            auto& ms = static_cast<mu::MemoryViewStream&>(is);
+            v.share((const T*)ms.gskip(sizeof(T) * (size_t)size), size);
         }
         else {
             v.resize_discard(size);
@@ -337,12 +354,13 @@ struct csum_impl<std::vector<T>>
         return ret;
     }
 };
+// order sensitive. reordered elements (flipped winding, swapped vertices, etc) must change the checksum
 template<class T>
 struct csum_impl<SharedVector<T>>
 {
     uint64_t operator()(const SharedVector<T>& v) const
     {
-        return mu::SumInt32(v.cdata(), v.size_in_byte());
+        return mu::HashInt32(v.cdata(), v.size_in_byte());
     }
 };
 
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #include "MeshUtils/muMisc.h" //mu::nanosec
 
@@ -12,9 +14,15 @@
 #include "MeshSync/SceneGraph/msSceneSettings.h"
 
 
+msDeclClassPtr(Message)
 msDeclClassPtr(ResponseMessage)
 msDeclClassPtr(Scene)
 
+// request header of a message whose body is passed in shared memory: "<name> <size>"
+#define msSharedMemoryHeader "X-MeshSync-Shared-Memory"
+// Content-Encoding of compressed message bodies. the server lists it in Accept-Encoding of /protocol_version if it accepts it
+#define msContentEncodingZSTD "zstd"
+
 namespace ms {
 
 class Message
@@ -31,6 +39,7 @@ public:
         Screenshot,
         Query,
         Response,
+        Batch,
     };
     int protocol_version = msProtocolVersion;
     int session_id = InvalidID;
@@ -41,11 +50,27 @@ public:
     mu::nanosec timestamp_recv = 0;
 
     virtual ~Message();
+    virtual Type getType() const; // dispatch tag. avoids dynamic casts
     virtual void serialize(std::ostream& os) const;
     virtual void deserialize(std::istream& is); // throw
 };
 msSerializable(Message);
 
+// set when the host application has answered a request. HTTP handlers wait on it instead of polling.
+class ReadyFlag
+{
+public:
+    void set();
+    bool isSet() const;
+    // returns false on timeout
+    bool wait(int timeout_ms);
+
+private:
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_ready = false;
+};
+
 class GetMessage : public Message
 {
 using super = Message;
@@ -55,10 +80,11 @@ public:
     MeshRefineSettings refine_settings;
 
     // non-serializable fields
-    std::atomic_bool ready{ false };
+    ReadyFlag ready;
 
 public:
     GetMessage();
+    Message::Type getType() const override;
     void serialize(std::ostream& os) const override;
     void deserialize(std::istream& is) override;
 };
@@ -74,6 +100,7 @@ public:
 public:
     SetMessage();
     explicit SetMessage(ScenePtr scene);
+    Message::Type getType() const override;
     void serialize(std::ostream& os) const override;
     void deserialize(std::istream& is) override;
 };
@@ -88,6 +115,7 @@ public:
     std::vector<Identifier> materials;
 
     DeleteMessage();
+    Message::Type getType() const override;
     void serialize(std::ostream& os) const override;
     void deserialize(std::istream& is) override;
 };
@@ -108,12 +136,28 @@ public:
     FenceType type = FenceType::Unknown;
 
     ~FenceMessage() override;
+    Message::Type getType() const override;
     void serialize(std::ostream& os) const override;
     void deserialize(std::istream& is) override;
 };
 msSerializable(FenceMessage);
 
 
+// Set, Delete and Fence messages sent in one request. the server queues them in order, as if they were sent one by one.
+class BatchMessage : public Message
+{
+using super = Message;
+public:
+    std::vector<MessagePtr> messages;
+
+    BatchMessage();
+    Message::Type getType() const override;
+    void serialize(std::ostream& os) const override;
+    void deserialize(std::istream& is) override;
+};
+msSerializable(BatchMessage);
+
+
 class TextMessage : public Message
 {
 using super = Message;
@@ -126,6 +170,7 @@ public:
     };
 
     ~TextMessage() override;
+    Message::Type getType() const override;
     void serialize(std::ostream& os) const override;
     void deserialize(std::istream& is) override;
 
@@ -142,10 +187,11 @@ using super = Message;
 public:
 
     // non-serializable fields
-    std::atomic_bool ready{ false };
+    ReadyFlag ready;
 
 public:
     ScreenshotMessage();
+    Message::Type getType() const override;
     void serialize(std::ostream& os) const override;
     void deserialize(std::istream& is) override;
 };
@@ -159,6 +205,7 @@ public:
     std::vector<std::string> text;
 
     ResponseMessage();
+    Message::Type getType() const override;
     void serialize(std::ostream& os) const override;
     void deserialize(std::istream& is) override;
 };
@@ -183,10 +230,11 @@ public:
     QueryType query_type = QueryType::Unknown;
 
     // non-serializable fields
-    std::atomic_bool ready{ false };
+    ReadyFlag ready;
     ResponseMessagePtr response;
 
     QueryMessage();
+    Message::Type getType() const override;
     void serialize(std::ostream& os) const override;
     void deserialize(std::istream& is) override;
 };
@@ -205,7 +253,7 @@ public:
     PollType poll_type = PollType::Unknown;
 
     // non-serializable fields
-    std::atomic_bool ready{ false };
+    ReadyFlag ready;
 
     PollMessage();
     void serialize(std::ostream& os) const override;
@@ -2,11 +2,14 @@
 
 #include <list>
 #include <map>
+#include <deque>
 #include <mutex>
 #include <future>
 
+#include "MeshUtils/muConcurrency.h" //mpsc_queue
 #include "MeshSync/msProtocol.h"
 #include "MeshSync/SceneGraph/msSceneImportSettings.h"
+#include "MeshSync/SceneGraph/msMeshRefineCache.h"
 
 namespace Poco {
     namespace Net {
@@ -25,13 +28,30 @@ msDeclClassPtr(ScreenshotMessage)
 
 namespace ms {
 
+class ParkedRequests;
+class ParkedResponse;
+
 struct ServerSettings
 {
+    // shared with C# (ServerSettings in msNetworkAPI.cs). keep the layout
     int max_queue = 256;
     int max_threads = 8;
     uint16_t port = 8080;
 
     SceneImportSettings import_settings;
+
+    // C++ only
+    bool keep_alive = true; // serve multiple requests on one connection
+    int keep_alive_timeout_ms = 10000;
+    int max_keep_alive_requests = 0; // 0: unlimited
+    bool shared_memory = true; // accept message bodies in shared memory from clients on the same machine
+    bool compression = true; // accept ZSTD-compressed message bodies
+    int import_threads = 0; // threads importing received scenes. 0: number of cores. read on construction
+    // scenes are refused with 503 while the messages waiting for processMessages() take more than this. 0: unlimited
+    uint64_t max_pending_bytes = 1024 * 1024 * 1024;
+    int retry_after_sec = 1; // Retry-After of 503 responses
+    // meshes kept to apply vertex patches to. the least recently used ones are dropped beyond this. 0: unlimited
+    uint64_t max_patch_base_bytes = 256 * 1024 * 1024;
 };
 
 class Server {
@@ -48,8 +68,12 @@ public:
     inline void AllowPublicAccess(const bool access);
 
     using MessageHandler = std::function<void(Message::Type type, Message& data)>;
+    // all dispatchable messages at once, in the same order processMessages() would pass them.
+    // if there are multiple Get or Screenshot requests, the last one is current and earlier ones are released.
+    using BatchMessageHandler = std::function<void(int num_messages, const Message::Type *types, Message *const *messages)>;
     int getNumMessages() const;
     int processMessages(const MessageHandler& handler);
+    int processMessagesBatch(const BatchMessageHandler& handler);
 
     void serveText(Poco::Net::HTTPServerResponse &response, const char* text, int stat = 200);
     void serveBinary(Poco::Net::HTTPServerResponse &response, const void *data, size_t size, int stat = 200);
@@ -71,10 +95,12 @@ public:
     {
         MessagePtr message;
         std::future<void> task;
-        std::atomic_bool ready = { false };
+        std::shared_ptr<void> reservation; // counts the request in m_pending_bytes until dispatched
+        uint64_t seq = 0; // arrival order
 
         MessageHolder();
         MessageHolder(MessageHolder&& v);
+        MessageHolder& operator=(MessageHolder&& v);
     };
 
     Scene* getHostScene();
@@ -82,6 +108,7 @@ public:
     void recvSet(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response);
     void recvDelete(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response);
     void recvFence(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response);
+    void recvBatch(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response);
     void recvGet(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response);
     void recvQuery(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response);
     void recvText(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response);
@@ -91,11 +118,33 @@ public:
     static void sanitizeHierarchyPath(std::string& path);
 
 private:
-    template<class MessageT>
-    std::shared_ptr<MessageT> deserializeMessage(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response);
+    // counts a request body in m_pending_bytes while alive. grows as the body is read
+    struct MemoryReservation;
+    using MemoryReservationPtr = std::shared_ptr<MemoryReservation>;
 
-    MessageHolder* queueMessage(MessagePtr mes);
-    MessageHolder* queueMessage(MessagePtr mes, std::future<void>&& task);
+    template<class MessageT>
+    std::shared_ptr<MessageT> deserializeMessage(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response, MemoryReservation *reservation = nullptr);
+    std::shared_ptr<mu::SharedMemory> openRequestSharedMemory(Poco::Net::HTTPServerRequest& request);
+    bool applyVertexPatches(const std::vector<MessagePtr>& messages);
+    void erasePatchBases(const std::vector<Identifier>& entities);
+    MemoryReservationPtr admitRequest(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response);
+    void serveBusy(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response);
+    std::future<void> importAsync(SetMessagePtr mes);
+
+    void queueMessage(MessagePtr mes);
+    void queueMessage(MessagePtr mes, std::future<void>&& task, const std::shared_ptr<void>& reservation = nullptr);
+
+    // take received messages and return the ones that can be dispatched now, in dispatch order
+    void collectMessages(std::vector<MessageHolder>& dst);
+    void collectPendingMessages(std::vector<MessageHolder>& dst);
+    bool isDispatchable(const Message& mes) const;
+    void updateSceneSession(const Message& mes);
+    void waitTasks(std::vector<MessageHolder>& messages);
+    void updateSceneCache(std::vector<MessageHolder>& messages);
+    void setReady(ReadyFlag& flag);
+    // hand the connection over to m_parked_requests. returns false if the caller has to wait and answer by itself
+    bool parkRequest(Poco::Net::HTTPServerRequest& request, MessagePtr mes, ReadyFlag& flag, int timeout_ms,
+        std::function<void(bool ready, ParkedResponse& response)>&& respond);
 
     bool loadMIMETypes(const std::string& path);
     const std::string& getMIMEType(const std::string& filename);
@@ -113,17 +162,38 @@ private:
     std::map<std::string, std::string> m_mimetypes;
     std::mutex m_message_mutex;
     std::mutex m_poll_mutex;
+    std::mutex m_patch_mutex;
 
     int m_current_scene_session = InvalidID;
-    std::list<MessageHolder> m_received_messages, m_processing_messages;
+    mu::mpsc_queue<MessageHolder> m_received_messages; // pushed by HTTP threads, popped by processMessages()
+    std::atomic_int m_num_received_messages{ 0 };
+    uint64_t m_message_seq = 0;
+    // scene messages of sessions other than the current one. kept per session until the session becomes current
+    std::map<int, std::deque<MessageHolder>> m_session_messages;
     std::vector<SetMessagePtr> m_scene_cache;
     PollMessages m_polls;
+    struct PatchBase
+    {
+        MeshPtr mesh;
+        uint64_t size = 0; // bytes of the vertex and index arrays
+        uint64_t last_use = 0;
+    };
+    // raw (not imported) copies of meshes sent with MESH_DATA_FLAG_PATCH_BASE. vertex patches are applied to them
+    std::map<std::string, PatchBase> m_patch_bases;
+    uint64_t m_patch_base_bytes = 0;
+    uint64_t m_patch_base_uses = 0;
+    MeshRefineCache m_refine_cache; // re-indexing results of received meshes, reused while their topology is unchanged
 
     ScenePtr m_host_scene;
+    std::shared_ptr<const RawVector<char>> m_host_scene_data; // m_host_scene serialized for get requests
     GetMessagePtr m_current_get_request;
     ScreenshotMessagePtr m_current_screenshot_request;
     std::string m_screenshot_file_path;
     std::string m_file_root_path;
+
+    std::atomic<uint64_t> m_pending_bytes{ 0 }; // request bodies of the messages not dispatched yet
+    std::unique_ptr<mu::task_queue> m_import_queue; // runs the remaining imports on destruction
+    std::unique_ptr<ParkedRequests> m_parked_requests; // get, screenshot and poll requests waiting for the host. destroyed first
 };
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -1,12 +1,22 @@
 #include "pch.h"
 #include "MeshUtils/MeshUtils.h"
+#include "MeshUtils/muCompression.h"
 #include "msEncoder.h"
+#include "MeshSync/SceneGraph/msMesh.h"
+#include "MeshSync/NetworkData/msMeshDataFlags.h"
 
 #define ZSTD_STATIC_LINKING_ONLY
 #include <zstd.h>
 #include "MeshSync/SceneCache/msSceneCache.h"
 #pragma comment(lib, "libzstd_static.lib")
 
+// zdict.h is not part of External/zstd. the functions are in the static library.
+extern "C" {
+size_t ZDICT_trainFromBuffer(void *dictBuffer, size_t dictBufferCapacity,
+    const void *samplesBuffer, const size_t *samplesSizes, unsigned nbSamples);
+unsigned ZDICT_isError(size_t errorCode);
+}
+
 namespace ms {
 
 BufferEncoder::~BufferEncoder()
@@ -17,8 +27,9 @@ BufferEncoder::~BufferEncoder()
 class PlainBufferEncoder : public BufferEncoder
 {
 public:
+    using BufferEncoder::decode;
     void encode(RawVector<char>& dst, const RawVector<char>& src) override;
-    void decode(RawVector<char>& dst, const RawVector<char>& src) override;
+    void decode(RawVector<char>& dst, const char *src, size_t src_size) override;
 };
 
 void PlainBufferEncoder::encode(RawVector<char>& dst, const RawVector<char>& src)
@@ -26,9 +37,9 @@ void PlainBufferEncoder::encode(RawVector<char>& dst, const RawVector<char>& src
     dst = src;
 }
 
-void PlainBufferEncoder::decode(RawVector<char>& dst, const RawVector<char>& src)
+void PlainBufferEncoder::decode(RawVector<char>& dst, const char *src, size_t src_size)
 {
-    dst = src;
+    dst.assign(src, src + src_size);
 }
 
 BufferEncoderPtr CreatePlainEncoder() { return std::make_shared<PlainBufferEncoder>(); }
@@ -50,42 +61,616 @@ int GetZSTDDefaultCompressionLevel()
     return ZSTD_CLEVEL_DEFAULT;
 }
 
+// ZSTD contexts hold large work buffers. creating one per call dominates the cost of small buffers,
+// so contexts are recycled across calls and threads. (std::async may spawn a new thread for each task,
+// so thread_local storage would not be reused.)
+template<class Context, Context* (*Create)(), size_t (*Release)(Context*)>
+class ZSTDContextPool
+{
+public:
+    ~ZSTDContextPool()
+    {
+        for (auto *ctx : m_pool)
+            Release(ctx);
+    }
+
+    Context* acquire()
+    {
+        {
+            std::unique_lock<std::mutex> l(m_mutex);
+            if (!m_pool.empty()) {
+                auto *ret = m_pool.back();
+                m_pool.pop_back();
+                return ret;
+            }
+        }
+        return Create();
+    }
+
+    void release(Context *ctx)
+    {
+        std::unique_lock<std::mutex> l(m_mutex);
+        m_pool.push_back(ctx);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<Context*> m_pool;
+};
+using ZSTDCCtxPool = ZSTDContextPool<ZSTD_CCtx, ZSTD_createCCtx, ZSTD_freeCCtx>;
+using ZSTDDCtxPool = ZSTDContextPool<ZSTD_DCtx, ZSTD_createDCtx, ZSTD_freeDCtx>;
+
+static ZSTDCCtxPool& GetCCtxPool()
+{
+    static ZSTDCCtxPool s_pool;
+    return s_pool;
+}
+
+static ZSTDDCtxPool& GetDCtxPool()
+{
+    static ZSTDDCtxPool s_pool;
+    return s_pool;
+}
+
 class ZSTDBufferEncoder : public BufferEncoder
 {
 public:
-    ZSTDBufferEncoder(int cl);
+    using BufferEncoder::decode;
+    ZSTDBufferEncoder(int cl, int num_workers, const void *dict, size_t dict_size);
+    ~ZSTDBufferEncoder() override;
     void encode(RawVector<char>& dst, const RawVector<char>& src) override;
-    void decode(RawVector<char>& dst, const RawVector<char>& src) override;
+    void decode(RawVector<char>& dst, const char *src, size_t src_size) override;
 
 private:
     int m_compression_level;
+    int m_num_workers;
+    ZSTD_CDict *m_cdict = nullptr;
+    ZSTD_DDict *m_ddict = nullptr;
 };
 
-ZSTDBufferEncoder::ZSTDBufferEncoder(int cl)
+ZSTDBufferEncoder::ZSTDBufferEncoder(int cl, int num_workers, const void *dict, size_t dict_size)
 {
     m_compression_level = mu::clamp(cl, ZSTD_minCLevel(), ZSTD_maxCLevel());
+    m_num_workers = std::max(num_workers, 0);
+    if (dict && dict_size > 0) {
+        m_cdict = ZSTD_createCDict(dict, dict_size, m_compression_level);
+        m_ddict = ZSTD_createDDict(dict, dict_size);
+    }
+}
+
+ZSTDBufferEncoder::~ZSTDBufferEncoder()
+{
+    ZSTD_freeCDict(m_cdict);
+    ZSTD_freeDDict(m_ddict);
 }
 
 void ZSTDBufferEncoder::encode(RawVector<char>& dst, const RawVector<char>& src)
 {
+    auto& pool = GetCCtxPool();
+    ZSTD_CCtx *ctx = pool.acquire();
+
+    // parameters are sticky. restore defaults as the context may have been used by another encoder.
+    ZSTD_CCtx_reset(ctx, ZSTD_reset_session_and_parameters);
+    ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, m_compression_level);
+    if (m_num_workers > 0)
+        ZSTD_CCtx_setParameter(ctx, ZSTD_c_nbWorkers, m_num_workers); // fails silently if zstd is built without multithread support
+    if (m_cdict)
+        ZSTD_CCtx_refCDict(ctx, m_cdict);
+
     size_t size = ZSTD_compressBound(src.size());
     dst.resize_discard(size);
-    size_t csize = ZSTD_compress(dst.data(), dst.size(), src.data(), src.size(), m_compression_level);
-    dst.resize(csize);
+    size_t csize = ZSTD_compress2(ctx, dst.data(), dst.size(), src.data(), src.size());
+    dst.resize(ZSTD_isError(csize) ? 0 : csize);
+
+    pool.release(ctx);
 }
 
-void ZSTDBufferEncoder::decode(RawVector<char>& dst, const RawVector<char>& src)
+void ZSTDBufferEncoder::decode(RawVector<char>& dst, const char *src, size_t src_size)
 {
-    size_t dsize = (size_t)ZSTD_findDecompressedSize(src.data(), src.size());
+    auto& pool = GetDCtxPool();
+    ZSTD_DCtx *ctx = pool.acquire();
+
+    size_t dsize = (size_t)ZSTD_findDecompressedSize(src, src_size);
     dst.resize_discard(dsize);
-    dsize = ZSTD_decompress(dst.data(), dst.size(), src.data(), src.size());
+    if (m_ddict)
+        dsize = ZSTD_decompress_usingDDict(ctx, dst.data(), dst.size(), src, src_size, m_ddict);
+    else
+        dsize = ZSTD_decompressDCtx(ctx, dst.data(), dst.size(), src, src_size);
+    dst.resize(ZSTD_isError(dsize) ? 0 : dsize);
+
+    pool.release(ctx);
+}
+
+BufferEncoderPtr CreateZSTDEncoder(int compression_level, int num_workers, const void *dictionary, size_t dictionary_size)
+{
+    return std::make_shared<ZSTDBufferEncoder>(compression_level, num_workers, dictionary, dictionary_size);
+}
+
+bool TrainZSTDDictionary(RawVector<char>& dst, size_t capacity, const std::vector<const RawVector<char>*>& samples)
+{
+    // the trainer only needs representative data. cap the samples to keep training time reasonable.
+    const size_t max_sample_size = 128 * 1024;
+    const size_t max_total_size = 16 * 1024 * 1024;
+
+    RawVector<char> sample_buf;
+    std::vector<size_t> sample_sizes;
+    for (auto *sample : samples) {
+        size_t size = std::min(sample->size(), max_sample_size);
+        if (size == 0)
+            continue;
+        if (sample_buf.size() + size > max_total_size)
+            break;
+        sample_buf.insert(sample_buf.end(), sample->cdata(), sample->cdata() + size);
+        sample_sizes.push_back(size);
+    }
+
+    dst.clear();
+    // the trainer needs a handful of samples and more data than the dictionary itself
+    if (sample_sizes.size() < 8 || sample_buf.size() < capacity)
+        return false;
+
+    dst.resize_discard(capacity);
+    size_t dsize = ZDICT_trainFromBuffer(dst.data(), dst.size(), sample_buf.cdata(), sample_sizes.data(), (unsigned)sample_sizes.size());
+    if (ZDICT_isError(dsize)) {
+        dst.clear();
+        return false;
+    }
     dst.resize(dsize);
+    return true;
+}
+
+bool CompressZSTDStream(const std::vector<mu::GatherStream::Segment>& src, uint64_t src_size, int compression_level,
+    const std::function<void(const char *data, size_t size)>& write)
+{
+    auto& pool = GetCCtxPool();
+    ZSTD_CCtx *ctx = pool.acquire();
+    ZSTD_CCtx_reset(ctx, ZSTD_reset_session_and_parameters);
+    ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, mu::clamp(compression_level, ZSTD_minCLevel(), ZSTD_maxCLevel()));
+    // stored in the frame header. the receiver allocates the whole buffer at once
+    ZSTD_CCtx_setPledgedSrcSize(ctx, src_size);
+
+    RawVector<char> buf;
+    buf.resize_discard(ZSTD_CStreamOutSize());
+    auto compress = [&](ZSTD_inBuffer& in, ZSTD_EndDirective mode) {
+        for (;;) {
+            ZSTD_outBuffer out{ buf.data(), buf.size(), 0 };
+            size_t r = ZSTD_compressStream2(ctx, &out, &in, mode);
+            if (ZSTD_isError(r))
+                return false;
+            if (out.pos > 0)
+                write(buf.data(), out.pos);
+            if (mode == ZSTD_e_end ? r == 0 : in.pos == in.size)
+                return true;
+        }
+    };
+
+    bool ret = true;
+    try {
+        for (auto& seg : src) {
+            ZSTD_inBuffer in{ seg.data, seg.size, 0 };
+            if (!(ret = compress(in, ZSTD_e_continue)))
+                break;
+        }
+        if (ret) {
+            ZSTD_inBuffer in{ nullptr, 0, 0 };
+            ret = compress(in, ZSTD_e_end);
+        }
+    }
+    catch (...) {
+        // write() failed (connection lost etc)
+        pool.release(ctx);
+        throw;
+    }
+    pool.release(ctx);
+    return ret;
+}
+
+bool DecompressZSTDStream(RawVector<char>& dst, std::istream& src, const std::function<bool(size_t size)>& reserve)
+{
+    auto& pool = GetDCtxPool();
+    ZSTD_DCtx *ctx = pool.acquire();
+    ZSTD_DCtx_reset(ctx, ZSTD_reset_session_and_parameters);
+
+    RawVector<char> buf;
+    buf.resize_discard(ZSTD_DStreamInSize());
+    dst.clear();
+    size_t dst_size = 0;
+    size_t r = 1; // 0 when the frame is complete
+    bool ret = true;
+    while (ret && r != 0 && src) {
+        src.read(buf.data(), buf.size());
+        size_t n = (size_t)src.gcount();
+        if (n == 0)
+            break;
+        if (dst.empty()) {
+            auto content_size = ZSTD_getFrameContentSize(buf.data(), n);
+            if (content_size != ZSTD_CONTENTSIZE_UNKNOWN && content_size != ZSTD_CONTENTSIZE_ERROR && content_size <= 0xffffffffULL) {
+                if (reserve && !reserve((size_t)content_size)) {
+                    ret = false;
+                    break;
+                }
+                dst.resize_discard((size_t)content_size);
+            }
+        }
+
+        ZSTD_inBuffer in{ buf.data(), n, 0 };
+        for (;;) {
+            if (dst_size == dst.size()) {
+                const size_t new_size = std::max(dst.size() * 2, ZSTD_DStreamOutSize());
+                if (reserve && !reserve(new_size)) {
+                    ret = false;
+                    break;
+                }
+                dst.resize(new_size);
+            }
+            ZSTD_outBuffer out{ dst.data() + dst_size, dst.size() - dst_size, 0 };
+            r = ZSTD_decompressStream(ctx, &out, &in);
+            if (ZSTD_isError(r)) {
+                ret = false;
+                break;
+            }
+            dst_size += out.pos;
+            if (r == 0 || (in.pos == in.size && out.pos < out.size))
+                break;
+        }
+    }
+    dst.resize(dst_size);
+
+    pool.release(ctx);
+    return ret && r == 0;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------------
+
+MeshEncodeSettings::MeshEncodeSettings()
+{
+    quantize_points = 0;
+    quantize_normals = 0;
+    quantize_tangents = 0;
+    quantize_uv = 0;
+    quantize_colors = 0;
+    quantize_velocities = 0;
+}
+
+bool MeshEncodeSettings::any() const
+{
+    return quantize_points || quantize_normals || quantize_tangents ||
+        quantize_uv || quantize_colors || quantize_velocities;
+}
+
+MeshEncoder::~MeshEncoder()
+{
+}
+
+
+// bit index of each attribute in the block mask
+enum MeshEncodeAttribute
+{
+    MESH_ENCODE_POINTS,
+    MESH_ENCODE_NORMALS,
+    MESH_ENCODE_TANGENTS,
+    MESH_ENCODE_COLORS,
+    MESH_ENCODE_VELOCITIES,
+    MESH_ENCODE_UV0,
+};
+
+template<class T>
+static void WritePacked(std::ostream& os, const RawVector<T>& v)
+{
+    auto size = (uint32_t)v.size();
+    os.write((const char*)&size, sizeof(size));
+    os.write((const char*)v.cdata(), v.size_in_byte());
+    write_align(os, v.size_in_byte());
+}
+
+template<class T>
+static void ReadPacked(std::istream& is, RawVector<T>& v)
+{
+    uint32_t size = 0;
+    is.read((char*)&size, sizeof(size));
+    v.resize_discard(size);
+    is.read((char*)v.data(), v.size_in_byte());
+    read_align(is, v.size_in_byte());
+}
+
+// Bounded16: bound_min, bound_max, unorm16 array
+template<class Packed, class Plain>
+static void WriteBounded(std::ostream& os, const SharedVector<Plain>& src)
+{
+    mu::BoundedArray<Packed, Plain> ba;
+    mu::encode(ba, src.cdata(), src.size());
+    write(os, VertexArrayEncoding::Bounded16);
+    write(os, ba.bound_min);
+    write(os, ba.bound_max);
+    WritePacked(os, ba.packed);
+}
+
+// S16: snorm16 array
+template<class Packed, class Plain>
+static void WriteNormalized(std::ostream& os, const SharedVector<Plain>& src)
+{
+    mu::PackedArray<Packed> pa;
+    mu::encode(pa, src.cdata(), src.size());
+    write(os, VertexArrayEncoding::S16);
+    WritePacked(os, pa.packed);
+}
+
+template<class Plain, class Bounded, class Normalized>
+static bool ReadArray(std::istream& is, SharedVector<Plain>& dst)
+{
+    auto encoding = VertexArrayEncoding::Empty;
+    read(is, encoding);
+    switch (encoding) {
+    case VertexArrayEncoding::Bounded16:
+    {
+        Bounded ba;
+        read(is, ba.bound_min);
+        read(is, ba.bound_max);
+        ReadPacked(is, ba.packed);
+        dst.resize_discard(ba.packed.size());
+        mu::decode(dst.data(), ba);
+        return true;
+    }
+    case VertexArrayEncoding::S16:
+    {
+        Normalized pa;
+        ReadPacked(is, pa.packed);
+        dst.resize_discard(pa.packed.size());
+        mu::decode(dst.data(), pa);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+class QuantizeMeshEncoder : public MeshEncoder
+{
+public:
+    QuantizeMeshEncoder(const MeshEncodeSettings& settings);
+    void encode(std::ostream& dst, Mesh& src) override;
+    void decode(Mesh& dst, std::istream& src) override;
+
+private:
+    MeshEncodeSettings m_settings;
+};
+
+QuantizeMeshEncoder::QuantizeMeshEncoder(const MeshEncodeSettings& settings)
+    : m_settings(settings)
+{
+}
+
+void QuantizeMeshEncoder::encode(std::ostream& os, Mesh& mesh)
+{
+    uint32_t mask = 0;
+    if (!mesh.md_flags.Get(MESH_DATA_FLAG_UNCHANGED)) {
+        auto check = [&mask](bool enabled, const auto& data, int bit) {
+            if (enabled && !data.empty())
+                mask |= 1u << bit;
+        };
+        check(m_settings.quantize_points, mesh.points, MESH_ENCODE_POINTS);
+        check(m_settings.quantize_normals, mesh.normals, MESH_ENCODE_NORMALS);
+        check(m_settings.quantize_tangents, mesh.tangents, MESH_ENCODE_TANGENTS);
+        check(m_settings.quantize_colors, mesh.colors, MESH_ENCODE_COLORS);
+        check(m_settings.quantize_velocities, mesh.velocities, MESH_ENCODE_VELOCITIES);
+        for (uint32_t i = 0; i < MeshSyncConstants::MAX_UV; ++i)
+            check(m_settings.quantize_uv, mesh.m_uv[i], MESH_ENCODE_UV0 + i);
+    }
+    write(os, mask);
+    if (mask == 0)
+        return;
+
+    // quantized arrays are removed from the mesh so that Mesh::serialize() doesn't write them again
+    auto has = [mask](int bit) { return (mask & (1u << bit)) != 0; };
+    if (has(MESH_ENCODE_POINTS)) {
+        WriteBounded<mu::unorm16x3>(os, mesh.points);
+        mesh.points.clear();
+        mesh.md_flags.Set(MESH_DATA_FLAG_HAS_POINTS, false);
+    }
+    if (has(MESH_ENCODE_NORMALS)) {
+        WriteNormalized<mu::snorm16x3>(os, mesh.normals);
+        mesh.normals.clear();
+        mesh.md_flags.Set(MESH_DATA_FLAG_HAS_NORMALS, false);
+    }
+    if (has(MESH_ENCODE_TANGENTS)) {
+        WriteNormalized<mu::snorm16x4>(os, mesh.tangents);
+        mesh.tangents.clear();
+        mesh.md_flags.Set(MESH_DATA_FLAG_HAS_TANGENTS, false);
+    }
+    if (has(MESH_ENCODE_COLORS)) {
+        WriteBounded<mu::unorm16x4>(os, mesh.colors);
+        mesh.colors.clear();
+        mesh.md_flags.Set(MESH_DATA_FLAG_HAS_COLORS, false);
+    }
+    if (has(MESH_ENCODE_VELOCITIES)) {
+        WriteBounded<mu::unorm16x3>(os, mesh.velocities);
+        mesh.velocities.clear();
+        mesh.md_flags.Set(MESH_DATA_FLAG_HAS_VELOCITIES, false);
+    }
+    for (uint32_t i = 0; i < MeshSyncConstants::MAX_UV; ++i) {
+        if (has(MESH_ENCODE_UV0 + i)) {
+            WriteBounded<mu::unorm16x2>(os, mesh.m_uv[i]);
+            mesh.m_uv[i].clear();
+            mesh.md_flags.SetUV(i, false);
+        }
+    }
+}
+
+void QuantizeMeshEncoder::decode(Mesh& mesh, std::istream& is)
+{
+    uint32_t mask = 0;
+    read(is, mask);
+    if (mask == 0)
+        return;
+
+    auto has = [mask](int bit) { return (mask & (1u << bit)) != 0; };
+    if (has(MESH_ENCODE_POINTS))
+        mesh.md_flags.Set(MESH_DATA_FLAG_HAS_POINTS,
+            ReadArray<mu::float3, mu::BoundedArrayU16x3, mu::PackedArrayS16x3>(is, mesh.points));
+    if (has(MESH_ENCODE_NORMALS))
+        mesh.md_flags.Set(MESH_DATA_FLAG_HAS_NORMALS,
+            ReadArray<mu::float3, mu::BoundedArrayU16x3, mu::PackedArrayS16x3>(is, mesh.normals));
+    if (has(MESH_ENCODE_TANGENTS))
+        mesh.md_flags.Set(MESH_DATA_FLAG_HAS_TANGENTS,
+            ReadArray<mu::float4, mu::BoundedArrayU16x4, mu::PackedArrayS16x4>(is, mesh.tangents));
+    if (has(MESH_ENCODE_COLORS))
+        mesh.md_flags.Set(MESH_DATA_FLAG_HAS_COLORS,
+            ReadArray<mu::float4, mu::BoundedArrayU16x4, mu::PackedArrayS16x4>(is, mesh.colors));
+    if (has(MESH_ENCODE_VELOCITIES))
+        mesh.md_flags.Set(MESH_DATA_FLAG_HAS_VELOCITIES,
+            ReadArray<mu::float3, mu::BoundedArrayU16x3, mu::PackedArrayS16x3>(is, mesh.velocities));
+    for (uint32_t i = 0; i < MeshSyncConstants::MAX_UV; ++i) {
+        if (has(MESH_ENCODE_UV0 + i))
+            mesh.md_flags.SetUV(i, ReadArray<mu::float2, mu::BoundedArrayU16x2, mu::PackedArrayS16x2>(is, mesh.m_uv[i]));
+    }
 }
 
-BufferEncoderPtr CreateZSTDEncoder(int compression_level)
+MeshEncoderPtr CreateQuantizeMeshEncoder(const MeshEncodeSettings& settings)
 {
-    return std::make_shared<ZSTDBufferEncoder>(compression_level);
+    return std::make_shared<QuantizeMeshEncoder>(settings);
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+
+// deltas are stored per component (x of all vertices, then y, ...) so that each bit plane holds one component
+template<class T>
+static void WriteDelta(std::ostream& os, const SharedVector<T>& src, const SharedVector<T>& ref)
+{
+    const size_t num_components = sizeof(T) / 4;
+    static_assert(sizeof(T) % 4 == 0, "");
+    const size_t num = src.size();
+    auto *s = (const uint32_t*)src.cdata();
+    auto *r = (const uint32_t*)ref.cdata();
+
+    RawVector<uint32_t> delta;
+    delta.resize_discard(num * num_components);
+    for (size_t i = 0; i < num; ++i) {
+        for (size_t c = 0; c < num_components; ++c) {
+            size_t wi = i * num_components + c;
+            delta[c * num + i] = s[wi] ^ r[wi];
+        }
+    }
+
+    RawVector<uint8_t> shuffled;
+    shuffled.resize_discard(delta.size_in_byte());
+    for (size_t c = 0; c < num_components; ++c)
+        mu::BitShuffle32(shuffled.data() + c * num * 4, delta.cdata() + c * num, num);
+    WritePacked(os, shuffled);
+}
+
+template<class T>
+static void ReadDelta(std::istream& is, SharedVector<T>& dst, const SharedVector<T>& ref)
+{
+    const size_t num_components = sizeof(T) / 4;
+    RawVector<uint8_t> shuffled;
+    ReadPacked(is, shuffled);
+
+    const size_t num = shuffled.size() / sizeof(T);
+    if (ref.size() != num)
+        throw std::runtime_error("[MeshSync] reference mismatch in temporal delta");
+
+    RawVector<uint32_t> delta;
+    delta.resize_discard(num * num_components);
+    for (size_t c = 0; c < num_components; ++c)
+        mu::BitUnshuffle32(delta.data() + c * num, shuffled.cdata() + c * num * 4, num);
+
+    dst.resize_discard(num);
+    auto *d = (uint32_t*)dst.data();
+    auto *r = (const uint32_t*)ref.cdata();
+    for (size_t i = 0; i < num; ++i) {
+        for (size_t c = 0; c < num_components; ++c) {
+            size_t wi = i * num_components + c;
+            d[wi] = delta[c * num + i] ^ r[wi];
+        }
+    }
+}
+
+// prediction only pays off if most values stay close to the reference.
+// "close" here means sign, exponent and the top 3 bits of mantissa are the same.
+template<class T>
+static bool IsPredictable(const SharedVector<T>& data, const SharedVector<T>& ref)
+{
+    const size_t num_words = data.size() * (sizeof(T) / 4);
+    auto *s = (const uint32_t*)data.cdata();
+    auto *r = (const uint32_t*)ref.cdata();
+    size_t num_close = 0;
+    for (size_t i = 0; i < num_words; ++i) {
+        if (((s[i] ^ r[i]) >> 20) == 0)
+            ++num_close;
+    }
+    return num_close * 4 >= num_words * 3;
+}
+
+void EncodeMeshDelta(std::ostream& os, Mesh& mesh, const Mesh *reference)
+{
+    uint32_t mask = 0;
+    if (reference && !mesh.md_flags.Get(MESH_DATA_FLAG_UNCHANGED)) {
+        auto check = [&mask](const auto& data, const auto& ref, int bit) {
+            if (!data.empty() && data.size() == ref.size() && IsPredictable(data, ref))
+                mask |= 1u << bit;
+        };
+        check(mesh.points, reference->points, MESH_ENCODE_POINTS);
+        check(mesh.normals, reference->normals, MESH_ENCODE_NORMALS);
+        check(mesh.tangents, reference->tangents, MESH_ENCODE_TANGENTS);
+        check(mesh.colors, reference->colors, MESH_ENCODE_COLORS);
+        check(mesh.velocities, reference->velocities, MESH_ENCODE_VELOCITIES);
+        for (uint32_t i = 0; i < MeshSyncConstants::MAX_UV; ++i)
+            check(mesh.m_uv[i], reference->m_uv[i], MESH_ENCODE_UV0 + i);
+    }
+    write(os, mask);
+    if (mask == 0)
+        return;
+
+    auto has = [mask](int bit) { return (mask & (1u << bit)) != 0; };
+    auto encode = [&](auto& data, const auto& ref, int bit, int flag) {
+        if (!has(bit))
+            return;
+        WriteDelta(os, data, ref);
+        data.clear();
+        mesh.md_flags.Set(flag, false);
+    };
+    encode(mesh.points, reference->points, MESH_ENCODE_POINTS, MESH_DATA_FLAG_HAS_POINTS);
+    encode(mesh.normals, reference->normals, MESH_ENCODE_NORMALS, MESH_DATA_FLAG_HAS_NORMALS);
+    encode(mesh.tangents, reference->tangents, MESH_ENCODE_TANGENTS, MESH_DATA_FLAG_HAS_TANGENTS);
+    encode(mesh.colors, reference->colors, MESH_ENCODE_COLORS, MESH_DATA_FLAG_HAS_COLORS);
+    encode(mesh.velocities, reference->velocities, MESH_ENCODE_VELOCITIES, MESH_DATA_FLAG_HAS_VELOCITIES);
+    for (uint32_t i = 0; i < MeshSyncConstants::MAX_UV; ++i) {
+        if (has(MESH_ENCODE_UV0 + i)) {
+            WriteDelta(os, mesh.m_uv[i], reference->m_uv[i]);
+            mesh.m_uv[i].clear();
+            mesh.md_flags.SetUV(i, false);
+        }
+    }
+}
+
+void DecodeMeshDelta(Mesh& mesh, std::istream& is, const Mesh *reference)
+{
+    uint32_t mask = 0;
+    read(is, mask);
+    if (mask == 0)
+        return;
+    if (!reference)
+        throw std::runtime_error("[MeshSync] reference mesh not found in temporal delta");
+
+    auto has = [mask](int bit) { return (mask & (1u << bit)) != 0; };
+    auto decode = [&](auto& data, const auto& ref, int bit, int flag) {
+        if (!has(bit))
+            return;
+        ReadDelta(is, data, ref);
+        mesh.md_flags.Set(flag, true);
+    };
+    decode(mesh.points, reference->points, MESH_ENCODE_POINTS, MESH_DATA_FLAG_HAS_POINTS);
+    decode(mesh.normals, reference->normals, MESH_ENCODE_NORMALS, MESH_DATA_FLAG_HAS_NORMALS);
+    decode(mesh.tangents, reference->tangents, MESH_ENCODE_TANGENTS, MESH_DATA_FLAG_HAS_TANGENTS);
+    decode(mesh.colors, reference->colors, MESH_ENCODE_COLORS, MESH_DATA_FLAG_HAS_COLORS);
+    decode(mesh.velocities, reference->velocities, MESH_ENCODE_VELOCITIES, MESH_DATA_FLAG_HAS_VELOCITIES);
+    for (uint32_t i = 0; i < MeshSyncConstants::MAX_UV; ++i) {
+        if (has(MESH_ENCODE_UV0 + i)) {
+            ReadDelta(is, mesh.m_uv[i], reference->m_uv[i]);
+            mesh.md_flags.SetUV(i, true);
+        }
+    }
+}
 
 } // namespace ms
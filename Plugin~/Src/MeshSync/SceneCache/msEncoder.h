@@ -3,6 +3,7 @@
 #include "MeshSync/SceneGraph/msScene.h"
 
 msDeclClassPtr(BufferEncoder);
+msDeclClassPtr(MeshEncoder);
 msDeclClassPtr(Mesh);
 
 namespace ms {
@@ -12,20 +13,24 @@ class BufferEncoder
 public:
     virtual ~BufferEncoder();
     virtual void encode(RawVector<char>& dst, const RawVector<char>& src) = 0;
-    virtual void decode(RawVector<char>& dst, const RawVector<char>& src) = 0;
+    virtual void decode(RawVector<char>& dst, const char *src, size_t src_size) = 0;
+
+    void decode(RawVector<char>& dst, const RawVector<char>& src) { decode(dst, src.cdata(), src.size()); }
 };
 
 BufferEncoderPtr CreatePlainEncoder();
-BufferEncoderPtr CreateZSTDEncoder(int compression_level);
-
+// num_workers > 0 compresses a buffer with multiple threads. dictionary is optional.
+BufferEncoderPtr CreateZSTDEncoder(int compression_level, int num_workers = 0, const void *dictionary = nullptr, size_t dictionary_size = 0);
+// train a dictionary of up to capacity byte. returns false if samples are too few to train.
+bool TrainZSTDDictionary(RawVector<char>& dst, size_t capacity, const std::vector<const RawVector<char>*>& samples);
 
-class MeshEncoder
-{
-public:
-    virtual ~MeshEncoder();
-    virtual void encode(RawVector<char>& dst, const Mesh&& src) = 0;
-    virtual void decode(Mesh& dst, const RawVector<char>& src) = 0;
-};
+// streaming ZSTD for message bodies on the network. the compressed data is passed to write as it is produced,
+// so neither side holds a second copy of the whole body.
+bool CompressZSTDStream(const std::vector<mu::GatherStream::Segment>& src, uint64_t src_size, int compression_level,
+    const std::function<void(const char *data, size_t size)>& write);
+// dst is allocated once if the stream tells the size of the content. returns false if the stream is broken.
+// reserve is called with the new size before dst grows. decompression stops and returns false if it returns false.
+bool DecompressZSTDStream(RawVector<char>& dst, std::istream& src, const std::function<bool(size_t size)>& reserve = nullptr);
 
 
 enum class VertexArrayEncoding
@@ -37,6 +42,7 @@ enum class VertexArrayEncoding
     Bounded8,
     Bounded16,
     S10x3,
+    S16, // per-component snorm16. for normalized vectors
 
     // int array encodings
     I8,
@@ -54,6 +60,27 @@ struct MeshEncodeSettings
     uint32_t quantize_uv : 1;
     uint32_t quantize_colors : 1;
     uint32_t quantize_velocities : 1;
+
+    MeshEncodeSettings();
+    bool any() const;
 };
 
+// encodes vertex arrays of a mesh into a separate block.
+// encode() writes the quantized arrays to dst and removes them from src. decode() restores them.
+class MeshEncoder
+{
+public:
+    virtual ~MeshEncoder();
+    virtual void encode(std::ostream& dst, Mesh& src) = 0;
+    virtual void decode(Mesh& dst, std::istream& src) = 0;
+};
+
+MeshEncoderPtr CreateQuantizeMeshEncoder(const MeshEncodeSettings& settings);
+
+// temporal prediction of vertex arrays against a reference (key) frame.
+// float bits are xor-ed with the reference and bit-plane shuffled so that small motions turn into runs of zeros.
+// lossless. arrays that have no counterpart of the same size in reference are left in the mesh.
+void EncodeMeshDelta(std::ostream& dst, Mesh& mesh, const Mesh *reference);
+void DecodeMeshDelta(Mesh& mesh, std::istream& src, const Mesh *reference);
+
 } // namespace ms
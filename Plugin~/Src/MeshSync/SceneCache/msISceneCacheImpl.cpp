@@ -5,56 +5,74 @@
 #include "MeshUtils/muLog.h"
 
 #include "MeshSync/SceneGraph/msTransform.h"
+#include "MeshSync/SceneGraph/msMesh.h"
 
 
 namespace ms {
 
 ISceneCacheImpl::ISceneCacheImpl(StreamPtr ist, const ISceneCacheSettings& iscs)
+    : ISceneCacheImpl(ist, nullptr, iscs)
+{
+}
+
+ISceneCacheImpl::ISceneCacheImpl(StreamPtr ist, MappedFilePtr mapped, const ISceneCacheSettings& iscs)
 {
     m_ist = ist;
+    m_mapped = mapped;
     m_iscs = iscs;
+    if (m_mapped)
+        m_ist = std::make_shared<mu::MemoryViewStream>(m_mapped->data(), m_mapped->size());
     if (!m_ist || !(*m_ist))
         return;
 
     m_header.version = 0;
     m_ist->read((char*)&m_header, sizeof(m_header));
-    if (m_header.version != msProtocolVersion)
+    const bool legacy = m_header.version == msSceneCacheVersionLegacy;
+    if (legacy) {
+        // none of these existed. the bits may be garbage
+        m_header.oscs.quantize_points = 0;
+        m_header.oscs.quantize_normals = 0;
+        m_header.oscs.quantize_tangents = 0;
+        m_header.oscs.quantize_uv = 0;
+        m_header.oscs.quantize_colors = 0;
+        m_header.oscs.quantize_velocities = 0;
+        m_header.oscs.temporal_delta = 0;
+        m_header.oscs.zstd_dictionary = 0;
+    }
+    else if (m_header.version != msSceneCacheVersion)
         return;
 
-    m_encoder = CreateEncoder(m_header.oscs.encoding, m_header.oscs.encoder_settings);
+    if (m_header.oscs.zstd_dictionary) {
+        CacheFileDictionaryHeader dh;
+        m_ist->read((char*)&dh, sizeof(dh));
+
+        RawVector<char> dictionary;
+        dictionary.resize_discard((size_t)dh.size);
+        m_ist->read(dictionary.data(), dictionary.size());
+        if (!(*m_ist))
+            return;
+        if (!dictionary.empty())
+            m_encoder = CreateEncoder(m_header.oscs.encoding, m_header.oscs.encoder_settings, 0, &dictionary);
+    }
+    if (!m_encoder)
+        m_encoder = CreateEncoder(m_header.oscs.encoding, m_header.oscs.encoder_settings);
     if (!m_encoder) {
         // encoder associated with m_settings.encoding is not available
         return;
     }
+    m_mesh_encoder = CreateMeshEncoder(m_header.oscs);
 
-    m_records.reserve(512);
-    for (;;) {
-        // enumerate all scene headers
-        CacheFileSceneHeader sh;
-        m_ist->read((char*)&sh, sizeof(sh));
-        if (sh.buffer_count == 0) {
-            // empty header is a terminator
-            break;
-        }
-        else {
-            SceneRecord rec;
-            rec.time = sh.time;
-
-            rec.buffer_sizes.resize_discard(sh.buffer_count);
-            m_ist->read((char*)rec.buffer_sizes.data(), rec.buffer_sizes.size_in_byte());
-            rec.pos = (uint64_t)m_ist->tellg();
-
-            rec.buffer_size_total = 0;
-            for (auto s : rec.buffer_sizes)
-                rec.buffer_size_total += s;
-
-            rec.segments.resize(sh.buffer_count);
-
-            m_records.emplace_back(std::move(rec));
-            m_ist->seekg(rec.buffer_size_total, std::ios::cur);
-        }
+    {
+        const std::streamoff records_pos = m_ist->tellg();
+        m_ist->seekg(0, std::ios::end);
+        m_file_size = (uint64_t)m_ist->tellg();
+        m_ist->seekg(records_pos, std::ios::beg);
     }
 
+    // files written by older versions have no index. enumerate scene headers in that case.
+    if (legacy || !readIndex())
+        scanRecords();
+
     const size_t scene_count = m_records.size();
     std::sort(m_records.begin(), m_records.end(), [](auto& a, auto& b) { return a.time < b.time; });
 
@@ -72,6 +90,8 @@ ISceneCacheImpl::ISceneCacheImpl(StreamPtr ist, const ISceneCacheSettings& iscs)
         // read meta data
         CacheFileMetaHeader mh;
         m_ist->read((char*)&mh, sizeof(mh));
+        if (!(*m_ist) || mh.size > m_file_size)
+            mh.size = 0; // truncated or broken
 
         encoded_buf.resize((size_t)mh.size);
         m_ist->read(encoded_buf.data(), encoded_buf.size());
@@ -79,6 +99,9 @@ ISceneCacheImpl::ISceneCacheImpl(StreamPtr ist, const ISceneCacheSettings& iscs)
         m_encoder->decode(tmp_buf, encoded_buf);
         m_entity_meta.resize_discard(tmp_buf.size() / sizeof(CacheFileEntityMeta));
         tmp_buf.copy_to((char*)m_entity_meta.data());
+
+        // scenes are read with absolute seeks. don't let a failed read above break them
+        m_ist->clear();
     }
 
     if (m_header.oscs.strip_unchanged)
@@ -87,6 +110,119 @@ ISceneCacheImpl::ISceneCacheImpl(StreamPtr ist, const ISceneCacheSettings& iscs)
     //preloadAll(); // for test
 }
 
+bool ISceneCacheImpl::readIndex()
+{
+    const std::streamoff records_pos = m_ist->tellg();
+
+    CacheFileIndexFooter footer;
+    footer.magic[0] = '\0';
+    if (!m_ist->seekg(-(std::streamoff)sizeof(footer), std::ios::end) ||
+        !m_ist->read((char*)&footer, sizeof(footer)) ||
+        !footer.valid() ||
+        footer.index_size < (uint64_t)footer.scene_count * sizeof(CacheFileIndexEntry) ||
+        footer.index_pos > m_file_size || footer.index_size > m_file_size - footer.index_pos) {
+        m_ist->clear();
+        m_ist->seekg(records_pos, std::ios::beg);
+        return false;
+    }
+
+    // read the whole table at once
+    RawVector<char> buf;
+    buf.resize_discard((size_t)footer.index_size);
+    m_ist->seekg(footer.index_pos, std::ios::beg);
+    if (!m_ist->read(buf.data(), buf.size())) {
+        m_ist->clear();
+        m_ist->seekg(records_pos, std::ios::beg);
+        return false;
+    }
+
+    auto *entries = (const CacheFileIndexEntry*)buf.cdata();
+    auto *sizes = (const uint64_t*)(entries + footer.scene_count);
+    auto *sizes_end = (const uint64_t*)(buf.cdata() + buf.size());
+
+    m_records.reserve(footer.scene_count);
+    for (uint32_t i = 0; i < footer.scene_count; ++i) {
+        auto& entry = entries[i];
+        if (sizes + entry.buffer_count > sizes_end) {
+            // broken index
+            m_records.clear();
+            m_ist->seekg(records_pos, std::ios::beg);
+            return false;
+        }
+
+        SceneRecord rec;
+        rec.time = entry.time;
+        rec.keyframe = entry.keyframe;
+        rec.pos = entry.pos;
+        rec.buffer_sizes.assign(sizes, sizes + entry.buffer_count);
+        sizes += entry.buffer_count;
+        if (!fitsInFile(rec.pos, rec.buffer_sizes, rec.buffer_size_total))
+            continue; // points out of the file (truncated or broken). drop it
+        rec.segments.resize(entry.buffer_count);
+        m_records.emplace_back(std::move(rec));
+    }
+
+    // leave the stream at the meta data just like scanRecords() does
+    m_ist->seekg(footer.meta_pos, std::ios::beg);
+    return true;
+}
+
+void ISceneCacheImpl::scanRecords()
+{
+    m_records.reserve(512);
+    for (;;) {
+        // enumerate all scene headers
+        CacheFileSceneHeader sh;
+        m_ist->read((char*)&sh, sizeof(sh));
+        if (!(*m_ist) || sh.buffer_count == 0) {
+            // empty header is a terminator. end of the file if truncated
+            m_ist->clear();
+            break;
+        }
+        else if ((uint64_t)sh.buffer_count * sizeof(uint64_t) > m_file_size) {
+            // broken header
+            m_ist->clear();
+            m_ist->seekg(0, std::ios::end);
+            break;
+        }
+        else {
+            SceneRecord rec;
+            rec.time = sh.time;
+            rec.keyframe = sh.keyframe;
+
+            rec.buffer_sizes.resize_discard(sh.buffer_count);
+            m_ist->read((char*)rec.buffer_sizes.data(), rec.buffer_sizes.size_in_byte());
+            rec.pos = (uint64_t)m_ist->tellg();
+            if (!(*m_ist) || !fitsInFile(rec.pos, rec.buffer_sizes, rec.buffer_size_total)) {
+                // truncated or broken. the following records and the meta data can't be located
+                m_ist->clear();
+                m_ist->seekg(0, std::ios::end);
+                break;
+            }
+
+            rec.segments.resize(sh.buffer_count);
+
+            m_records.emplace_back(std::move(rec));
+            m_ist->seekg(rec.buffer_size_total, std::ios::cur);
+        }
+    }
+}
+
+// segments of mapped files are read without bounds checks. every record must be validated with this
+bool ISceneCacheImpl::fitsInFile(uint64_t pos, const RawVector<uint64_t>& buffer_sizes, uint64_t& total) const
+{
+    total = 0;
+    if (pos > m_file_size)
+        return false;
+    const uint64_t space = m_file_size - pos;
+    for (auto s : buffer_sizes) {
+        if (s > space - total)
+            return false;
+        total += s;
+    }
+    return true;
+}
+
 ISceneCacheImpl::~ISceneCacheImpl()
 {
     waitAllPreloads();
@@ -150,35 +286,138 @@ int ISceneCacheImpl::getFrameByTime(float time) const
     return 0;
 }
 
-// thread safe
-ScenePtr ISceneCacheImpl::getByIndexImpl(size_t scene_index, bool wait_preload)
+// quantized vertex arrays follow the scene in the same order as meshes
+void ISceneCacheImpl::decodeMeshes(Scene& scene, std::istream& is)
 {
-    if (!valid() || scene_index >= m_records.size())
-        return nullptr;
+    if (!m_mesh_encoder)
+        return;
+    scene.eachEntity<Mesh>([this, &is](Mesh& mesh) {
+        m_mesh_encoder->decode(mesh, is);
+    });
+}
 
-    auto& rec = m_records[scene_index];
-    if (wait_preload && rec.preload.valid()) {
-        // wait preload
-        rec.preload.wait();
-        rec.preload = {};
+// temporal deltas follow the quantized vertex arrays. they start with the time of the reference keyframe
+void ISceneCacheImpl::decodeDeltas(Scene& scene, std::istream& is)
+{
+    float reference_time = 0.0f;
+    read(is, reference_time);
+    ScenePtr reference = getKeyframe(reference_time);
+    if (!reference)
+        throw std::runtime_error("[MeshSync] keyframe not found");
+
+    scene.eachEntity<Mesh>([&is, &reference](Mesh& mesh) {
+        DecodeMeshDelta(mesh, is, FindReferenceMesh(*reference, mesh));
+    });
+}
+
+// raw (not merged, not imported) keyframe. the last few are cached because consecutive scenes share them.
+ScenePtr ISceneCacheImpl::getKeyframe(float time)
+{
+    std::unique_lock<std::mutex> lock(m_keyframe_mutex);
+    for (auto& kf : m_keyframes) {
+        if (kf.first == time)
+            return kf.second;
     }
 
-    auto& ret = rec.scene;
-    if (ret)
-        return ret; // already loaded
+    auto p = std::lower_bound(m_records.begin(), m_records.end(), time, [](auto& a, float t) { return a.time < t; });
+    for (; p != m_records.end() && p->time == time; ++p) {
+        if (!p->keyframe)
+            continue;
+
+        std::vector<SceneSegment> segments;
+        ScenePtr ret = loadScene(std::distance(m_records.begin(), p), segments);
+        if (ret) {
+            m_keyframes.emplace_back(time, ret);
+            while (m_keyframes.size() > 2)
+                m_keyframes.pop_front();
+        }
+        return ret;
+    }
+    return nullptr;
+}
 
-    auto load_begin = mu::Now();
+// read & decode all segments of a scene. no merge and no import.
+// segments is owned by the caller so that keyframes can be loaded while the same record is being loaded.
+ScenePtr ISceneCacheImpl::loadScene(size_t scene_index, std::vector<SceneSegment>& segments)
+{
+    auto& rec = m_records[scene_index];
+    ScenePtr ret;
 
     size_t seg_count = rec.buffer_sizes.size();
-    rec.segments.resize(seg_count);
+    segments.resize(seg_count);
+
+    // scenes that are not keyframes are predicted from a keyframe
+    const bool predicted = m_header.oscs.temporal_delta && !rec.keyframe;
+
+    // decode a segment and deserialize it. src points to either seg.encoded_buf or the mapped file.
+    auto decode = [this, predicted](SceneSegment& seg, const char *src) {
+        mu::ScopedTimer timer;
+
+        std::shared_ptr<Scene> ret = Scene::create();
+        try {
+            if (m_mapped && m_header.oscs.encoding == SceneCacheEncoding::Plain) {
+                // deserialize straight from the mapping. vertex arrays share the mapped memory
+                mu::MemoryViewStream scene_buf(src, (size_t)seg.size_encoded);
+                ret->deserialize(scene_buf);
+                decodeMeshes(*ret, scene_buf);
+                if (predicted)
+                    decodeDeltas(*ret, scene_buf);
+                ret->external_buffers.push_back(m_mapped);
+                seg.size_decoded = seg.size_encoded;
+            }
+            else {
+                RawVector<char> tmp_buf;
+                m_encoder->decode(tmp_buf, src, (size_t)seg.size_encoded);
+                seg.size_decoded = tmp_buf.size();
 
-    {
+                mu::MemoryStream scene_buf(std::move(tmp_buf));
+                ret->deserialize(scene_buf);
+                decodeMeshes(*ret, scene_buf);
+                if (predicted)
+                    decodeDeltas(*ret, scene_buf);
+
+                // keep scene buffer alive. Meshes will use it as vertex buffers
+                ret->scene_buffers.push_back(scene_buf.moveBuffer());
+            }
+            seg.segment = ret;
+
+            // count vertices
+            seg.vertex_count = 0;
+            for (auto& e : seg.segment->entities)
+                seg.vertex_count += e->vertexCount();
+        }
+        catch (std::runtime_error& e) {
+            muLogError("exception: %s\n", e.what());
+            ret = nullptr;
+            seg.error = true;
+        }
+
+        seg.decode_time = timer.elapsed();
+    };
+
+    if (m_mapped) {
+        // no file access. segments are decoded directly from the mapped memory
+        uint64_t pos = rec.pos;
+        for (size_t si = 0; si < seg_count; ++si) {
+            auto& seg = segments[si];
+            seg.size_encoded = rec.buffer_sizes[si];
+            seg.read_time = 0.0f;
+
+            const char *src = m_mapped->data() + pos;
+            pos += seg.size_encoded;
+            seg.task = std::async(std::launch::async, [decode, &seg, src, scene_index, si]() {
+                msProfileScope("ISceneCacheImpl: [%d] decode segment (%d)", (int)scene_index, (int)si);
+                decode(seg, src);
+            });
+        }
+    }
+    else {
         // get exclusive file access
         std::unique_lock<std::mutex> lock(m_mutex);
 
         m_ist->seekg(rec.pos, std::ios::beg);
         for (size_t si = 0; si < seg_count; ++si) {
-            auto& seg = rec.segments[si];
+            auto& seg = segments[si];
             seg.size_encoded = rec.buffer_sizes[si];
 
             // read segment
@@ -193,43 +432,20 @@ ScenePtr ISceneCacheImpl::getByIndexImpl(size_t scene_index, bool wait_preload)
             }
 
             // launch async decode
-            seg.task = std::async(std::launch::async, [this, &seg, scene_index, si]() {
+            seg.task = std::async(std::launch::async, [decode, &seg, scene_index, si]() {
                 msProfileScope("ISceneCacheImpl: [%d] decode segment (%d)", (int)scene_index, (int)si);
-                mu::ScopedTimer timer;
-
-                RawVector<char> tmp_buf;
-                m_encoder->decode(tmp_buf, seg.encoded_buf);
-                seg.size_decoded = tmp_buf.size();
-
-                std::shared_ptr<Scene> ret = Scene::create();
-                mu::MemoryStream scene_buf(std::move(tmp_buf));
-                try {
-                    ret->deserialize(scene_buf);
-
-                    // keep scene buffer alive. Meshes will use it as vertex buffers
-                    ret->scene_buffers.push_back(scene_buf.moveBuffer());
-                    seg.segment = ret;
-
-                    // count vertices
-                    seg.vertex_count = 0;
-                    for (auto& e : seg.segment->entities)
-                        seg.vertex_count += e->vertexCount();
-                }
-                catch (std::runtime_error& e) {
-                    muLogError("exception: %s\n", e.what());
-                    ret = nullptr;
-                    seg.error = true;
-                }
-
-                seg.decode_time = timer.elapsed();
+                decode(seg, seg.encoded_buf.cdata());
             });
         }
     }
 
+    // all tasks must be done before returning even if one of them failed. segments outlive this call
+    for (auto& seg : segments)
+        seg.task.wait();
+
     // concat segmented scenes
     for (size_t si = 0; si < seg_count; ++si) {
-        auto& seg = rec.segments[si];
-        seg.task.wait();
+        auto& seg = segments[si];
         if (seg.error)
             break;
 
@@ -242,7 +458,30 @@ ScenePtr ISceneCacheImpl::getByIndexImpl(size_t scene_index, bool wait_preload)
     if (ret) {
         // sort entities by ID
         std::sort(ret->entities.begin(), ret->entities.end(), [](auto& a, auto& b) { return a->id < b->id; });
+    }
+    return ret;
+}
+
+// thread safe
+ScenePtr ISceneCacheImpl::getByIndexImpl(size_t scene_index, bool wait_preload)
+{
+    if (!valid() || scene_index >= m_records.size())
+        return nullptr;
 
+    auto& rec = m_records[scene_index];
+    if (wait_preload && rec.preload.valid()) {
+        // wait preload
+        rec.preload.wait();
+        rec.preload = {};
+    }
+
+    auto& ret = rec.scene;
+    if (ret)
+        return ret; // already loaded
+
+    auto load_begin = mu::Now();
+    ret = loadScene(scene_index, rec.segments);
+    if (ret) {
         // update profile data
         SceneProfileData& prof = ret->profile_data;
         prof = {};
@@ -276,7 +515,7 @@ ScenePtr ISceneCacheImpl::getByIndexImpl(size_t scene_index, bool wait_preload)
             }
 
             // do import
-            ret->import(m_iscs.sis);
+            ret->import(m_iscs.sis, &m_refine_cache);
 
             prof.setup_time = timer.elapsed();
         }
@@ -478,7 +717,12 @@ const AnimationCurvePtr ISceneCacheImpl::getFrameCurve(int base_frame)
 
 
 ISceneCacheFile::ISceneCacheFile(const char *path, const ISceneCacheSettings& iscs)
-    : super(createStream(path, iscs), iscs)
+    : ISceneCacheFile(path, createMapping(path, iscs), iscs)
+{
+}
+
+ISceneCacheFile::ISceneCacheFile(const char *path, MappedFilePtr mapped, const ISceneCacheSettings& iscs)
+    : super(mapped ? nullptr : createStream(path, iscs), mapped, iscs)
 {
 }
 
@@ -492,6 +736,16 @@ ISceneCacheFile::StreamPtr ISceneCacheFile::createStream(const char *path, const
     return *ret ? ret : nullptr;
 }
 
+ISceneCacheFile::MappedFilePtr ISceneCacheFile::createMapping(const char *path, const ISceneCacheSettings& iscs)
+{
+    if (!path || !iscs.memory_map)
+        return nullptr;
+
+    // fall back to the stream if mapping fails (e.g. not enough address space)
+    auto ret = std::make_shared<mu::MemoryMappedFile>();
+    return ret->open(path) ? ret : nullptr;
+}
+
 
 ISceneCache* OpenISceneCacheFileRaw(const char *path, const ISceneCacheSettings& iscs)
 {
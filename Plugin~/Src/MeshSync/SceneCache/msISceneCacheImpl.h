@@ -1,6 +1,7 @@
 #pragma once
 #include "MeshSync/SceneCache/msSceneCache.h"
 #include "msSceneCacheImpl.h"
+#include "MeshSync/SceneGraph/msMeshRefineCache.h"
 
 namespace ms {
 
@@ -8,8 +9,11 @@ class ISceneCacheImpl : public ISceneCache
 {
 public:
     using StreamPtr = std::shared_ptr<std::istream>;
+    using MappedFilePtr = std::shared_ptr<mu::MemoryMappedFile>;
 
     ISceneCacheImpl(StreamPtr ist, const ISceneCacheSettings& iscs);
+    // if mapped is given, segments are read straight from it (no lock, no copy) and ist is ignored
+    ISceneCacheImpl(StreamPtr ist, MappedFilePtr mapped, const ISceneCacheSettings& iscs);
     ~ISceneCacheImpl() override;
     bool valid() const override;
 
@@ -31,7 +35,15 @@ public:
     const AnimationCurvePtr getFrameCurve(int base_frame) override;
 
 protected:
+    bool readIndex();
+    void scanRecords();
+    bool fitsInFile(uint64_t pos, const RawVector<uint64_t>& buffer_sizes, uint64_t& total) const;
+    struct SceneSegment;
     ScenePtr getByIndexImpl(size_t i, bool wait_preload = true);
+    ScenePtr loadScene(size_t i, std::vector<SceneSegment>& segments);
+    ScenePtr getKeyframe(float time);
+    void decodeMeshes(Scene& scene, std::istream& is);
+    void decodeDeltas(Scene& scene, std::istream& is);
     ScenePtr postprocess(ScenePtr& sp, size_t scene_index);
     bool kickPreload(size_t i);
     void waitAllPreloads();
@@ -57,6 +69,7 @@ protected:
         uint64_t pos = 0;
         uint64_t buffer_size_total = 0;
         float time = 0.0f;
+        bool keyframe = true;
 
         ScenePtr scene;
         std::future<void> preload;
@@ -65,9 +78,12 @@ protected:
     };
 
     StreamPtr m_ist;
+    MappedFilePtr m_mapped;
+    uint64_t m_file_size = 0; // records that don't fit in it are dropped
     ISceneCacheSettings m_iscs;
     CacheFileHeader m_header;
     BufferEncoderPtr m_encoder;
+    MeshEncoderPtr m_mesh_encoder;
 
     std::mutex m_mutex;
     std::vector<SceneRecord> m_records;
@@ -78,6 +94,10 @@ protected:
     float m_last_time = -1.0f;
     int m_last_index = -1, m_last_index2 = -1;
     ScenePtr m_base_scene, m_last_scene, m_last_diff;
+    MeshRefineCache m_refine_cache; // constant topology meshes are re-indexed once
+
+    std::mutex m_keyframe_mutex;
+    std::deque<std::pair<float, ScenePtr>> m_keyframes;
     std::deque<size_t> m_history;
 };
 
@@ -89,6 +109,10 @@ public:
     ISceneCacheFile(const char *path, const ISceneCacheSettings& iscs);
 
     static StreamPtr createStream(const char *path, const ISceneCacheSettings& iscs);
+    static MappedFilePtr createMapping(const char *path, const ISceneCacheSettings& iscs);
+
+private:
+    ISceneCacheFile(const char *path, MappedFilePtr mapped, const ISceneCacheSettings& iscs);
 };
 
 } // namespace ms
@@ -3,6 +3,8 @@
 
 #include "Utils/msDebug.h"
 
+#include "MeshUtils/muLog.h"
+
 #include "MeshSync/NetworkData/msMeshDataFlags.h"
 #include "MeshSync/SceneGraph/msMeshRefineFlags.h"
 #include "MeshSync/SceneGraph/msTransform.h"
@@ -17,11 +19,20 @@ OSceneCacheImpl::OSceneCacheImpl(StreamPtr ost, const OSceneCacheSettings& oscs)
     if (!m_ost || !(*m_ost))
         return;
 
-    m_encoder = CreateEncoder(m_oscs.encoding, m_oscs.encoder_settings);
+    m_encoder = CreateEncoder(m_oscs.encoding, m_oscs.encoder_settings, m_oscs.compression_workers);
     if (!m_encoder) {
         m_oscs.encoding = SceneCacheEncoding::Plain;
         m_encoder = CreatePlainEncoder();
     }
+    m_mesh_encoder = CreateMeshEncoder(m_oscs);
+    if (m_oscs.keyframe_interval <= 1)
+        m_oscs.temporal_delta = 0;
+    if (m_oscs.encoding != SceneCacheEncoding::ZSTD || m_oscs.dictionary_scenes <= 0 || m_oscs.dictionary_size <= 0)
+        m_oscs.zstd_dictionary = 0;
+    if (m_oscs.zstd_dictionary) {
+        m_dictionary_pending = true;
+        m_dictionary_ready = m_dictionary_promise.get_future().share();
+    }
 
     CacheFileHeader header;
     header.oscs = m_oscs;
@@ -34,6 +45,8 @@ OSceneCacheImpl::~OSceneCacheImpl()
         return;
 
     flush();
+    if (m_dictionary_pending)
+        trainDictionary(); // fewer scenes than dictionary_scenes
 
     {
         // add terminator
@@ -41,6 +54,7 @@ OSceneCacheImpl::~OSceneCacheImpl()
         m_ost->write((char*)&terminator, sizeof(terminator));
     }
 
+    const std::streamoff meta_pos = m_ost->tellp();
     {
         // add meta data
         mu::MemoryStream scene_buf;
@@ -62,6 +76,36 @@ OSceneCacheImpl::~OSceneCacheImpl()
         m_ost->write((char*)&header, sizeof(header));
         m_ost->write(encoded_buf.data(), encoded_buf.size());
     }
+
+    if (m_oscs.write_index && m_index_valid && meta_pos >= 0)
+        writeIndex((uint64_t)meta_pos);
+}
+
+void OSceneCacheImpl::writeIndex(uint64_t meta_pos)
+{
+    const std::streamoff index_pos = m_ost->tellp();
+    if (index_pos < 0)
+        return;
+
+    CacheFileIndexFooter footer;
+    footer.index_pos = (uint64_t)index_pos;
+    footer.meta_pos = meta_pos;
+    footer.scene_count = (uint32_t)m_index_records.size();
+
+    for (auto& rec : m_index_records) {
+        CacheFileIndexEntry entry;
+        entry.pos = rec.pos;
+        entry.time = rec.time;
+        entry.buffer_count = (uint32_t)rec.buffer_sizes.size();
+        entry.keyframe = rec.keyframe;
+        m_ost->write((char*)&entry, sizeof(entry));
+        footer.index_size += sizeof(entry);
+    }
+    for (auto& rec : m_index_records) {
+        m_ost->write((char*)rec.buffer_sizes.cdata(), rec.buffer_sizes.size_in_byte());
+        footer.index_size += rec.buffer_sizes.size_in_byte();
+    }
+    m_ost->write((char*)&footer, sizeof(footer));
 }
 
 bool OSceneCacheImpl::valid() const
@@ -128,8 +172,14 @@ static std::vector<ScenePtr> LoadBalancing(ScenePtr base, const int max_segments
 
 void OSceneCacheImpl::addScene(ScenePtr scene, float time)
 {
-    while (m_scene_count_in_queue > 0 && ((m_oscs.strip_unchanged && !m_base_scene) || m_scene_count_in_queue >= m_oscs.max_queue_size)) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    {
+        // wait until the writer makes room in the queue. with strip_unchanged, the first scene must be optimized
+        // before the following scenes can be stripped against it.
+        std::unique_lock<std::mutex> l(m_mutex);
+        m_queue_cond.wait(l, [this]() {
+            return m_scene_count_in_queue == 0 ||
+                (!(m_oscs.strip_unchanged && !m_base_scene) && m_scene_count_in_queue < m_oscs.max_queue_size);
+        });
     }
 
     auto rec_ptr = std::make_shared<SceneRecord>();
@@ -137,75 +187,158 @@ void OSceneCacheImpl::addScene(ScenePtr scene, float time)
     rec.index = m_scene_count_queued++;
     rec.time = time;
     rec.scene = scene;
+    rec.dictionary_sample = m_oscs.zstd_dictionary && rec.index < m_oscs.dictionary_scenes;
+
+    if (m_oscs.temporal_delta) {
+        rec.keyframe = rec.index % m_oscs.keyframe_interval == 0;
+        if (rec.keyframe) {
+            rec.keyframe_promise = std::make_shared<std::promise<ScenePtr>>();
+            m_keyframe = rec.keyframe_promise->get_future().share();
+            m_keyframe_time = time;
+        }
+        else {
+            rec.reference = m_keyframe;
+            rec.reference_time = m_keyframe_time;
+        }
+    }
 
     rec.task = std::async(std::launch::async, [this, &rec]() {
-        {
-            msProfileScope("OSceneCacheImpl: [%d] scene optimization", rec.index);
+        try {
+            {
+                msProfileScope("OSceneCacheImpl: [%d] scene optimization", rec.index);
 
-            auto& scene = rec.scene;
-            std::sort(scene->entities.begin(), scene->entities.end(), [](auto& a, auto& b) { return a->id < b->id; });
+                auto& scene = rec.scene;
+                std::sort(scene->entities.begin(), scene->entities.end(), [](auto& a, auto& b) { return a->id < b->id; });
 
-            if (m_oscs.flatten_hierarchy)
-                scene->flatternHierarchy();
+                if (m_oscs.flatten_hierarchy)
+                    scene->flatternHierarchy();
 
-            if (m_oscs.strip_normals) {
-                scene->eachEntity<Mesh>([](Mesh& mesh) {
-                    mesh.normals.clear();
-                    mesh.md_flags.Set(MESH_DATA_FLAG_HAS_NORMALS , false);
-                    mesh.refine_settings.flags.Set(MESH_REFINE_FLAG_GEN_NORMALS, false );
-                });
-            }
-            if (m_oscs.strip_tangents) {
-                scene->eachEntity<Mesh>([](Mesh& mesh) {
-                    mesh.tangents.clear();
-                    mesh.md_flags.Set(MESH_DATA_FLAG_HAS_TANGENTS,false);
-                    mesh.refine_settings.flags.Set(MESH_REFINE_FLAG_GEN_TANGENTS, false);
-                });
-            }
+                if (m_oscs.strip_normals) {
+                    scene->eachEntity<Mesh>([](Mesh& mesh) {
+                        mesh.normals.clear();
+                        mesh.md_flags.Set(MESH_DATA_FLAG_HAS_NORMALS , false);
+                        mesh.refine_settings.flags.Set(MESH_REFINE_FLAG_GEN_NORMALS, false );
+                    });
+                }
+                if (m_oscs.strip_tangents) {
+                    scene->eachEntity<Mesh>([](Mesh& mesh) {
+                        mesh.tangents.clear();
+                        mesh.md_flags.Set(MESH_DATA_FLAG_HAS_TANGENTS,false);
+                        mesh.refine_settings.flags.Set(MESH_REFINE_FLAG_GEN_TANGENTS, false);
+                    });
+                }
 
-            if (m_oscs.apply_refinement)
-                scene->import(m_oscs);
+                if (m_oscs.apply_refinement)
+                    scene->import(m_oscs);
 
-            if (m_oscs.strip_normals) {
-                scene->eachEntity<Mesh>([](Mesh& mesh) {
-                    mesh.refine_settings.flags.Set(MESH_REFINE_FLAG_GEN_NORMALS, true);
-                });
-            }
-            if (m_oscs.strip_tangents) {
-                scene->eachEntity<Mesh>([](Mesh& mesh) {
-                    mesh.refine_settings.flags.Set(MESH_REFINE_FLAG_GEN_TANGENTS, true);
-                });
-            }
+                if (m_oscs.strip_normals) {
+                    scene->eachEntity<Mesh>([](Mesh& mesh) {
+                        mesh.refine_settings.flags.Set(MESH_REFINE_FLAG_GEN_NORMALS, true);
+                    });
+                }
+                if (m_oscs.strip_tangents) {
+                    scene->eachEntity<Mesh>([](Mesh& mesh) {
+                        mesh.refine_settings.flags.Set(MESH_REFINE_FLAG_GEN_TANGENTS, true);
+                    });
+                }
 
-            // strip unchanged
-            if (m_oscs.strip_unchanged) {
-                if (!m_base_scene)
-                    m_base_scene = scene;
-                else
-                    scene->strip(*m_base_scene);
-            }
+                // strip unchanged
+                if (m_oscs.strip_unchanged) {
+                    if (!m_base_scene) {
+                        {
+                            std::unique_lock<std::mutex> l(m_mutex);
+                            m_base_scene = scene;
+                        }
+                        m_queue_cond.notify_all();
+                    }
+                    else
+                        scene->strip(*m_base_scene);
+                }
+
+                if (rec.keyframe_promise) {
+                    rec.keyframe_promise->set_value(rec.scene);
+                    rec.keyframe_promise.reset();
+                }
 
-            // split into segments
-            auto scene_segments = LoadBalancing(rec.scene, m_oscs.max_scene_segments);
-            size_t seg_count = scene_segments.size();
-            rec.segments.resize(seg_count);
-            for (size_t si = 0; si < seg_count; ++si) {
-                auto& seg = rec.segments[si];
-                seg.index = (int)si;
-                seg.segment = scene_segments[si];
-                seg.segment->settings = {};
+                // split into segments
+                auto scene_segments = LoadBalancing(rec.scene, m_oscs.max_scene_segments);
+                size_t seg_count = scene_segments.size();
+                rec.segments.resize(seg_count);
+                for (size_t si = 0; si < seg_count; ++si) {
+                    auto& seg = rec.segments[si];
+                    seg.index = (int)si;
+                    seg.segment = scene_segments[si];
+                    seg.segment->settings = {};
+                }
             }
-        }
 
-        for (auto& seg : rec.segments) {
-            seg.task = std::async(std::launch::async, [this, &rec, &seg]() {
-                msProfileScope("OSceneCacheImpl: [%d] serialize & encode segment (%d)", rec.index, seg.index);
+            // the reference keyframe must be optimized before deltas can be taken
+            ScenePtr reference;
+            if (rec.reference.valid())
+                reference = rec.reference.get();
+
+            for (auto& seg : rec.segments) {
+                seg.task = std::async(std::launch::async, [this, &rec, &seg, reference]() {
+                    msProfileScope("OSceneCacheImpl: [%d] serialize & encode segment (%d)", rec.index, seg.index);
+
+                    mu::MemoryStream scene_buf;
+                    std::ostream *os = &scene_buf;
+                    if (m_oscs.encoding == SceneCacheEncoding::Plain) {
+                        // nothing to encode. serialize with references to the vertex arrays and write them from there.
+                        seg.plain_buf.reset(new mu::GatherStream());
+                        os = seg.plain_buf.get();
+                    }
 
-                mu::MemoryStream scene_buf;
-                seg.segment->serialize(scene_buf);
-                scene_buf.flush();
-                m_encoder->encode(seg.encoded_buf, scene_buf.getBuffer());
-            });
+                    if (m_mesh_encoder || reference) {
+                        // quantized vertex arrays and then temporal deltas follow the scene.
+                        // meshes are cloned because the originals may be shared with the base scene or keyframe.
+                        mu::MemoryStream mesh_buf, delta_buf;
+                        for (auto& e : seg.segment->entities) {
+                            if (e->getType() != EntityType::Mesh)
+                                continue;
+                            auto mesh = std::static_pointer_cast<Mesh>(e->clone());
+                            if (m_mesh_encoder)
+                                m_mesh_encoder->encode(mesh_buf, *mesh);
+                            if (reference)
+                                EncodeMeshDelta(delta_buf, *mesh, FindReferenceMesh(*reference, *mesh));
+                            e = mesh;
+                        }
+                        mesh_buf.flush();
+                        delta_buf.flush();
+
+                        seg.segment->serialize(*os);
+                        auto& mesh_data = mesh_buf.getBuffer();
+                        os->write(mesh_data.cdata(), mesh_data.size());
+                        if (reference) {
+                            write(*os, rec.reference_time);
+                            auto& delta_data = delta_buf.getBuffer();
+                            os->write(delta_data.cdata(), delta_data.size());
+                        }
+                    }
+                    else {
+                        seg.segment->serialize(*os);
+                    }
+                    os->flush();
+                    if (seg.plain_buf)
+                        return;
+                    if (rec.dictionary_sample) {
+                        // encoded by trainDictionary()
+                        seg.encoded_buf = scene_buf.moveBuffer();
+                    }
+                    else {
+                        if (m_dictionary_ready.valid())
+                            m_dictionary_ready.wait();
+                        m_encoder->encode(seg.encoded_buf, scene_buf.getBuffer());
+                    }
+                });
+            }
+        }
+        catch (const std::exception& e) {
+            muLogError("exception: %s\n", e.what());
+            // deltas of the following scenes wait for the keyframe. let them fail instead of blocking forever
+            if (rec.keyframe_promise)
+                rec.keyframe_promise->set_exception(std::current_exception());
+            rec.segments.clear(); // the writer skips this scene
         }
     });
 
@@ -247,14 +380,19 @@ void OSceneCacheImpl::doWrite()
             {
                 std::unique_lock<std::mutex> l(m_mutex);
                 if (m_queue.empty()) {
+                    // cleared under the lock so that a scene queued right now starts a new writer
+                    m_writing = false;
                     break;
                 }
                 else {
-                    rec_ptr = std::move(m_queue.back());
-                    m_queue.pop_back();
+                    // scenes must be written in the order they were added. scenes after the dictionary samples
+                    // can't be encoded until the samples are written.
+                    rec_ptr = std::move(m_queue.front());
+                    m_queue.pop_front();
                     m_scene_count_in_queue = (int)m_queue.size();
                 }
             }
+            m_queue_cond.notify_all();
             if (!rec_ptr)
                 break;
             auto& rec = *rec_ptr;
@@ -283,39 +421,123 @@ void OSceneCacheImpl::doWrite()
                 }
             }
 
-            // write
-            {
-                uint64_t total_buffer_size = 0;
-                RawVector<uint64_t> buffer_sizes;
-                for (auto& seg : rec.segments) {
-                    if (seg.task.valid())
-                        seg.task.wait();
-                    buffer_sizes.push_back(seg.encoded_buf.size());
-                    total_buffer_size += seg.encoded_buf.size();
-                }
-
-                msProfileScope("OSceneCacheImpl: [%d] write (%u byte)", rec.index, (uint32_t)total_buffer_size);
-
-                CacheFileSceneHeader header;
-                header.buffer_count = (uint32_t)buffer_sizes.size();
-                header.time = rec.time;
-                m_ost->write((char*)&header, sizeof(header));
-                m_ost->write((char*)buffer_sizes.cdata(), buffer_sizes.size_in_byte());
-                for (auto& seg : rec.segments)
-                    m_ost->write(seg.encoded_buf.cdata(), seg.encoded_buf.size());
+            for (auto& seg : rec.segments) {
+                if (seg.task.valid())
+                    seg.task.wait();
+            }
+            if (rec.dictionary_sample) {
+                m_dictionary_samples.push_back(rec_ptr);
+                if (m_dictionary_samples.size() >= (size_t)m_oscs.dictionary_scenes)
+                    trainDictionary();
+            }
+            else if (!rec.segments.empty()) {
+                writeRecord(rec);
             }
-            ++m_scene_count_written;
         }
     };
 
     {
         std::unique_lock<std::mutex> l(m_mutex);
-        if (!m_queue.empty() && !isWriting()) {
+        if (!m_queue.empty() && !m_writing) {
+            m_writing = true;
             m_task = std::async(std::launch::async, body);
         }
     }
 }
 
+void OSceneCacheImpl::writeRecord(SceneRecord& rec)
+{
+    uint64_t total_buffer_size = 0;
+    RawVector<uint64_t> buffer_sizes;
+    for (auto& seg : rec.segments) {
+        buffer_sizes.push_back(seg.size());
+        total_buffer_size += seg.size();
+    }
+
+    msProfileScope("OSceneCacheImpl: [%d] write (%u byte)", rec.index, (uint32_t)total_buffer_size);
+
+    CacheFileSceneHeader header;
+    header.buffer_count = (uint32_t)buffer_sizes.size();
+    header.time = rec.time;
+    header.keyframe = rec.keyframe;
+    m_ost->write((char*)&header, sizeof(header));
+    m_ost->write((char*)buffer_sizes.cdata(), buffer_sizes.size_in_byte());
+
+    const std::streamoff pos = m_ost->tellp();
+    if (pos < 0)
+        m_index_valid = false; // not seekable. no index
+    IndexRecord irec;
+    irec.pos = (uint64_t)pos;
+    irec.time = rec.time;
+    irec.keyframe = rec.keyframe;
+    irec.buffer_sizes = std::move(buffer_sizes);
+    m_index_records.emplace_back(std::move(irec));
+
+    for (auto& seg : rec.segments) {
+        if (seg.plain_buf) {
+            for (auto& block : seg.plain_buf->getSegments())
+                m_ost->write(block.data, block.size);
+        }
+        else
+            m_ost->write(seg.encoded_buf.cdata(), seg.encoded_buf.size());
+    }
+    ++m_scene_count_written;
+}
+
+uint64_t OSceneCacheImpl::SceneSegment::size()
+{
+    return plain_buf ? plain_buf->size() : encoded_buf.size();
+}
+
+// train the dictionary from the unencoded segments of the first scenes, write it right after the file header,
+// then encode and write the held scenes. scenes added later wait for m_dictionary_ready before encoding.
+void OSceneCacheImpl::trainDictionary()
+{
+    msProfileScope("OSceneCacheImpl: train dictionary (%d scenes)", (int)m_dictionary_samples.size());
+
+    std::vector<const RawVector<char>*> samples;
+    for (auto& rec : m_dictionary_samples) {
+        for (auto& seg : rec->segments)
+            samples.push_back(&seg.encoded_buf);
+    }
+
+    RawVector<char> dictionary;
+    if (TrainZSTDDictionary(dictionary, (size_t)m_oscs.dictionary_size, samples))
+        m_encoder = CreateEncoder(m_oscs.encoding, m_oscs.encoder_settings, m_oscs.compression_workers, &dictionary);
+
+    CacheFileDictionaryHeader header;
+    header.size = dictionary.size();
+    m_ost->write((char*)&header, sizeof(header));
+    m_ost->write(dictionary.cdata(), dictionary.size());
+
+    m_dictionary_pending = false;
+    m_dictionary_promise.set_value();
+
+    for (auto& rec : m_dictionary_samples) {
+        for (auto& seg : rec->segments) {
+            seg.task = std::async(std::launch::async, [this, &seg]() {
+                RawVector<char> raw;
+                raw.swap(seg.encoded_buf);
+                m_encoder->encode(seg.encoded_buf, raw);
+            });
+        }
+    }
+    for (auto& rec : m_dictionary_samples) {
+        try {
+            for (auto& seg : rec->segments)
+                seg.task.get();
+        }
+        catch (const std::exception& e) {
+            muLogError("exception: %s\n", e.what());
+            rec->segments.clear();
+        }
+        // the scene failed to encode. an empty record would read as the terminator and hide the scenes after it
+        if (!rec->segments.empty())
+            writeRecord(*rec);
+    }
+    m_dictionary_samples.clear();
+}
+
 OSceneCacheFile::OSceneCacheFile(const char *path, const OSceneCacheSettings& oscs)
     : super(createStream(path), oscs)
 {
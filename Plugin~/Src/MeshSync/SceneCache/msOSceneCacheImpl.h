@@ -23,25 +23,49 @@ public:
 
 protected:
     void doWrite();
+    void writeIndex(uint64_t meta_pos);
 
     struct SceneSegment
     {
         int index = 0;
         ScenePtr segment;
         RawVector<char> encoded_buf;
+        std::unique_ptr<mu::GatherStream> plain_buf; // Plain encoding: references the vertex arrays of segment
         std::future<void> task;
+
+        uint64_t size();
     };
 
     struct SceneRecord
     {
         int index = 0;
         float time = 0.0f;
+        bool keyframe = true;
         ScenePtr scene;
         std::vector<SceneSegment> segments;
         std::future<void> task;
+
+        // temporal delta. keyframes publish their scene, other scenes wait for the preceding keyframe
+        std::shared_ptr<std::promise<ScenePtr>> keyframe_promise;
+        std::shared_future<ScenePtr> reference;
+        float reference_time = 0.0f;
+
+        // zstd dictionary. segments are kept unencoded until the dictionary is trained
+        bool dictionary_sample = false;
     };
     using SceneRecordPtr = std::shared_ptr<SceneRecord>;
 
+    void writeRecord(SceneRecord& rec);
+    void trainDictionary();
+
+    struct IndexRecord
+    {
+        uint64_t pos = 0;
+        float time = 0.0f;
+        bool keyframe = true;
+        RawVector<uint64_t> buffer_sizes;
+    };
+
     struct EntityRecord
     {
         EntityType type = EntityType::Unknown;
@@ -54,16 +78,28 @@ protected:
     OSceneCacheSettings m_oscs;
 
     std::mutex m_mutex;
+    std::condition_variable m_queue_cond; // notified when a scene leaves the queue or the base scene is ready
     std::list<SceneRecordPtr> m_queue;
     std::future<void> m_task;
+    bool m_writing = false;
 
     ScenePtr m_base_scene;
+    std::shared_future<ScenePtr> m_keyframe;
+    float m_keyframe_time = 0.0f;
     int m_scene_count_queued = 0;
     int m_scene_count_written = 0;
     int m_scene_count_in_queue = 0;
     std::vector<EntityRecord> m_entity_records;
+    std::vector<IndexRecord> m_index_records;
+    bool m_index_valid = true;
 
     BufferEncoderPtr m_encoder;
+    MeshEncoderPtr m_mesh_encoder;
+
+    bool m_dictionary_pending = false;
+    std::promise<void> m_dictionary_promise;
+    std::shared_future<void> m_dictionary_ready;
+    std::vector<SceneRecordPtr> m_dictionary_samples;
 };
 
 
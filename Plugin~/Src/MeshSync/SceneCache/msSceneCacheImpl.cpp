@@ -1,10 +1,13 @@
 #include "pch.h"
 #include "MeshSync/SceneCache/msSceneCache.h"
 #include "msSceneCacheImpl.h"
+#include "MeshSync/SceneGraph/msMesh.h"
 
 namespace ms {
 
 static_assert(sizeof(CacheFileEntityMeta) == 8, "");
+static_assert(sizeof(CacheFileIndexEntry) == 16, "");
+static_assert(sizeof(CacheFileIndexFooter) == 32, "");
 
 OSceneCacheSettingsBase::OSceneCacheSettingsBase()
 {
@@ -17,6 +20,14 @@ OSceneCacheSettingsBase::OSceneCacheSettingsBase()
     merge_meshes = 0;
     strip_normals = 0;
     strip_tangents = 0;
+    quantize_points = 0;
+    quantize_normals = 0;
+    quantize_tangents = 0;
+    quantize_uv = 0;
+    quantize_colors = 0;
+    quantize_velocities = 0;
+    temporal_delta = 0;
+    zstd_dictionary = 0;
 }
 
 ISceneCacheSettingsBase::ISceneCacheSettingsBase()
@@ -24,6 +35,7 @@ ISceneCacheSettingsBase::ISceneCacheSettingsBase()
     convert_scenes = 1;
     enable_diff = 1;
     generate_velocities = 0;
+    memory_map = 0;
     preload_length = 1;
 }
 
@@ -33,14 +45,46 @@ void ISceneCacheSettingsBase::setPreloadLength(int n)
     max_history = preload_length + 2;
 }
 
-BufferEncoderPtr CreateEncoder(SceneCacheEncoding encoding, const SceneCacheEncoderSettings& settings)
+BufferEncoderPtr CreateEncoder(SceneCacheEncoding encoding, const SceneCacheEncoderSettings& settings,
+    int num_workers, const RawVector<char> *dictionary)
 {
     BufferEncoderPtr ret;
     switch (encoding) {
-    case SceneCacheEncoding::ZSTD: ret = CreateZSTDEncoder(settings.zstd.compression_level); break;
+    case SceneCacheEncoding::Plain: ret = CreatePlainEncoder(); break;
+    case SceneCacheEncoding::ZSTD:
+        if (dictionary)
+            ret = CreateZSTDEncoder(settings.zstd.compression_level, num_workers, dictionary->cdata(), dictionary->size());
+        else
+            ret = CreateZSTDEncoder(settings.zstd.compression_level, num_workers);
+        break;
     default: break;
     }
     return ret;
 }
 
+const Mesh* FindReferenceMesh(const Scene& reference, const Mesh& mesh)
+{
+    auto& entities = reference.entities;
+    auto it = std::lower_bound(entities.begin(), entities.end(), mesh.id, [](auto& e, int id) { return e->id < id; });
+    for (; it != entities.end() && (*it)->id == mesh.id; ++it) {
+        if ((*it)->getType() == EntityType::Mesh && (*it)->path == mesh.path)
+            return static_cast<const Mesh*>(it->get());
+    }
+    return nullptr;
+}
+
+MeshEncoderPtr CreateMeshEncoder(const OSceneCacheSettingsBase& oscs)
+{
+    MeshEncodeSettings settings;
+    settings.quantize_points = oscs.quantize_points;
+    settings.quantize_normals = oscs.quantize_normals;
+    settings.quantize_tangents = oscs.quantize_tangents;
+    settings.quantize_uv = oscs.quantize_uv;
+    settings.quantize_colors = oscs.quantize_colors;
+    settings.quantize_velocities = oscs.quantize_velocities;
+    if (!settings.any())
+        return nullptr;
+    return CreateQuantizeMeshEncoder(settings);
+}
+
 } // namespace ms
@@ -5,22 +5,34 @@
 
 namespace ms {
 
+// files written before the layout had its own version have msProtocolVersion of that time.
+// they have no quantized arrays, deltas, dictionary or index, and the flags of those may be uninitialized.
+#define msSceneCacheVersionLegacy 123
+
 struct CacheFileHeader
 {
     char magic[4] = { 'M', 'S', 'S', 'C' };
-    int version = msProtocolVersion;
+    int version = msSceneCacheVersion;
     OSceneCacheSettingsBase oscs;
 };
 
+// follows CacheFileHeader if oscs.zstd_dictionary is set. size can be 0 if training failed.
+struct CacheFileDictionaryHeader
+{
+    uint64_t size = 0;
+    // char dictionary[size];
+};
+
 struct CacheFileSceneHeader
 {
     uint32_t buffer_count = 0;
     float time = 0.0f;
     // flags
-    uint32_t keyframe : 1;
+    uint32_t keyframe : 1; // with temporal_delta, scenes that are not keyframes are predicted from the preceding keyframe
 
     // uint64_t buffer_sizes[buffer_count];
 
+    CacheFileSceneHeader() : keyframe(1) {}
     static CacheFileSceneHeader terminator() { return CacheFileSceneHeader(); }
 };
 
@@ -37,7 +49,36 @@ struct CacheFileEntityMeta
     uint32_t constant_topology : 1;
 };
 
+// the index follows the meta data. readers that don't know about it stop at the meta data.
+// layout: CacheFileIndexEntry[scene_count], uint64_t buffer_sizes[sum of buffer_count], CacheFileIndexFooter
+struct CacheFileIndexEntry
+{
+    uint64_t pos = 0; // position of the first segment
+    float time = 0.0f;
+    uint32_t buffer_count : 31;
+    uint32_t keyframe : 1;
+
+    CacheFileIndexEntry() : buffer_count(0), keyframe(1) {}
+};
+
+// always at the very end of the file
+struct CacheFileIndexFooter
+{
+    uint64_t index_pos = 0;
+    uint64_t index_size = 0; // entries + buffer sizes in byte
+    uint64_t meta_pos = 0;   // position of CacheFileMetaHeader
+    uint32_t scene_count = 0;
+    char magic[4] = { 'M', 'S', 'C', 'I' };
+
+    bool valid() const { return magic[0] == 'M' && magic[1] == 'S' && magic[2] == 'C' && magic[3] == 'I'; }
+};
+
 
-BufferEncoderPtr CreateEncoder(SceneCacheEncoding encoding, const SceneCacheEncoderSettings& settings);
+BufferEncoderPtr CreateEncoder(SceneCacheEncoding encoding, const SceneCacheEncoderSettings& settings,
+    int num_workers = 0, const RawVector<char> *dictionary = nullptr);
+// null if no vertex array is quantized
+MeshEncoderPtr CreateMeshEncoder(const OSceneCacheSettingsBase& oscs);
+// find the counterpart of mesh in reference. reference's entities must be sorted by id
+const Mesh* FindReferenceMesh(const Scene& reference, const Mesh& mesh);
 
 } // namespace ms
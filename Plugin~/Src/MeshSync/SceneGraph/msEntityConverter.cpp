@@ -41,13 +41,23 @@ void EntityConverter::convert(AnimationClip& clip)
 void EntityConverter::convert(Animation &anim)
 {
     for (auto& curve : anim.curves)
-        convertAnimationCurve(*curve);
+        convertAnimationCurve(anim, *curve);
 }
 
-void EntityConverter::convertAnimationCurve(AnimationCurve &/*v*/)
+void EntityConverter::convertAnimationCurve(Animation &/*anim*/, AnimationCurve &/*v*/)
 {
 }
 
+mu::float3 EntityConverter::convertPoint(const mu::float3& v) const
+{
+    return v;
+}
+
+mu::float3 EntityConverter::convertVector(const mu::float3& v) const
+{
+    return v;
+}
+
 
 
 std::shared_ptr<ScaleConverter> ScaleConverter::create(float scale)
@@ -83,24 +93,22 @@ void ScaleConverter::convertLight(Light &e)
 void ScaleConverter::convertMesh(Mesh &e)
 {
     convertTransform(e);
-    mu::Scale(e.points.data(), m_scale, e.points.size());
     for (auto& bone : e.bones) {
         (mu::float3&)bone->bindpose[3] *= m_scale;
     }
-    for (auto& bs : e.blendshapes) {
-        for (auto& frame : bs->frames) {
-            mu::Scale(frame->points.data(), m_scale, frame->points.size());
-        }
-    }
 }
 
 void ScaleConverter::convertPoints(Points &e)
 {
     convertTransform(e);
-    mu::Scale(e.points.data(), m_scale, e.points.size());
 }
 
-void ScaleConverter::convertAnimationCurve(AnimationCurve &c)
+mu::float3 ScaleConverter::convertPoint(const mu::float3& v) const
+{
+    return v * m_scale;
+}
+
+void ScaleConverter::convertAnimationCurve(Animation &/*anim*/, AnimationCurve &c)
 {
     if (!c.data_flags.affect_scale)
         return;
@@ -151,34 +159,31 @@ void FlipX_HandednessCorrector::convertMesh(Mesh &e)
 {
     convertTransform(e);
 
-    mu::InvertX(e.points.data(), e.points.size());
-    mu::InvertX(e.normals.data(), e.normals.size());
-    mu::InvertX(e.tangents.data(), e.tangents.size());
-    mu::InvertX(e.velocities.data(), e.velocities.size());
-
     for (auto& bone : e.bones) {
         bone->bindpose = flip_x(bone->bindpose);
     }
-    for (auto& bs : e.blendshapes) {
-        for (auto& frame : bs->frames) {
-            for (auto& v : frame->points) { v = flip_x(v); }
-            for (auto& v : frame->normals) { v = flip_x(v); }
-            for (auto& v : frame->tangents) { v = flip_x(v); }
-        }
-    }
 }
 
 void FlipX_HandednessCorrector::convertPoints(Points &e)
 {
     convertTransform(e);
 
-    mu::InvertX(e.points.data(), e.points.size());
     mu::InvertX(e.scales.data(), e.scales.size());
     for (auto& v : e.rotations)
         v = flip_x(v);
 }
 
-void FlipX_HandednessCorrector::convertAnimationCurve(AnimationCurve &c)
+mu::float3 FlipX_HandednessCorrector::convertPoint(const mu::float3& v) const
+{
+    return flip_x(v);
+}
+
+mu::float3 FlipX_HandednessCorrector::convertVector(const mu::float3& v) const
+{
+    return flip_x(v);
+}
+
+void FlipX_HandednessCorrector::convertAnimationCurve(Animation &/*anim*/, AnimationCurve &c)
 {
     if (!c.data_flags.affect_handedness || c.data_flags.ignore_negate)
         return;
@@ -239,22 +244,8 @@ void FlipYZ_ZUpCorrector::convertMesh(Mesh &e)
 {
     convertTransform(e);
 
-    auto convert = [this](auto& v) { return flip_z(swap_yz(v)); };
-
-    for (auto& v : e.points) v = convert(v);
-    for (auto& v : e.normals) v = convert(v);
-    for (auto& v : e.tangents) v = convert(v);
-    for (auto& v : e.velocities) v = convert(v);
-
     for (auto& bone : e.bones) {
-        bone->bindpose = convert(bone->bindpose);
-    }
-    for (auto& bs : e.blendshapes) {
-        for (auto& frame : bs->frames) {
-            for (auto& v : frame->points) { v = convert(v); }
-            for (auto& v : frame->normals) { v = convert(v); }
-            for (auto& v : frame->tangents) { v = convert(v); }
-        }
+        bone->bindpose = flip_z(swap_yz(bone->bindpose));
     }
 }
 
@@ -262,48 +253,49 @@ void FlipYZ_ZUpCorrector::convertPoints(Points &e)
 {
     convertTransform(e);
 
-    auto convert = [this](auto& v) { return flip_z(swap_yz(v)); };
-
-    for (auto& v : e.points) v = flip_z(swap_yz(v));
     for (auto& v : e.rotations) v = flip_z(swap_yz(v));
     for (auto& v : e.scales) v = swap_yz(v);
 }
 
-void FlipYZ_ZUpCorrector::convert(Animation &anim)
-{
-    auto convert_curve = [&](AnimationCurve& c) {
-        if (!c.data_flags.affect_handedness)
-            return;
-
-        switch (c.data_type) {
-        case Animation::DataType::Float3:
-            if (!c.data_flags.ignore_negate)
-                c.each<mu::float3>([&](auto& v) { v.value = flip_z(swap_yz(v.value)); });
-            else
-                c.each<mu::float3>([&](auto& v) { v.value = swap_yz(v.value); });
-            break;
-        case Animation::DataType::Float4:
-            if (!c.data_flags.ignore_negate)
-                c.each<mu::float4>([&](auto& v) { v.value = flip_z(swap_yz(v.value)); });
-            else
-                c.each<mu::float4>([&](auto& v) { v.value = swap_yz(v.value); });
-            break;
-        case Animation::DataType::Quaternion:
+mu::float3 FlipYZ_ZUpCorrector::convertPoint(const mu::float3& v) const
+{
+    return flip_z(swap_yz(v));
+}
+
+mu::float3 FlipYZ_ZUpCorrector::convertVector(const mu::float3& v) const
+{
+    return flip_z(swap_yz(v));
+}
+
+void FlipYZ_ZUpCorrector::convertAnimationCurve(Animation &anim, AnimationCurve &c)
+{
+    if (!c.data_flags.affect_handedness)
+        return;
+
+    switch (c.data_type) {
+    case Animation::DataType::Float3:
+        if (!c.data_flags.ignore_negate)
+            c.each<mu::float3>([&](auto& v) { v.value = flip_z(swap_yz(v.value)); });
+        else
+            c.each<mu::float3>([&](auto& v) { v.value = swap_yz(v.value); });
+        break;
+    case Animation::DataType::Float4:
+        if (!c.data_flags.ignore_negate)
+            c.each<mu::float4>([&](auto& v) { v.value = flip_z(swap_yz(v.value)); });
+        else
+            c.each<mu::float4>([&](auto& v) { v.value = swap_yz(v.value); });
+        break;
+    case Animation::DataType::Quaternion:
+        if ((anim.entity_type == EntityType::Camera || anim.entity_type == EntityType::Light) && c.name == mskTransformRotation) {
+            const mu::quatf cr = mu::rotate_x(-90.0f * mu::DegToRad);
+            c.each<mu::quatf>([&](auto& v) { v.value = flip_z(swap_yz(v.value)) * cr; });
+        }
+        else {
             c.each<mu::quatf>([&](auto& v) { v.value = flip_z(swap_yz(v.value)); });
-            if ((anim.entity_type == EntityType::Camera || anim.entity_type == EntityType::Light) && c.name == mskTransformRotation) {
-                const mu::quatf cr = mu::rotate_x(-90.0f * mu::DegToRad);
-                c.each<mu::quatf>([&](auto& v) {
-                    v.value *= cr;
-                });
-            }
-            break;
-        default:
-            break;
         }
-    };
-
-    for (auto& curve : anim.curves) {
-        convert_curve(*curve);
+        break;
+    default:
+        break;
     }
 }
 
@@ -342,16 +334,9 @@ void RotateX_ZUpCorrector::convertPoints(Points &e)
     convertTransform(e);
 }
 
-void RotateX_ZUpCorrector::convert(Animation &e)
+void RotateX_ZUpCorrector::convertAnimationCurve(Animation &anim, AnimationCurve &c)
 {
-    if (!e.isRoot())
-        return;
-    super::convert(e);
-}
-
-void RotateX_ZUpCorrector::convertAnimationCurve(AnimationCurve &c)
-{
-    if (!c.data_flags.affect_handedness)
+    if (!anim.isRoot() || !c.data_flags.affect_handedness)
         return;
 
     switch (c.data_type) {
@@ -375,4 +360,77 @@ void RotateX_ZUpCorrector::convertAnimationCurve(AnimationCurve &c)
     }
 }
 
+
+
+std::shared_ptr<VertexStreamConverter> VertexStreamConverter::create(const std::vector<std::shared_ptr<EntityConverter>>& converters)
+{
+    return std::make_shared<VertexStreamConverter>(converters);
+}
+
+VertexStreamConverter::VertexStreamConverter(const std::vector<std::shared_ptr<EntityConverter>>& converters)
+{
+    // the conversions are linear, so the chain is composed by converting the basis vectors
+    m_point_matrix = m_vector_matrix = mu::float4x4::identity();
+    for (int i = 0; i < 3; ++i) {
+        mu::float3 p = (mu::float3&)m_point_matrix[i];
+        mu::float3 v = (mu::float3&)m_vector_matrix[i];
+        for (auto& cv : converters) {
+            p = cv->convertPoint(p);
+            v = cv->convertVector(v);
+        }
+        (mu::float3&)m_point_matrix[i] = p;
+        (mu::float3&)m_vector_matrix[i] = v;
+    }
+}
+
+bool VertexStreamConverter::isIdentity() const
+{
+    return m_point_matrix == mu::float4x4::identity() && m_vector_matrix == mu::float4x4::identity();
+}
+
+void VertexStreamConverter::convertTransform(Transform &/*e*/)
+{
+}
+
+void VertexStreamConverter::convertCamera(Camera &/*e*/)
+{
+}
+
+void VertexStreamConverter::convertLight(Light &/*e*/)
+{
+}
+
+void VertexStreamConverter::convertMesh(Mesh &e)
+{
+    mu::MulPoints(m_point_matrix, e.points.cdata(), e.points.data(), e.points.size());
+    mu::MulVectors(m_vector_matrix, e.normals.cdata(), e.normals.data(), e.normals.size());
+    for (auto& t : e.tangents)
+        t = mu::mul_v(m_vector_matrix, t); // keeps w (binormal sign)
+    mu::MulVectors(m_vector_matrix, e.velocities.cdata(), e.velocities.data(), e.velocities.size());
+
+    for (auto& bs : e.blendshapes) {
+        for (auto& frame : bs->frames) {
+            // deltas. the scale applies to them as to points
+            mu::MulPoints(m_point_matrix, frame->points.cdata(), frame->points.data(), frame->points.size());
+            mu::MulVectors(m_vector_matrix, frame->normals.cdata(), frame->normals.data(), frame->normals.size());
+            mu::MulVectors(m_vector_matrix, frame->tangents.cdata(), frame->tangents.data(), frame->tangents.size());
+        }
+    }
+}
+
+void VertexStreamConverter::convertPoints(Points &e)
+{
+    mu::MulPoints(m_point_matrix, e.points.cdata(), e.points.data(), e.points.size());
+}
+
+mu::float3 VertexStreamConverter::convertPoint(const mu::float3& v) const
+{
+    return mu::mul_p(m_point_matrix, v);
+}
+
+mu::float3 VertexStreamConverter::convertVector(const mu::float3& v) const
+{
+    return mu::mul_v(m_vector_matrix, v);
+}
+
 } // namespace ms
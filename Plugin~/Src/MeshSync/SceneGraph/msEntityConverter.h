@@ -15,6 +15,9 @@ class Points;
 class Animation;
 class AnimationCurve;
 
+// converters don't touch mesh vertex streams (points, normals, tangents, velocities, blend shape deltas) or the
+// positions of Points. they only describe how to convert them with convertPoint() and convertVector(), and
+// VertexStreamConverter applies the whole chain in one pass per stream.
 class EntityConverter
 {
 public:
@@ -26,9 +29,13 @@ public:
     virtual void convertMesh(Mesh& v) = 0;
     virtual void convertPoints(Points& v) = 0;
 
+    // must be linear
+    virtual mu::float3 convertPoint(const mu::float3& v) const;
+    virtual mu::float3 convertVector(const mu::float3& v) const;
+
     virtual void convert(AnimationClip& v);
     virtual void convert(Animation& v);
-    virtual void convertAnimationCurve(AnimationCurve& v);
+    virtual void convertAnimationCurve(Animation& anim, AnimationCurve& v);
 };
 
 
@@ -46,7 +53,9 @@ public:
     void convertMesh(Mesh& v) override;
     void convertPoints(Points& v) override;
 
-    void convertAnimationCurve(AnimationCurve& v) override;
+    mu::float3 convertPoint(const mu::float3& v) const override;
+
+    void convertAnimationCurve(Animation& anim, AnimationCurve& v) override;
 
 private:
     float m_scale;
@@ -65,7 +74,10 @@ public:
     void convertMesh(Mesh& v) override;
     void convertPoints(Points& v) override;
 
-    void convertAnimationCurve(AnimationCurve& v) override;
+    mu::float3 convertPoint(const mu::float3& v) const override;
+    mu::float3 convertVector(const mu::float3& v) const override;
+
+    void convertAnimationCurve(Animation& anim, AnimationCurve& v) override;
 };
 
 
@@ -81,7 +93,10 @@ public:
     void convertMesh(Mesh& v) override;
     void convertPoints(Points& v) override;
 
-    void convert(Animation &anim) override;
+    mu::float3 convertPoint(const mu::float3& v) const override;
+    mu::float3 convertVector(const mu::float3& v) const override;
+
+    void convertAnimationCurve(Animation& anim, AnimationCurve& v) override;
 };
 
 
@@ -99,8 +114,35 @@ public:
     void convertMesh(Mesh& v) override;
     void convertPoints(Points& v) override;
 
-    void convert(Animation& v)override;
-    void convertAnimationCurve(AnimationCurve& v) override;
+    void convertAnimationCurve(Animation& anim, AnimationCurve& v) override;
+};
+
+
+// applies convertPoint() and convertVector() of a converter chain, composed into one matrix each, to mesh vertex
+// streams and to the positions of Points. each stream is read and written once regardless of the chain length.
+class VertexStreamConverter : public EntityConverter
+{
+using super = EntityConverter;
+public:
+    static std::shared_ptr<VertexStreamConverter> create(const std::vector<std::shared_ptr<EntityConverter>>& converters);
+
+    VertexStreamConverter(const std::vector<std::shared_ptr<EntityConverter>>& converters);
+
+    // true if the chain doesn't change vertices at all
+    bool isIdentity() const;
+
+    void convertTransform(Transform& v) override;
+    void convertCamera(Camera& v) override;
+    void convertLight(Light& v) override;
+    void convertMesh(Mesh& v) override;
+    void convertPoints(Points& v) override;
+
+    mu::float3 convertPoint(const mu::float3& v) const override;
+    mu::float3 convertVector(const mu::float3& v) const override;
+
+private:
+    mu::float4x4 m_point_matrix;
+    mu::float4x4 m_vector_matrix;
 };
 
 
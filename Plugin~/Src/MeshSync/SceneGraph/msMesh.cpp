@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "MeshSync/SceneGraph/msScene.h"
 #include "MeshSync/SceneGraph/msMesh.h"
+#include "MeshSync/SceneGraph/msMeshRefineCache.h"
 
 
 
@@ -216,6 +217,48 @@ void BoneData::clear()
     weights.clear();
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+
+#define EachMember(F)\
+    F(base_checksum) F(range_offsets) F(range_counts) F(points) F(normals) F(colors) F(velocities)
+
+void MeshVertexPatch::serialize(std::ostream& os) const
+{
+    EachMember(msWrite);
+}
+
+void MeshVertexPatch::deserialize(std::istream& is)
+{
+    EachMember(msRead);
+}
+
+void MeshVertexPatch::detach()
+{
+#define Body(A) vdetach(A);
+    EachMember(Body);
+#undef Body
+}
+
+void MeshVertexPatch::clear()
+{
+    base_checksum = 0;
+    range_offsets.clear();
+    range_counts.clear();
+    points.clear();
+    normals.clear();
+    colors.clear();
+    velocities.clear();
+}
+
+size_t MeshVertexPatch::vertexCount() const
+{
+    size_t ret = 0;
+    for (int c : range_counts)
+        ret += c;
+    return ret;
+}
+#undef EachMember
+
 #define EachTopologyAttribute(F)\
     F(counts) F(indices) F(material_ids)
 
@@ -255,6 +298,7 @@ void BoneData::clear()
             op(stream, m_uv[i]); \
         } \
     } \
+    if (flags.Get(MESH_DATA_FLAG_HAS_VERTEX_PATCH))     { op(stream, vertex_patch); } \
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -294,6 +338,7 @@ void Mesh::detach()
 #define Body(A) vdetach(A);
     EachMember(Body);
 #undef Body
+    vdetach(vertex_patch);
 }
 
 void Mesh::setupDataFlags()
@@ -365,12 +410,47 @@ bool Mesh::strip(const Entity& base_)
     return true;
 }
 
+// copy the vertices in the ranges of the patch over dst
+template<class T>
+static bool ApplyVertexPatch(SharedVector<T>& dst, const SharedVector<T>& src, const MeshVertexPatch& patch, size_t num_vertices)
+{
+    if (src.empty())
+        return true;
+    if (dst.size() != num_vertices || src.size() != patch.vertexCount())
+        return false;
+
+    T* d = dst.data(); // detach from the base
+    const T* s = src.cdata();
+    const size_t num_ranges = patch.range_offsets.size();
+    for (size_t ri = 0; ri < num_ranges; ++ri) {
+        int count = patch.range_counts[ri];
+        std::copy(s, s + count, d + patch.range_offsets[ri]);
+        s += count;
+    }
+    return true;
+}
+
 bool Mesh::merge(const Entity& base_)
 {
     if (!super::merge(base_))
         return false;
     auto& base = static_cast<const Mesh&>(base_);
 
+    const bool patched = md_flags.Get(MESH_DATA_FLAG_HAS_VERTEX_PATCH);
+    const size_t num_vertices = base.points.size();
+    if (patched) {
+        // the patch is valid only for the exact mesh it was made from
+        auto& patch = vertex_patch;
+        if (patch.range_offsets.size() != patch.range_counts.size() || patch.base_checksum != base.checksumGeom())
+            return false;
+        for (size_t ri = 0; ri < patch.range_offsets.size(); ++ri) {
+            int offset = patch.range_offsets[ri];
+            int count = patch.range_counts[ri];
+            if (offset < 0 || count < 0 || (size_t)offset + count > num_vertices)
+                return false;
+        }
+    }
+
     if (md_flags.Get(MESH_DATA_FLAG_UNCHANGED)) {
 #define Body(A) A = base.A;
         EachMember(Body);
@@ -384,6 +464,14 @@ bool Mesh::merge(const Entity& base_)
 #define Body(A) assign_if_empty(A, base.A);
         EachGeometryAttribute(Body);
 #undef Body
+
+        if (patched) {
+#define Body(A) if (!ApplyVertexPatch(A, vertex_patch.A, vertex_patch, num_vertices)) return false;
+            Body(points) Body(normals) Body(colors) Body(velocities)
+#undef Body
+            vertex_patch.clear();
+            md_flags.Set(MESH_DATA_FLAG_HAS_VERTEX_PATCH, false);
+        }
     }
     return true;
 }
@@ -413,6 +501,97 @@ bool Mesh::diff(const Entity& e1_, const Entity& e2_)
     return true;
 }
 
+bool Mesh::makeVertexPatch(const Mesh& base, float max_ratio)
+{
+    const size_t num_vertices = points.size();
+    if (num_vertices == 0 || base.points.size() != num_vertices || !(refine_settings == base.refine_settings))
+        return false;
+
+    // attributes that are not patched must be identical
+    bool identical = true;
+    auto compare_attribute = [&](const auto& a1, const auto& a2) {
+        if (identical && !mu::near_equal(a1, a2))
+            identical = false;
+    };
+#define Body(A) compare_attribute(A, base.A);
+    EachTopologyAttribute(Body);
+    Body(tangents);
+    for (uint32_t i = 0; i < MeshSyncConstants::MAX_UV; ++i)
+        Body(m_uv[i]);
+#undef Body
+    if (!identical)
+        return false;
+
+    // patched attributes must be empty or per-vertex
+    auto is_patchable = [&](const auto& a1, const auto& a2) {
+        return a1.size() == a2.size() && (a1.empty() || a1.size() == num_vertices);
+    };
+    if (!is_patchable(normals, base.normals) || !is_patchable(colors, base.colors) || !is_patchable(velocities, base.velocities))
+        return false;
+
+    // mark modified vertices. bit per attribute. compared bitwise as small changes by sculpting matter
+    enum { Points = 1, Normals = 2, Colors = 4, Velocities = 8 };
+    RawVector<uint8_t> modified;
+    modified.resize_discard(num_vertices);
+    mu::parallel_for_blocked(0, (int)num_vertices, 4096, [&](int begin, int end) {
+        auto differs = [](const auto& a1, const auto& a2, int i) {
+            return !a1.empty() && std::memcmp(&a1[i], &a2[i], sizeof(a1[i])) != 0;
+        };
+        const Mesh& cur = *this;
+        for (int vi = begin; vi < end; ++vi) {
+            uint8_t m = 0;
+            if (differs(cur.points, base.points, vi))           m |= Points;
+            if (differs(cur.normals, base.normals, vi))         m |= Normals;
+            if (differs(cur.colors, base.colors, vi))           m |= Colors;
+            if (differs(cur.velocities, base.velocities, vi))   m |= Velocities;
+            modified[vi] = m;
+        }
+    });
+
+    // contiguous modified vertices make a range
+    MeshVertexPatch patch;
+    uint8_t modified_attributes = 0;
+    size_t num_modified = 0;
+    for (size_t vi = 0; vi < num_vertices; ) {
+        if (!modified[vi]) {
+            ++vi;
+            continue;
+        }
+        size_t begin = vi;
+        for (; vi < num_vertices && modified[vi]; ++vi)
+            modified_attributes |= modified[vi];
+        patch.range_offsets.push_back((int)begin);
+        patch.range_counts.push_back((int)(vi - begin));
+        num_modified += vi - begin;
+    }
+    if (num_modified > num_vertices * max_ratio)
+        return false;
+
+    auto gather = [&](auto& dst, const auto& src) {
+        dst.resize_discard(num_modified);
+        auto* d = dst.data();
+        for (size_t ri = 0; ri < patch.range_offsets.size(); ++ri) {
+            const auto* s = src.cdata() + patch.range_offsets[ri];
+            d = std::copy(s, s + patch.range_counts[ri], d);
+        }
+    };
+    if (modified_attributes & Points)       gather(patch.points, points);
+    if (modified_attributes & Normals)      gather(patch.normals, normals);
+    if (modified_attributes & Colors)       gather(patch.colors, colors);
+    if (modified_attributes & Velocities)   gather(patch.velocities, velocities);
+    patch.base_checksum = base.checksumGeom();
+
+    // everything else comes from the base
+#define Body(A) A.clear();
+    EachGeometryAttribute(Body);
+#undef Body
+    vertex_patch = std::move(patch);
+    md_flags.Set(MESH_DATA_FLAG_HAS_VERTEX_PATCH, true);
+    md_flags.Set(MESH_DATA_FLAG_TOPOLOGY_UNCHANGED, true);
+    md_flags.Set(MESH_DATA_FLAG_UNCHANGED, false);
+    return true;
+}
+
 bool Mesh::lerp(const Entity& e1_, const Entity& e2_, float t)
 {
     if (!super::lerp(e1_, e2_, t))
@@ -473,6 +652,7 @@ void Mesh::clear()
     vclear(weights1);
     bone_weight_count = 0;
     bounds = {};
+    vertex_patch.clear();
 }
 
 uint64_t Mesh::hash() const
@@ -558,7 +738,20 @@ static inline void Remap(C1& dst, const C2& src, const C3& indices)
     }
 }
 
-void Mesh::refine()
+// true if every corner of the expanded attribute has the same value as the new vertex the record maps it to.
+// the cached splits stay valid as long as no corner needs a vertex of its own.
+template<class T>
+static bool FitsRecord(const SharedVector<T>& values, const RawVector<int>& remap, const RawVector<int>& old2new)
+{
+    const size_t n = old2new.size();
+    for (size_t ii = 0; ii < n; ++ii) {
+        if (values[ii] != values[remap[old2new[ii]]])
+            return false;
+    }
+    return true;
+}
+
+void Mesh::refine(MeshRefineCache *cache)
 {
     if (cache_flags.constant)
         return;
@@ -611,7 +804,25 @@ void Mesh::refine()
     } else if (mrs.flags.Get(MESH_REFINE_FLAG_GEN_NORMALS_WITH_SMOOTH_ANGLE) 
                && !mrs.flags.Get(MESH_REFINE_FLAG_NO_REINDEXING)) 
     {
-        GenerateNormalsWithSmoothAngle(normals.as_raw(), points, counts, indices, mrs.smooth_angle, flip_normals);
+        // the connection only depends on the topology. keep it for the next frame of this entity
+        MeshRefineCache::ConnectionPtr connection;
+        uint64_t connection_hash = 0;
+        const bool cache_connection = cache && id != InvalidID;
+        if (cache_connection) {
+            const uint32_t num_points = (uint32_t)points.size();
+            connection_hash = mu::HashInt32(&num_points, sizeof(num_points));
+            connection_hash = mu::HashInt32(counts.cdata(), counts.size_in_byte(), connection_hash);
+            connection_hash = mu::HashInt32(indices.cdata(), indices.size_in_byte(), connection_hash);
+            connection = cache->findConnection(id, connection_hash);
+        }
+        if (!connection) {
+            auto tmp = std::make_shared<mu::MeshConnectionInfo>();
+            tmp->buildConnection(indices, counts, points);
+            connection = tmp;
+            if (cache_connection)
+                cache->storeConnection(id, connection_hash, connection);
+        }
+        GenerateNormalsWithSmoothAngle(normals.as_raw(), *connection, points, counts, indices, mrs.smooth_angle, flip_normals);
     }
 
     // generate back faces
@@ -622,9 +833,16 @@ void Mesh::refine()
     auto handle_tangents = [this, &mrs]() {
         // generating tangents require normals and uvs
         if (mrs.flags.Get(MESH_REFINE_FLAG_GEN_TANGENTS) && normals.size() == points.size() && m_uv[0].size() == points.size()) {
-            tangents.resize(points.size());
-            GenerateTangentsTriangleIndexed(tangents.data(),
-                points.cdata(), m_uv[0].cdata(), normals.cdata(), indices.cdata(), (int)indices.size() / 3, (int)points.size());
+            // indices are still polygons if re-indexing is disabled
+            const bool polygons = !counts.empty() && std::any_of(counts.begin(), counts.end(), [](int c) { return c != 3; });
+            if (mrs.flags.Get(MESH_REFINE_FLAG_NO_REINDEXING) && polygons) {
+                GenerateTangentsPoly(tangents.as_raw(), points, m_uv[0], normals, counts, indices);
+            }
+            else {
+                tangents.resize(points.size());
+                GenerateTangentsTriangleIndexed(tangents.data(),
+                    points.cdata(), m_uv[0].cdata(), normals.cdata(), indices.cdata(), (int)indices.size() / 3, (int)points.size());
+            }
         }
     };
 
@@ -662,59 +880,124 @@ void Mesh::refine()
     else {
         size_t num_indices_old = indices.size();
         size_t num_points_old = points.size();
-
-        RawVector<mu::float3> tmp_normals;
-        RawVector<mu::float2> tmp_uv[MeshSyncConstants::MAX_UV];
-        RawVector<int> remap_uv[MeshSyncConstants::MAX_UV];
-        RawVector<mu::float4> tmp_colors;
-        RawVector<int> remap_normals, remap_colors;
-
-        mu::MeshRefiner refiner;
-        refiner.split_unit = mrs.flags.Get(MESH_REFINE_FLAG_SPLIT)? mrs.split_unit : INT_MAX;
-        refiner.points = points;
-        refiner.indices = indices;
-        refiner.counts = counts;
-        refiner.buildConnection();
-
         const size_t numIndices = indices.size();
+        const bool flip_faces = mrs.flags.Get(MESH_REFINE_FLAG_FLIP_FACES);
+        const bool has_face_groups = md_flags.Get(MESH_DATA_FLAG_HAS_FACE_GROUPS);
+        const int split_unit = mrs.flags.Get(MESH_REFINE_FLAG_SPLIT) ? mrs.split_unit : INT_MAX;
 
+        // per-index attributes are welded by value, so which ones are per-index is part of the topology
+        uint32_t expanded = 0;
         if (normals.size() == numIndices)
-            refiner.addExpandedAttribute<mu::float3>(normals, tmp_normals, remap_normals);
-        for (uint32_t i=0;i<MeshSyncConstants::MAX_UV;++i) {
-            if (m_uv[i].size() != numIndices) {
-                continue;
+            expanded |= 1 << 0;
+        for (uint32_t i = 0; i < MeshSyncConstants::MAX_UV; ++i) {
+            if (m_uv[i].size() == numIndices)
+                expanded |= 1 << (1 + i);
+        }
+        if (colors.size() == numIndices)
+            expanded |= 1 << (1 + MeshSyncConstants::MAX_UV);
+
+        // reuse the splits of the previous frame if the topology has not changed
+        MeshRefineCache::RecordPtr rec;
+        uint64_t topology_hash = 0;
+        if (cache && id != InvalidID) {
+            const uint32_t signature[] = { (uint32_t)num_points_old, (uint32_t)split_unit, expanded, (uint32_t)flip_faces, (uint32_t)has_face_groups };
+            topology_hash = mu::HashInt32(signature, sizeof(signature));
+            topology_hash = mu::HashInt32(counts.cdata(), counts.size_in_byte(), topology_hash);
+            topology_hash = mu::HashInt32(indices.cdata(), indices.size_in_byte(), topology_hash);
+            topology_hash = mu::HashInt32(material_ids.cdata(), material_ids.size_in_byte(), topology_hash);
+
+            rec = cache->find(id, topology_hash);
+            if (rec) {
+                bool fits = rec->old2new_indices.size() == numIndices;
+                if (fits && !rec->remap_normals.empty())
+                    fits = FitsRecord(normals, rec->remap_normals, rec->old2new_indices);
+                for (uint32_t i = 0; fits && i < MeshSyncConstants::MAX_UV; ++i) {
+                    if (!rec->remap_uv[i].empty())
+                        fits = FitsRecord(m_uv[i], rec->remap_uv[i], rec->old2new_indices);
+                }
+                if (fits && !rec->remap_colors.empty())
+                    fits = FitsRecord(colors, rec->remap_colors, rec->old2new_indices);
+                if (fits)
+                    cache->addHit();
+                else
+                    rec = nullptr;
             }
-
-            refiner.addExpandedAttribute<mu::float2>(m_uv[i], tmp_uv[i], remap_uv[i]);
         }
 
-        if (colors.size() == indices.size())
-            refiner.addExpandedAttribute<mu::float4>(colors, tmp_colors, remap_colors);
+        if (!rec) {
+            RawVector<mu::float3> tmp_normals;
+            RawVector<mu::float2> tmp_uv[MeshSyncConstants::MAX_UV];
+            RawVector<mu::float4> tmp_colors;
+            auto new_rec = std::make_shared<MeshRefineCache::Record>();
+
+            mu::MeshRefiner refiner;
+            refiner.split_unit = split_unit;
+            refiner.points = points;
+            refiner.indices = indices;
+            refiner.counts = counts;
+
+            if (normals.size() == numIndices)
+                refiner.addExpandedAttribute<mu::float3>(normals, tmp_normals, new_rec->remap_normals);
+            for (uint32_t i=0;i<MeshSyncConstants::MAX_UV;++i) {
+                if (m_uv[i].size() != numIndices) {
+                    continue;
+                }
+
+                refiner.addExpandedAttribute<mu::float2>(m_uv[i], tmp_uv[i], new_rec->remap_uv[i]);
+            }
 
-        // refine
-        refiner.refine();
-        refiner.retopology(mrs.flags.Get(MESH_REFINE_FLAG_FLIP_FACES));
-        refiner.genSubmeshes(material_ids, md_flags.Get(MESH_DATA_FLAG_HAS_FACE_GROUPS));
+            if (colors.size() == indices.size())
+                refiner.addExpandedAttribute<mu::float4>(colors, tmp_colors, new_rec->remap_colors);
+
+            // refine
+            refiner.refine();
+            refiner.retopology(flip_faces);
+            refiner.genSubmeshes(material_ids, has_face_groups);
+
+            new_rec->topology_hash = topology_hash;
+            new_rec->new2old_points.swap(refiner.new2old_points);
+            // new_indices has the vertex of every corner of the emitted faces in order. it maps all old indices
+            // only if no face was skipped. otherwise the map stays empty and the record never fits.
+            if (refiner.new_indices.size() == numIndices)
+                new_rec->old2new_indices.swap(refiner.new_indices);
+            new_rec->indices.swap(refiner.new_indices_submeshes);
+            for (auto& src : refiner.submeshes) {
+                SubmeshData sm;
+                sm.index_count = src.index_count;
+                sm.index_offset = src.index_offset;
+                sm.topology = (Topology)src.topology;
+                sm.material_id = src.material_id;
+                new_rec->submeshes.push_back(sm);
+            }
+            if (cache && id != InvalidID)
+                cache->store(id, new_rec);
+            rec = new_rec;
+        }
+        const RawVector<int>& new2old_points = rec->new2old_points;
+        const RawVector<int>& remap_normals = rec->remap_normals;
 
         // apply new points & indices
-        refiner.new_points.swap(points);
-        refiner.new_counts.swap(counts);
-        refiner.new_indices_submeshes.swap(indices);
+        {
+            RawVector<mu::float3> tmp_points;
+            Remap(tmp_points, points, new2old_points);
+            tmp_points.swap(points);
+
+            RawVector<int> tmp_indices;
+            tmp_indices.assign(rec->indices.cdata(), rec->indices.size());
+            tmp_indices.swap(indices);
+        }
 
         // setup submeshes
-        submeshes.clear();
-        for (auto& src : refiner.submeshes) {
-            SubmeshData sm;
-            sm.index_count = src.index_count;
-            sm.index_offset = src.index_offset;
-            sm.topology = (Topology)src.topology;
-            sm.material_id = src.material_id;
-            submeshes.push_back(sm);
+        {
+            RawVector<SubmeshData> tmp_submeshes;
+            tmp_submeshes.assign(rec->submeshes.cdata(), rec->submeshes.size());
+            tmp_submeshes.swap(submeshes);
         }
 
         // remap vertex attributes
         if (!normals.empty()) {
-            Remap(tmp_normals, normals, !remap_normals.empty() ? remap_normals : refiner.new2old_points);
+            RawVector<mu::float3> tmp_normals;
+            Remap(tmp_normals, normals, !remap_normals.empty() ? remap_normals : new2old_points);
             tmp_normals.swap(normals);
         }
 
@@ -723,13 +1006,15 @@ void Mesh::refine()
             if (m_uv[i].empty())
                 continue;
 
-            Remap(tmp_uv[i], m_uv[i], !remap_uv[i].empty() ? remap_uv[i] : refiner.new2old_points);
-            tmp_uv[i].swap(m_uv[i]);
+            RawVector<mu::float2> tmp_uv;
+            Remap(tmp_uv, m_uv[i], !rec->remap_uv[i].empty() ? rec->remap_uv[i] : new2old_points);
+            tmp_uv.swap(m_uv[i]);
 
         }
 
         if (!colors.empty()) {
-            Remap(tmp_colors, colors, !remap_colors.empty() ? remap_colors : refiner.new2old_points);
+            RawVector<mu::float4> tmp_colors;
+            Remap(tmp_colors, colors, !rec->remap_colors.empty() ? rec->remap_colors : new2old_points);
             tmp_colors.swap(colors);
         }
 
@@ -739,14 +1024,14 @@ void Mesh::refine()
         // velocities
         if (velocities.size() == num_points_old) {
             RawVector<mu::float3> tmp_velocities;
-            Remap(tmp_velocities, velocities, refiner.new2old_points);
+            Remap(tmp_velocities, velocities, new2old_points);
             tmp_velocities.swap(velocities);
         }
 
         // bone weights
         if (weights4.size() == num_points_old) {
             RawVector<mu::Weights4> tmp_weights;
-            Remap(tmp_weights, weights4, refiner.new2old_points);
+            Remap(tmp_weights, weights4, new2old_points);
             weights4.swap(tmp_weights);
         }
         if (!weights1.empty() && bone_counts.size() == num_points_old && bone_offsets.size() == num_points_old) {
@@ -754,7 +1039,7 @@ void Mesh::refine()
             RawVector<int> tmp_bone_offsets;
             RawVector<mu::Weights1> tmp_weights;
 
-            Remap(tmp_bone_counts, bone_counts, refiner.new2old_points);
+            Remap(tmp_bone_counts, bone_counts, new2old_points);
 
             size_t num_points = points.size();
             tmp_bone_offsets.resize_discard(num_points);
@@ -770,7 +1055,7 @@ void Mesh::refine()
             // remap weights
             for (size_t i = 0; i < num_points; ++i) {
                 int new_offset = tmp_bone_offsets[i];
-                int old_offset = bone_offsets[refiner.new2old_points[i]];
+                int old_offset = bone_offsets[new2old_points[i]];
                 weights1[old_offset].copy_to(&tmp_weights[new_offset], tmp_bone_counts[i]);
             }
 
@@ -792,12 +1077,12 @@ void Mesh::refine()
                 for (auto& fp : bs->frames) {
                     auto& f = *fp;
                     if (f.points.size() == num_points_old) {
-                        Remap(tmp, f.points, refiner.new2old_points);
+                        Remap(tmp, f.points, new2old_points);
                         f.points.swap(tmp);
                     }
 
                     if (f.normals.size() == num_points_old) {
-                        Remap(tmp, f.normals, refiner.new2old_points);
+                        Remap(tmp, f.normals, new2old_points);
                         f.normals.swap(tmp);
                     }
                     else if (f.normals.size() == num_indices_old) {
@@ -806,7 +1091,7 @@ void Mesh::refine()
                     }
 
                     if (f.tangents.size() == num_points_old) {
-                        Remap(tmp, f.tangents, refiner.new2old_points);
+                        Remap(tmp, f.tangents, new2old_points);
                         f.tangents.swap(tmp);
                     }
                 }
@@ -0,0 +1,66 @@
+#include "pch.h"
+#include "MeshSync/SceneGraph/msMeshRefineCache.h"
+
+namespace ms {
+
+MeshRefineCache::RecordPtr MeshRefineCache::find(int id, uint64_t topology_hash) const
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto it = m_records.find(id);
+    if (it == m_records.end() || it->second->topology_hash != topology_hash)
+        return nullptr;
+    return it->second;
+}
+
+void MeshRefineCache::store(int id, RecordPtr record)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_records[id] = std::move(record);
+}
+
+MeshRefineCache::ConnectionPtr MeshRefineCache::findConnection(int id, uint64_t topology_hash) const
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto it = m_connections.find(id);
+    if (it == m_connections.end() || it->second.first != topology_hash)
+        return nullptr;
+    return it->second.second;
+}
+
+void MeshRefineCache::storeConnection(int id, uint64_t topology_hash, ConnectionPtr connection)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_connections[id] = { topology_hash, std::move(connection) };
+}
+
+void MeshRefineCache::erase(int id)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_records.erase(id);
+    m_connections.erase(id);
+}
+
+void MeshRefineCache::clear()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_records.clear();
+    m_connections.clear();
+}
+
+size_t MeshRefineCache::size() const
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_records.size();
+}
+
+uint64_t MeshRefineCache::getNumHits() const
+{
+    return m_num_hits;
+}
+
+void MeshRefineCache::addHit()
+{
+    ++m_num_hits;
+}
+
+} // namespace ms
@@ -98,6 +98,8 @@ void Scene::concat(Scene& src, bool move_buffer)
     if (move_buffer) {
         for (auto& buf : src.scene_buffers)
             scene_buffers.push_back(std::move(buf));
+        for (auto& buf : src.external_buffers)
+            external_buffers.push_back(std::move(buf));
         src.clear();
     }
 }
@@ -192,6 +194,7 @@ void Scene::clear()
     constraints.clear();
 
     scene_buffers.clear();
+    external_buffers.clear();
     data_sources.clear();
     profile_data = {};
 }
@@ -219,7 +222,7 @@ void Scene::sanitizeObjectName(std::string& name)
     }
 }
 
-void Scene::import(const SceneImportSettings& cv)
+void Scene::import(const SceneImportSettings& cv, MeshRefineCache *refine_cache)
 {
     // receive and convert assets
     bool flip_x = settings.handedness == Handedness::Right || settings.handedness == Handedness::RightZUp;
@@ -239,6 +242,12 @@ void Scene::import(const SceneImportSettings& cv)
         else if (cv.zup_correction_mode == ZUpCorrectionMode::RotateX)
             converters.push_back(RotateX_ZUpCorrector::create());
     }
+    if (!converters.empty()) {
+        // vertex streams are converted by the whole chain in one pass
+        auto vertex_converter = VertexStreamConverter::create(converters);
+        if (!vertex_converter->isIdentity())
+            converters.push_back(vertex_converter);
+    }
 
     auto convert = [&converters](auto& obj) {
         for (auto& cv : converters)
@@ -257,7 +266,7 @@ void Scene::import(const SceneImportSettings& cv)
             mesh.refine_settings.flags.Set(MESH_REFINE_FLAG_SPLIT, true);
             mesh.refine_settings.split_unit = cv.mesh_split_unit;
             mesh.refine_settings.max_bone_influence = cv.mesh_max_bone_influence;
-            mesh.refine();
+            mesh.refine(refine_cache);
         }
 
         if (!converters.empty())
@@ -273,7 +282,11 @@ void Scene::import(const SceneImportSettings& cv)
             mu::parallel_for_each(clip.animations.begin(), clip.animations.end(), [&](AnimationPtr& anim) {
                 sanitizeHierarchyPath(anim->path);
                 Animation::validate(anim);
-                convert(*anim);
+                // curve by curve, so each curve stays in cache while the whole chain converts it
+                for (auto& curve : anim->curves) {
+                    for (auto& cv : converters)
+                        cv->convertAnimationCurve(*anim, *curve);
+                }
             });
         }
     }
@@ -140,109 +140,178 @@ void AsyncSceneSender::send()
     auto append = [](auto& dst, auto& src) { dst.insert(dst.end(), src.begin(), src.end()); };
 
     bool succeeded = true;
-    ms::Client client(client_settings);
+    const ClientSettings& cs = m_client ? m_client->getSettings() : client_settings;
+    if (!m_client || cs.server != client_settings.server || cs.port != client_settings.port || cs.timeout_ms != client_settings.timeout_ms ||
+        cs.max_connections != client_settings.max_connections || cs.keep_alive_timeout_ms != client_settings.keep_alive_timeout_ms ||
+        cs.shared_memory != client_settings.shared_memory || cs.compression != client_settings.compression ||
+        cs.compression_level != client_settings.compression_level) {
+        m_client.reset(new ms::Client(client_settings));
+        diff_tracker.clear(); // may be another server
+    }
+    ms::Client& client = *m_client;
+    if (send_changes_only) {
+        diff_tracker.forget(deleted_entities);
+        diff_tracker.filter(transforms);
+        diff_tracker.filter(geometries);
+    }
 
     auto setup_message = [this](ms::Message& mes) {
         mes.session_id = session_id;
         mes.message_id = message_count++;
         mes.timestamp_send = mu::Now();
     };
+    auto create_set_message = [this]() {
+        auto mes = std::make_shared<ms::SetMessage>();
+        mes->scene->settings = scene_settings;
+        return mes;
+    };
+
+    // small messages are packed into BatchMessages of up to max_batch_size bytes, so a scene of small objects takes
+    // a single round trip. the batch is sent before any message that goes on its own to keep the order.
+    ms::BatchMessage batch;
+    uint64_t batch_size = 0;
+    auto flush_batch = [&]() {
+        if (batch.messages.empty())
+            return true;
+        bool ret = client.send(batch);
+        batch.messages.clear();
+        batch_size = 0;
+        return ret;
+    };
+    auto send_message = [&](auto mes) {
+        setup_message(*mes);
+        if (max_batch_size == 0)
+            return client.send(*mes);
+        batch_size += ssize(*mes);
+        batch.messages.push_back(mes);
+        return batch_size < max_batch_size || flush_batch();
+    };
+
+    // send messages of one stage concurrently, up to max_in_flight at a time. each message is serialized on its own
+    // thread while others are on the wire. all of them are acknowledged when this returns, so the server receives
+    // the stages (and the scene end fence) in order.
+    auto send_pipelined = [&](size_t count, auto&& setup_set_message) {
+        const size_t window = (size_t)std::max(max_in_flight, 1);
+        std::deque<std::future<bool>> in_flight;
+        bool ret = true;
+        for (size_t i = 0; i < count && ret; ++i) {
+            if (in_flight.size() >= window) {
+                ret = in_flight.front().get();
+                in_flight.pop_front();
+                if (!ret)
+                    break;
+            }
+            auto mes = create_set_message();
+            setup_message(*mes);
+            setup_set_message(*mes, i);
+            in_flight.push_back(std::async(std::launch::async, [&client, mes]() { return client.send(*mes); }));
+        }
+        for (auto& f : in_flight)
+            ret = f.get() && ret;
+        return ret;
+    };
+
+    // textures and geometries that don't fit in a batch are pipelined
+    auto send_objects = [&](auto& objects, auto&& assign) {
+        std::vector<size_t> large;
+        bool ret = true;
+        for (size_t i = 0; i < objects.size() && ret; ++i) {
+            if (max_batch_size == 0 || ssize(*objects[i]) >= max_batch_size) {
+                large.push_back(i);
+                continue;
+            }
+            auto mes = create_set_message();
+            assign(*mes, objects[i]);
+            ret = send_message(mes);
+        }
+        if (ret && !large.empty()) {
+            ret = flush_batch() && send_pipelined(large.size(), [&](ms::SetMessage& mes, size_t i) {
+                assign(mes, objects[large[i]]);
+            });
+        }
+        return ret;
+    };
 
     // notify scene begin
     {
-        ms::FenceMessage mes;
-        setup_message(mes);
-        mes.type = ms::FenceMessage::FenceType::SceneBegin;
-        succeeded = succeeded && client.send(mes);
+        auto mes = std::make_shared<ms::FenceMessage>();
+        mes->type = ms::FenceMessage::FenceType::SceneBegin;
+        succeeded = succeeded && send_message(mes);
         if (!succeeded)
             goto cleanup;
     }
 
     // assets
     if (!assets.empty()) {
-        ms::SetMessage mes;
-        setup_message(mes);
-        mes.scene->settings = scene_settings;
-        mes.scene->assets = assets;
-        succeeded = succeeded && client.send(mes);
+        auto mes = create_set_message();
+        mes->scene->assets = assets;
+        succeeded = succeeded && send_message(mes);
         if (!succeeded)
             goto cleanup;
     }
 
     // textures
     if (!textures.empty()) {
-        for (std::vector<std::shared_ptr<Texture>>::value_type& tex : textures) {
-            ms::SetMessage mes;
-            setup_message(mes);
-            mes.scene->settings = scene_settings;
-            mes.scene->assets = std::vector<AssetPtr> {tex};
-            succeeded = succeeded && client.send(mes);
-            if (!succeeded)
-                goto cleanup;
-        };
+        succeeded = send_objects(textures, [](ms::SetMessage& mes, const TexturePtr& tex) {
+            mes.scene->assets = std::vector<AssetPtr> { tex };
+        });
+        if (!succeeded)
+            goto cleanup;
     }
 
     // materials and non-geometry objects
     if (!materials.empty() || !transforms.empty()) {
-        ms::SetMessage mes;
-        setup_message(mes);
-        mes.scene->settings = scene_settings;
-        append(mes.scene->assets, materials);
-        mes.scene->entities = transforms;
-        succeeded = succeeded && client.send(mes);
+        auto mes = create_set_message();
+        append(mes->scene->assets, materials);
+        mes->scene->entities = transforms;
+        succeeded = succeeded && send_message(mes);
         if (!succeeded)
             goto cleanup;
     }
 
     // geometries
     if (!geometries.empty()) {
-        for (auto& geom : geometries) {
-            ms::SetMessage mes;
-            setup_message(mes);
-            mes.scene->settings = scene_settings;
+        succeeded = send_objects(geometries, [](ms::SetMessage& mes, const TransformPtr& geom) {
             mes.scene->entities = { geom };
-            succeeded = succeeded && client.send(mes);
-            if (!succeeded)
-                goto cleanup;
-        };
+        });
+        if (!succeeded)
+            goto cleanup;
     }
 
     // animations
     if (!animations.empty()) {
-        ms::SetMessage mes;
-        setup_message(mes);
-        mes.scene->settings = scene_settings;
-        append(mes.scene->assets, animations);
-        succeeded = succeeded && client.send(mes);
+        auto mes = create_set_message();
+        append(mes->scene->assets, animations);
+        succeeded = succeeded && send_message(mes);
         if (!succeeded)
             goto cleanup;
     }
 
     // deleted
     if (!deleted_entities.empty() || !deleted_materials.empty()) {
-        ms::DeleteMessage mes;
-        setup_message(mes);
-        mes.entities = deleted_entities;
-        mes.materials = deleted_materials;
-        succeeded = succeeded && client.send(mes);
+        auto mes = std::make_shared<ms::DeleteMessage>();
+        mes->entities = deleted_entities;
+        mes->materials = deleted_materials;
+        succeeded = succeeded && send_message(mes);
         if (!succeeded)
             goto cleanup;
     }
 
     // notify scene end
     {
-        ms::FenceMessage mes;
-        setup_message(mes);
-        mes.type = ms::FenceMessage::FenceType::SceneEnd;
-        succeeded = succeeded && client.send(mes);
+        auto mes = std::make_shared<ms::FenceMessage>();
+        mes->type = ms::FenceMessage::FenceType::SceneEnd;
+        succeeded = succeeded && send_message(mes) && flush_batch();
     }
 
 cleanup:
     if (succeeded) {
+        diff_tracker.commit();
         if (on_success)
             on_success();
     }
     else {
+        diff_tracker.discard();
         if (on_error)
             on_error();
     }
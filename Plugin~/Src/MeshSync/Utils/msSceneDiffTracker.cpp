@@ -0,0 +1,102 @@
+#include "pch.h"
+#include "MeshSync/Utility/msSceneDiffTracker.h"
+
+#include "MeshSync/SceneGraph/msMesh.h"
+#include "MeshSync/SceneGraph/msTransform.h"
+
+namespace ms {
+
+// the geometry is unchanged since the last send. send the rest only.
+static TransformPtr StripGeometry(const Transform& src)
+{
+    auto ret = std::static_pointer_cast<Transform>(const_cast<Transform&>(src).clone());
+    // comparing with the source clears every array and sets the data-unchanged flag of the entity type
+    ret->strip(src);
+    // Entity::strip() also clears the path, which the receiver needs to find the entity
+    ret->path = src.path;
+    ret->td_flags.Set(TRANSFORM_DATA_FLAG_UNCHANGED, false);
+    if (ret->getType() == EntityType::Mesh) {
+        // Mesh::strip() keeps these. the receiver skips the whole geometry anyway
+        auto& mesh = static_cast<Mesh&>(*ret);
+        mesh.root_bone.clear();
+        mesh.bones.clear();
+        mesh.blendshapes.clear();
+    }
+    return ret;
+}
+
+// the geometry is modified. send it as a vertex patch if possible, and ask the receiver to keep it.
+static TransformPtr MakePatch(const Mesh& src, const Mesh* base, float max_ratio)
+{
+    auto ret = std::static_pointer_cast<Mesh>(const_cast<Mesh&>(src).clone());
+    if (base)
+        ret->makeVertexPatch(*base, max_ratio);
+    ret->md_flags.Set(MESH_DATA_FLAG_PATCH_BASE, true);
+    return ret;
+}
+
+void SceneDiffTracker::filter(std::vector<TransformPtr>& entities)
+{
+    const size_t n = entities.size();
+    std::vector<Record> checksums(n);
+    mu::parallel_for(0, (int)n, 10, [&](int i) {
+        auto& e = *entities[i];
+        checksums[i].checksum_trans = e.checksumTrans();
+        checksums[i].checksum_geom = e.checksumGeom();
+    });
+
+    size_t num_kept = 0;
+    for (size_t i = 0; i < n; ++i) {
+        auto& e = entities[i];
+        auto& cur = checksums[i];
+
+        auto it = m_records.find(e->path);
+        const Record* last = it != m_records.end() ? &it->second : nullptr;
+        if (last && cur.checksum_geom == last->checksum_geom) {
+            cur.patch_base = last->patch_base;
+            if (cur.checksum_trans == last->checksum_trans)
+                continue; // nothing has changed
+            if (e->isGeometry())
+                e = StripGeometry(*e);
+        }
+        else if (vertex_patches && e->getType() == EntityType::Mesh) {
+            auto& mesh = static_cast<Mesh&>(*e);
+            cur.patch_base = std::static_pointer_cast<Mesh>(mesh.clone(true));
+            e = MakePatch(mesh, last ? last->patch_base.get() : nullptr, max_patch_ratio);
+        }
+        m_pending.emplace_back(e->path, std::move(cur));
+        entities[num_kept++] = e;
+    }
+    entities.resize(num_kept);
+}
+
+void SceneDiffTracker::commit()
+{
+    for (auto& kvp : m_pending)
+        m_records[kvp.first] = kvp.second;
+    m_pending.clear();
+}
+
+void SceneDiffTracker::discard()
+{
+    if (vertex_patches) {
+        // the receiver may have kept some of the meshes. patches against the last commit may not match them
+        clear();
+        return;
+    }
+    m_pending.clear();
+}
+
+void SceneDiffTracker::forget(const std::vector<Identifier>& entities)
+{
+    for (auto& id : entities)
+        m_records.erase(id.name);
+}
+
+void SceneDiffTracker::clear()
+{
+    m_records.clear();
+    m_pending.clear();
+}
+
+} // namespace ms
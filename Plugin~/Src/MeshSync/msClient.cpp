@@ -1,6 +1,16 @@
 #include "pch.h"
+#include <limits>
+#include "Poco/Net/NetException.h"
+#include "Poco/Net/HTTPBufferAllocator.h"
+#ifndef _WIN32
+    #include <cerrno>
+    #include <unistd.h>
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+#endif
 #include "MeshSync/msClient.h"
 #include "MeshSync/SceneGraph/msScene.h" //Scene
+#include "SceneCache/msEncoder.h" //CompressZSTDStream
 
 namespace ms {
 
@@ -12,13 +22,24 @@ Client::Client(const ClientSettings & settings)
 {
 }
 
-const std::string& Client::getErrorMessage() const
+Client::~Client()
 {
+}
+
+const ClientSettings& Client::getSettings() const
+{
+    return m_settings;
+}
+
+std::string Client::getErrorMessage() const
+{
+    std::unique_lock<std::mutex> l(m_session_mutex);
     return m_error_message;
 }
 
 bool Client::isServerAvailable(int timeout_ms)
 {
+    std::string error;
     try {
         HTTPClientSession session{ m_settings.server, m_settings.port };
         session.setTimeout(timeout_ms * 1000);
@@ -32,178 +53,403 @@ bool Client::isServerAvailable(int timeout_ms)
         StreamCopier::copyStream(rs, ostr);
         auto content = ostr.str();
         if (response.getStatus() != HTTPResponse::HTTP_OK) {
-            m_error_message = "Server is not working.";
+            error = "Server is not working.";
         }
         else {
             if (std::atoi(content.c_str()) == msProtocolVersion) {
-                m_error_message.clear();
+                const bool zstd = response.has("Accept-Encoding") &&
+                    response.get("Accept-Encoding").find(msContentEncodingZSTD) != std::string::npos;
+                m_compression = zstd ? Compression::Accepted : Compression::Refused;
+                setErrorMessage("");
                 return true;
             }
             else {
-                m_error_message = "Version doesn't match server.";
+                error = "Version doesn't match server.";
             }
         }
     }
     catch (const Poco::TimeoutException& /*e*/) {
         // in this case e.what() is empty.
-        m_error_message = "Could not reach server (timeout).";
+        error = "Could not reach server (timeout).";
     }
     catch (const Poco::Exception& e) {
-        m_error_message = e.what();
+        error = e.what();
     }
 
-    if (!m_error_message.empty()) {
+    if (!error.empty()) {
         char buf[512];
         sprintf(buf, " [%s:%d]", m_settings.server.c_str(), (int)m_settings.port);
-        m_error_message += buf;
+        error += buf;
     }
+    setErrorMessage(error.c_str());
     return false;
 }
 
-ScenePtr Client::send(const GetMessage& mes)
+void Client::setErrorMessage(const char *mes)
 {
-    ScenePtr ret;
-    try {
-        HTTPClientSession session{ m_settings.server, m_settings.port };
-        session.setTimeout(m_settings.timeout_ms * 1000);
+    // send() can be called from multiple threads
+    std::unique_lock<std::mutex> l(m_session_mutex);
+    m_error_message = mes;
+}
 
-        {
-            HTTPRequest request{ HTTPRequest::HTTP_POST, "get" };
-            request.setContentType("application/octet-stream");
-            request.setExpectContinue(true);
-            request.setContentLength(ssize(mes));
-            auto& os = session.sendRequest(request);
-            mes.serialize(os);
-            os.flush();
-        }
+Client::SessionPtr Client::acquireSession(int timeout_ms, bool& reused)
+{
+    {
+        std::unique_lock<std::mutex> l(m_session_mutex);
+        while (!m_sessions.empty()) {
+            SessionPtr session = std::move(m_sessions.back());
+            m_sessions.pop_back();
 
-        {
-            HTTPResponse response;
-            auto& is = session.receiveResponse(response);
+            // health check. nothing should be readable on an idle connection.
+            // if it is, the server has closed the connection (or it is broken).
             try {
-                ret = Scene::create(is);
+                if (session->connected() && !session->socket().poll(Timespan(0), Socket::SELECT_READ | Socket::SELECT_ERROR)) {
+                    session->setTimeout(timeout_ms * 1000);
+                    reused = true;
+                    return session;
+                }
             }
-            catch (const std::exception&) {
-                ret.reset();
+            catch (const Poco::Exception&) {
             }
         }
     }
-    catch (...) {
-    }
-    return ret;
+
+    SessionPtr session(new HTTPClientSession(m_settings.server, m_settings.port));
+    session->setTimeout(timeout_ms * 1000);
+    session->setKeepAlive(m_settings.max_connections > 0);
+    session->setKeepAliveTimeout(Timespan(m_settings.keep_alive_timeout_ms * 1000));
+    reused = false;
+    return session;
 }
 
-bool Client::send(const SetMessage& mes)
+void Client::releaseSession(SessionPtr&& session)
 {
-    try {
-        HTTPClientSession session{ m_settings.server, m_settings.port };
-        session.setTimeout(m_settings.timeout_ms * 1000);
+    std::unique_lock<std::mutex> l(m_session_mutex);
+    if (m_sessions.size() < (size_t)m_settings.max_connections)
+        m_sessions.push_back(std::move(session));
+}
+
+// send the segments straight from their memory with vectored I/O
+static void SendSegments(StreamSocket& socket, const std::vector<mu::GatherStream::Segment>& segments)
+{
+    const size_t max_buffers = 64;
+    const size_t max_buffer_size = 0x40000000;
+    const auto fd = socket.impl()->sockfd();
 
-        HTTPRequest request{ HTTPRequest::HTTP_POST, "set" };
-        request.setContentType("application/octet-stream");
-        request.setExpectContinue(true);
-        request.setContentLength(ssize(mes));
-        auto& os = session.sendRequest(request);
-        mes.serialize(os);
-        os.flush();
+    size_t si = 0, offset = 0;
+    while (si < segments.size()) {
+#ifdef _WIN32
+        WSABUF bufs[max_buffers];
+#else
+        iovec bufs[max_buffers];
+#endif
+        size_t n = 0;
+        for (size_t i = si, o = offset; i < segments.size() && n < max_buffers; ++i, o = 0) {
+            const char *data = segments[i].data + o;
+            size_t size = std::min(segments[i].size - o, max_buffer_size);
+#ifdef _WIN32
+            bufs[n].buf = (CHAR*)data;
+            bufs[n].len = (ULONG)size;
+#else
+            bufs[n].iov_base = (void*)data;
+            bufs[n].iov_len = size;
+#endif
+            ++n;
+            if (o + size < segments[i].size)
+                break; // the rest of this segment goes in the next round
+        }
 
-        HTTPResponse response;
-        auto& rs = session.receiveResponse(response);
-        std::ostringstream ostr;
-        StreamCopier::copyStream(rs, ostr);
-        return response.getStatus() == HTTPResponse::HTTP_OK;
+        size_t sent = 0;
+#ifdef _WIN32
+        DWORD bytes = 0;
+        if (::WSASend(fd, bufs, (DWORD)n, &bytes, 0, nullptr, nullptr) != 0) {
+            int err = ::WSAGetLastError();
+            if (err == WSAETIMEDOUT || err == WSAEWOULDBLOCK)
+                throw TimeoutException();
+            throw NetException("send failed", err);
+        }
+        sent = (size_t)bytes;
+#else
+        msghdr msg{};
+        msg.msg_iov = bufs;
+        msg.msg_iovlen = n;
+    #ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+    #else
+        const int flags = 0; // Poco sets SO_NOSIGPIPE on the socket
+    #endif
+        auto r = ::sendmsg(fd, &msg, flags);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                throw TimeoutException();
+            throw NetException(std::strerror(errno), errno);
+        }
+        sent = (size_t)r;
+#endif
+
+        while (sent > 0) {
+            size_t rest = segments[si].size - offset;
+            if (sent >= rest) {
+                sent -= rest;
+                ++si;
+                offset = 0;
+            }
+            else {
+                offset += sent;
+                sent = 0;
+            }
+        }
     }
-    catch (...) {
+}
+
+// copy the serialized message into a new shared memory object with a unique name
+static bool CreateSharedMemory(mu::SharedMemory& dst, std::string& name, const std::vector<mu::GatherStream::Segment>& segments, uint64_t size)
+{
+    static std::atomic_int s_count{ 0 };
+#ifdef _WIN32
+    unsigned pid = (unsigned)::GetCurrentProcessId();
+#else
+    unsigned pid = (unsigned)::getpid();
+#endif
+    name = mu::Format("ms_%u_%d", pid, ++s_count);
+    if (!dst.create(name.c_str(), (size_t)size))
         return false;
+
+    char *p = dst.data();
+    for (auto& seg : segments) {
+        memcpy(p, seg.data, seg.size);
+        p += seg.size;
     }
+    return true;
 }
 
-bool Client::send(const DeleteMessage& mes)
+// higher levels compress better but slower. pick the highest one that still compresses faster than the connection sends.
+// rough single-thread ZSTD speeds: level 1 ~400 MB/s, 3 ~250 MB/s, 6 ~100 MB/s, 9 ~60 MB/s.
+int Client::getCompressionLevel() const
 {
-    try {
-        HTTPClientSession session{ m_settings.server, m_settings.port };
-        session.setTimeout(m_settings.timeout_ms * 1000);
+    if (m_settings.compression_level > 0)
+        return m_settings.compression_level;
 
-        HTTPRequest request{ HTTPRequest::HTTP_POST, "delete" };
-        request.setContentType("application/octet-stream");
-        request.setExpectContinue(true);
-        request.setContentLength(ssize(mes));
-        auto& os = session.sendRequest(request);
-        mes.serialize(os);
-        os.flush();
+    const float MB = 1024.0f * 1024.0f;
+    const float speed = m_link_speed;
+    if (speed == 0.0f)
+        return 3; // not measured yet. ZSTD's default
+    else if (speed > 100.0f * MB)
+        return 1;
+    else if (speed > 30.0f * MB)
+        return 3;
+    else if (speed > 10.0f * MB)
+        return 6;
+    else
+        return 9;
+}
 
-        HTTPResponse response;
-        auto& rs = session.receiveResponse(response);
-        std::ostringstream ostr;
-        StreamCopier::copyStream(rs, ostr);
-        return response.getStatus() == HTTPResponse::HTTP_OK;
+template<class Handler>
+bool Client::post(const char *uri, const Message& mes, int timeout_ms, const Handler& on_response)
+{
+    const mu::nanosec start_time = mu::Now();
+
+    // serialize once. large vertex arrays are not copied but referenced in place and sent from there.
+    mu::GatherStream body;
+    mes.serialize(body);
+    const auto& segments = body.getSegments();
+    const uint64_t body_size = body.size();
+
+    // large messages to a server on the same machine are passed in shared memory and only the header goes over the socket.
+    // the server maps it before responding, so it can be released right after the response.
+    const uint64_t shared_memory_min_size = 1024 * 1024;
+    mu::SharedMemory shm;
+    std::string shm_name;
+    if (m_settings.shared_memory && m_shared_memory_available && body_size >= shared_memory_min_size)
+        CreateSharedMemory(shm, shm_name, segments, body_size);
+
+    // large messages to a server that accepts it are compressed while being sent
+    const uint64_t compression_min_size = 64 * 1024;
+    if (m_settings.compression && m_compression == Compression::Unknown) {
+        std::unique_lock<std::mutex> l(m_negotiation_mutex);
+        if (m_compression == Compression::Unknown)
+            isServerAvailable(timeout_ms);
     }
-    catch (...) {
+    bool compress = !shm.valid() && m_settings.compression && m_compression == Compression::Accepted && body_size >= compression_min_size;
+
+    for (;;) {
+        bool reused = false;
+        try {
+            SessionPtr session = acquireSession(timeout_ms, reused);
+
+            HTTPRequest request{ HTTPRequest::HTTP_POST, uri, HTTPMessage::HTTP_1_1 };
+            request.setContentType("application/octet-stream");
+            request.setExpectContinue(true);
+            request.setKeepAlive(session->getKeepAlive());
+            if (shm.valid()) {
+                request.set(msSharedMemoryHeader, mu::Format("%s %llu", shm_name.c_str(), (unsigned long long)body_size));
+                request.setContentLength(0);
+            }
+            else if (compress) {
+                request.set("Content-Encoding", msContentEncodingZSTD);
+                request.setChunkedTransferEncoding(true);
+            }
+            else
+                request.setContentLength64((Poco::Int64)body_size);
+            auto& os = session->sendRequest(request);
+
+            const mu::nanosec begin = mu::Now();
+            mu::nanosec compress_time = 0;
+            uint64_t compressed_size = 0;
+            if (shm.valid()) {
+                os.flush();
+            }
+            else if (compress) {
+                mu::nanosec write_time = 0;
+                bool compressed = CompressZSTDStream(segments, body_size, getCompressionLevel(), [&](const char *data, size_t size) {
+                    const mu::nanosec t = mu::Now();
+                    os.write(data, size);
+                    write_time += mu::Now() - t;
+                    compressed_size += size;
+                });
+                compress_time = mu::Now() - begin - write_time;
+                if (!compressed)
+                    throw DataException("ZSTD compression failed");
+                os.flush();
+            }
+            else if (body_size >= (uint64_t)HTTPBufferAllocator::BUFFER_SIZE) {
+                // sendRequest() leaves the header in the buffer of os. it must be on the wire before the body,
+                // which is written straight to the socket.
+                os.flush();
+                SendSegments(session->socket(), segments);
+            }
+            else {
+                // small requests are sent in one packet with the header that is still buffered in os
+                for (auto& seg : segments)
+                    os.write(seg.data, seg.size);
+                os.flush();
+            }
+
+            HTTPResponse response;
+            auto& is = session->receiveResponse(response);
+            if (shm.valid() && response.getStatus() == HTTPResponse::HTTP_NOT_IMPLEMENTED) {
+                // the server can't open it (another machine, disabled, etc). send bodies over the socket from now on.
+                is.ignore(std::numeric_limits<std::streamsize>::max());
+                if (session->getKeepAlive() && response.getKeepAlive())
+                    releaseSession(std::move(session));
+                m_shared_memory_available = false;
+                shm.close();
+                continue;
+            }
+            if (compress && response.getStatus() == HTTPResponse::HTTP_UNSUPPORTED_MEDIA_TYPE) {
+                // the server doesn't take compressed messages any more (settings changed etc)
+                is.ignore(std::numeric_limits<std::streamsize>::max());
+                if (session->getKeepAlive() && response.getKeepAlive())
+                    releaseSession(std::move(session));
+                m_compression = Compression::Refused;
+                compress = false;
+                continue;
+            }
+            if (response.getStatus() == HTTPResponse::HTTP_SERVICE_UNAVAILABLE && response.has("Retry-After")) {
+                // the server has too many messages to process. try again when it tells, as long as the timeout allows.
+                is.ignore(std::numeric_limits<std::streamsize>::max());
+                if (session->getKeepAlive() && response.getKeepAlive())
+                    releaseSession(std::move(session));
+                const int wait_ms = std::max(std::atoi(response.get("Retry-After").c_str()), 1) * 1000;
+                if (mu::NS2MS(mu::Now() - start_time) + wait_ms < timeout_ms) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
+                    continue;
+                }
+                setErrorMessage("Server is busy.");
+                return false;
+            }
+            if (compress && compressed_size >= 1024 * 1024) {
+                // the server responds after it has received everything. the rest of the time was spent on the wire.
+                const mu::nanosec wire_time = mu::Now() - begin - compress_time;
+                if (wire_time > 0) {
+                    const float speed = (float)((double)compressed_size * 1e9 / (double)wire_time);
+                    const float prev = m_link_speed;
+                    m_link_speed = prev == 0.0f ? speed : (prev + speed) * 0.5f;
+                }
+            }
+            bool ret = on_response(response, is);
+
+            // the rest of the body must be consumed before the connection can be reused
+            is.ignore(std::numeric_limits<std::streamsize>::max());
+            if (session->getKeepAlive() && response.getKeepAlive())
+                releaseSession(std::move(session));
+            return ret;
+        }
+        catch (const Poco::Net::NetException& e) {
+            // the server may have closed a pooled connection right before it was used. retry with a new connection.
+            if (reused)
+                continue;
+            setErrorMessage(e.what());
+        }
+        catch (const Poco::TimeoutException& /*e*/) {
+            // in this case e.what() is empty.
+            setErrorMessage("Could not reach server (timeout).");
+        }
+        catch (const Poco::Exception& e) {
+            setErrorMessage(e.what());
+        }
         return false;
     }
 }
 
-bool Client::send(const FenceMessage& mes)
+ScenePtr Client::send(const GetMessage& mes)
 {
-    try {
-        HTTPClientSession session{ m_settings.server, m_settings.port };
-        session.setTimeout(m_settings.timeout_ms * 1000);
+    ScenePtr ret;
+    post("get", mes, m_settings.timeout_ms, [&ret](HTTPResponse& /*response*/, std::istream& is) {
+        try {
+            ret = Scene::create(is);
+        }
+        catch (const std::exception&) {
+            ret.reset();
+        }
+        return ret != nullptr;
+    });
+    return ret;
+}
 
-        HTTPRequest request{ HTTPRequest::HTTP_POST, "fence" };
-        request.setContentType("application/octet-stream");
-        request.setExpectContinue(true);
-        request.setContentLength(ssize(mes));
-        auto& os = session.sendRequest(request);
-        mes.serialize(os);
-        os.flush();
+bool Client::send(const SetMessage& mes)
+{
+    return post("set", mes, m_settings.timeout_ms, [](HTTPResponse& response, std::istream& /*is*/) {
+        return response.getStatus() == HTTPResponse::HTTP_OK;
+    });
+}
 
-        HTTPResponse response;
-        auto& rs = session.receiveResponse(response);
-        std::ostringstream ostr;
-        StreamCopier::copyStream(rs, ostr);
+bool Client::send(const BatchMessage& mes)
+{
+    return post("batch", mes, m_settings.timeout_ms, [](HTTPResponse& response, std::istream& /*is*/) {
         return response.getStatus() == HTTPResponse::HTTP_OK;
-    }
-    catch (...) {
-        return false;
-    }
+    });
+}
+
+bool Client::send(const DeleteMessage& mes)
+{
+    return post("delete", mes, m_settings.timeout_ms, [](HTTPResponse& response, std::istream& /*is*/) {
+        return response.getStatus() == HTTPResponse::HTTP_OK;
+    });
+}
+
+bool Client::send(const FenceMessage& mes)
+{
+    return post("fence", mes, m_settings.timeout_ms, [](HTTPResponse& response, std::istream& /*is*/) {
+        return response.getStatus() == HTTPResponse::HTTP_OK;
+    });
 }
 
 ResponseMessagePtr Client::send(const QueryMessage& mes, int timeout_ms)
 {
     ResponseMessagePtr ret;
-    try {
-        HTTPClientSession session{ m_settings.server, m_settings.port };
-        session.setTimeout(timeout_ms * 1000);
-
-        {
-            HTTPRequest request{ HTTPRequest::HTTP_POST, "query" };
-            request.setContentType("application/octet-stream");
-            request.setExpectContinue(true);
-            request.setContentLength(ssize(mes));
-            auto& os = session.sendRequest(request);
-            mes.serialize(os);
-            os.flush();
+    post("query", mes, timeout_ms, [this, &ret](HTTPResponse& response, std::istream& is) {
+        if (response.getStatus() == HTTPResponse::HTTP_OK) {
+            ret.reset(new ResponseMessage());
+            ret->deserialize(is);
         }
-
-        {
-            HTTPResponse response;
-            auto& is = session.receiveResponse(response);
-            if (response.getStatus() == HTTPResponse::HTTP_OK) {
-                ret.reset(new ResponseMessage());
-                ret->deserialize(is);
-            }
-            else {
-                m_error_message = "Server is stopped.";
-            }
+        else {
+            setErrorMessage("Server is stopped.");
         }
-    }
-    catch (const Poco::TimeoutException& /*e*/) {
-        // in this case e.what() is empty.
-        m_error_message = "Could not reach server (timeout).";
-    }
-    catch (const Poco::Exception& e) {
-        m_error_message = e.what();
-    }
+        return ret != nullptr;
+    });
     return ret;
 }
 
@@ -0,0 +1,171 @@
+#include "pch.h"
+#include "msParkedRequests.h"
+
+#include "Poco/Net/HTTPServerRequestImpl.h" //detachSocket()
+
+#include "MeshSync/msProtocol.h" //ReadyFlag
+
+namespace ms {
+
+using namespace Poco::Net;
+
+static const int kParkedSendTimeoutMS = 10000;
+static const int kParkedSendThreads = 4;
+
+ParkedResponse::ParkedResponse(StreamSocket& socket)
+    : HTTPResponse(HTTPMessage::HTTP_1_1)
+    , m_stream(socket)
+{
+    setKeepAlive(false);
+}
+
+std::ostream& ParkedResponse::send()
+{
+    write(m_stream);
+    m_sent = true;
+    return m_stream;
+}
+
+void ParkedResponse::sendText(const char* text, int stat)
+{
+    const size_t len = strlen(text);
+    setStatus((HTTPStatus)stat);
+    setContentType("text/plain");
+    setContentLength(len);
+    send().write(text, len);
+}
+
+bool ParkedResponse::sent() const
+{
+    return m_sent;
+}
+
+void ParkedResponse::flush()
+{
+    m_stream.flush();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+ParkedRequests::ParkedRequests()
+    : m_senders(kParkedSendThreads)
+{
+    m_thread = std::thread([this]() { process(); });
+}
+
+ParkedRequests::~ParkedRequests()
+{
+    stop();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+bool ParkedRequests::park(HTTPServerRequest& request, std::shared_ptr<ReadyFlag> flag, int timeout_ms, Responder&& respond)
+{
+    auto* impl = dynamic_cast<HTTPServerRequestImpl*>(&request);
+    if (!impl)
+        return false;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_stop)
+        return false;
+
+    // the HTTP thread closes its session after the handler returns as it doesn't have the socket anymore
+    Record rec;
+    rec.socket = std::make_shared<StreamSocket>(impl->detachSocket());
+    rec.flag = std::move(flag);
+    rec.deadline = mu::Now() + (mu::nanosec)timeout_ms * 1000000;
+    rec.respond = std::move(respond);
+    m_records.push_back(std::move(rec));
+    lock.unlock();
+
+    m_cond.notify_one();
+    return true;
+}
+
+void ParkedRequests::notify()
+{
+    // taking the lock ensures the thread is either scanning (and will see the flag) or waiting (and wakes up)
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.notify_one();
+}
+
+void ParkedRequests::stop()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_one();
+}
+
+int ParkedRequests::getNumParked() const
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return (int)m_records.size();
+}
+
+void ParkedRequests::process()
+{
+    std::vector<Record> done;
+    std::vector<bool> ready;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        const mu::nanosec now = mu::Now();
+        mu::nanosec next_deadline = std::numeric_limits<mu::nanosec>::max();
+        for (auto& rec : m_records) {
+            const bool r = rec.flag->isSet();
+            if (r || m_stop || now >= rec.deadline) {
+                ready.push_back(r);
+                done.push_back(std::move(rec));
+                rec.socket = nullptr;
+            }
+            else {
+                next_deadline = std::min(next_deadline, rec.deadline);
+            }
+        }
+        m_records.erase(
+            std::remove_if(m_records.begin(), m_records.end(), [](const Record& rec) { return !rec.socket; }),
+            m_records.end());
+
+        if (!done.empty()) {
+            lock.unlock();
+            for (size_t i = 0; i < done.size(); ++i) {
+                auto rec = std::make_shared<Record>(std::move(done[i]));
+                const bool r = ready[i];
+                m_senders.push([this, rec, r]() { respond(*rec, r); });
+            }
+            done.clear();
+            ready.clear();
+            lock.lock();
+            continue;
+        }
+        if (m_stop)
+            break;
+
+        if (m_records.empty())
+            m_cond.wait(lock);
+        else
+            m_cond.wait_for(lock, std::chrono::nanoseconds(next_deadline - now));
+    }
+}
+
+void ParkedRequests::respond(Record& rec, bool ready)
+{
+    try {
+        rec.socket->setSendTimeout(Poco::Timespan(kParkedSendTimeoutMS * 1000));
+        ParkedResponse response(*rec.socket);
+        rec.respond(ready, response);
+        if (!response.sent())
+            response.sendText("", HTTPResponse::HTTP_INTERNAL_SERVER_ERROR);
+        response.flush();
+        rec.socket->shutdownSend();
+    }
+    catch (const Poco::Exception&) {
+        // the client has gone
+    }
+    rec.socket->close();
+}
+
+} // namespace ms
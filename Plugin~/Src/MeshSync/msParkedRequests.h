@@ -0,0 +1,83 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Poco/Net/HTTPResponse.h" //HTTPResponse
+#include "Poco/Net/SocketStream.h" //SocketOutputStream
+#include "Poco/Net/StreamSocket.h" //StreamSocket
+#include "MeshUtils/muConcurrency.h" //mu::task_queue
+#include "MeshUtils/muMisc.h" //mu::nanosec
+
+namespace Poco {
+    namespace Net {
+        class HTTPServerRequest;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+namespace ms {
+
+    class ReadyFlag;
+
+    // response to a parked request. written directly to the connection, which is closed after the body.
+    class ParkedResponse : public Poco::Net::HTTPResponse {
+    public:
+        explicit ParkedResponse(Poco::Net::StreamSocket& socket);
+        // writes the header and returns the stream for the body
+        std::ostream& send();
+        void sendText(const char* text, int stat = HTTP_OK);
+        bool sent() const;
+        void flush();
+
+    private:
+        Poco::Net::SocketOutputStream m_stream;
+        bool m_sent = false;
+    };
+
+    // requests that wait for the host application (get, screenshot, poll).
+    // their connections are taken from the HTTP threads and watched by one thread until they are ready or timed out,
+    // so that waiting requests don't occupy ServerSettings::max_threads. the responses are sent by a few threads,
+    // so a slow client doesn't hold up the others.
+    class ParkedRequests {
+    public:
+        // ready is false if the request has timed out
+        using Responder = std::function<void(bool ready, ParkedResponse& response)>;
+
+        ParkedRequests();
+        ~ParkedRequests();
+
+        // returns false if the connection can't be taken. the caller has to answer the request by itself then.
+        // the request body must have been read.
+        bool park(Poco::Net::HTTPServerRequest& request, std::shared_ptr<ReadyFlag> flag, int timeout_ms, Responder&& respond);
+        // call after a flag has been set
+        void notify();
+        // answers all parked requests as timed out. park() fails after this
+        void stop();
+        int getNumParked() const;
+
+    private:
+        struct Record
+        {
+            std::shared_ptr<Poco::Net::StreamSocket> socket;
+            std::shared_ptr<ReadyFlag> flag;
+            mu::nanosec deadline = 0;
+            Responder respond;
+        };
+
+        void process();
+        void respond(Record& rec, bool ready);
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_cond;
+        std::vector<Record> m_records;
+        bool m_stop = false;
+        std::thread m_thread;
+        mu::task_queue m_senders; // sends the remaining responses on destruction
+    };
+
+} // namespace ms
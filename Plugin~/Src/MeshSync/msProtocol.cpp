@@ -8,6 +8,10 @@ namespace ms {
 Message::~Message()
 {
 }
+Message::Type Message::getType() const
+{
+    return Type::Unknown;
+}
 void Message::serialize(std::ostream& os) const
 {
     write(os, protocol_version);
@@ -26,10 +30,33 @@ void Message::deserialize(std::istream& is)
     read(is, timestamp_send);
 }
 
+void ReadyFlag::set()
+{
+    {
+        std::unique_lock<std::mutex> l(m_mutex);
+        m_ready = true;
+    }
+    m_cond.notify_all();
+}
+
+bool ReadyFlag::isSet() const
+{
+    std::unique_lock<std::mutex> l(m_mutex);
+    return m_ready;
+}
+
+bool ReadyFlag::wait(int timeout_ms)
+{
+    std::unique_lock<std::mutex> l(m_mutex);
+    return m_cond.wait_for(l, std::chrono::milliseconds(timeout_ms), [this]() { return m_ready; });
+}
+
+
 GetMessage::GetMessage()
 {
     SetAllGetFlags(flags);
 }
+Message::Type GetMessage::getType() const { return Message::Type::Get; }
 void GetMessage::serialize(std::ostream& os) const
 {
     super::serialize(os);
@@ -54,6 +81,7 @@ SetMessage::SetMessage(ScenePtr s)
 {
     scene = s;
 }
+Message::Type SetMessage::getType() const { return Message::Type::Set; }
 void SetMessage::serialize(std::ostream& os) const
 {
     super::serialize(os);
@@ -69,6 +97,7 @@ void SetMessage::deserialize(std::istream& is)
 DeleteMessage::DeleteMessage()
 {
 }
+Message::Type DeleteMessage::getType() const { return Message::Type::Delete; }
 void DeleteMessage::serialize(std::ostream& os) const
 {
     super::serialize(os);
@@ -84,6 +113,7 @@ void DeleteMessage::deserialize(std::istream& is)
 
 
 FenceMessage::~FenceMessage() {}
+Message::Type FenceMessage::getType() const { return Message::Type::Fence; }
 void FenceMessage::serialize(std::ostream& os) const
 {
     super::serialize(os);
@@ -95,7 +125,42 @@ void FenceMessage::deserialize(std::istream& is)
     read(is, type);
 }
 
+BatchMessage::BatchMessage()
+{
+}
+Message::Type BatchMessage::getType() const { return Message::Type::Batch; }
+void BatchMessage::serialize(std::ostream& os) const
+{
+    super::serialize(os);
+    auto count = (uint32_t)messages.size();
+    write(os, count);
+    for (auto& mes : messages) {
+        write(os, mes->getType());
+        mes->serialize(os);
+    }
+}
+void BatchMessage::deserialize(std::istream& is)
+{
+    super::deserialize(is);
+    uint32_t count = 0;
+    read(is, count);
+    messages.resize(count);
+    for (auto& mes : messages) {
+        Message::Type type = Message::Type::Unknown;
+        read(is, type);
+        switch (type) {
+        case Message::Type::Set: mes = std::make_shared<SetMessage>(); break;
+        case Message::Type::Delete: mes = std::make_shared<DeleteMessage>(); break;
+        case Message::Type::Fence: mes = std::make_shared<FenceMessage>(); break;
+        default:
+            throw std::runtime_error("BatchMessage: unsupported message type");
+        }
+        mes->deserialize(is);
+    }
+}
+
 TextMessage::~TextMessage() {}
+Message::Type TextMessage::getType() const { return Message::Type::Text; }
 void TextMessage::serialize(std::ostream& os) const
 {
     super::serialize(os);
@@ -111,6 +176,7 @@ void TextMessage::deserialize(std::istream& is)
 
 
 ScreenshotMessage::ScreenshotMessage() {}
+Message::Type ScreenshotMessage::getType() const { return Message::Type::Screenshot; }
 void ScreenshotMessage::serialize(std::ostream& os) const { super::serialize(os); }
 void ScreenshotMessage::deserialize(std::istream& is) { super::deserialize(is); }
 
@@ -119,6 +185,7 @@ ResponseMessage::ResponseMessage()
 {
 }
 
+Message::Type ResponseMessage::getType() const { return Message::Type::Response; }
 void ResponseMessage::serialize(std::ostream & os) const
 {
     super::serialize(os);
@@ -136,6 +203,7 @@ QueryMessage::QueryMessage()
 {
 }
 
+Message::Type QueryMessage::getType() const { return Message::Type::Query; }
 void QueryMessage::serialize(std::ostream & os) const
 {
     super::serialize(os);
@@ -1,6 +1,7 @@
 #include "pch.h"
 
 #include "msServerRequestHandler.h"
+#include "msParkedRequests.h"
 
 #include "MeshUtils/muLog.h"
 
@@ -10,6 +11,7 @@
 #include "MeshSync/MeshSync.h" //TestMessagePtr
 #include "MeshSync/SceneGraph/msScene.h"
 #include "MeshSync/SceneGraph/msMesh.h"
+#include "SceneCache/msEncoder.h" //DecompressZSTDStream
 
 namespace ms {
 
@@ -19,6 +21,7 @@ using namespace Poco::Net;
 Server::Server(const ServerSettings& settings)
     : m_settings(settings)
 {
+    m_import_queue.reset(new mu::task_queue(m_settings.import_threads));
 }
 
 Server::~Server()
@@ -29,12 +32,17 @@ Server::~Server()
 
 bool Server::start()
 {
+    if (!m_parked_requests)
+        m_parked_requests.reset(new ParkedRequests());
     if (!m_server) {
         auto* params = new HTTPServerParams;
         if (m_settings.max_queue > 0)
             params->setMaxQueued(m_settings.max_queue);
         if (m_settings.max_threads > 0)
             params->setMaxThreads(m_settings.max_threads);
+        params->setKeepAlive(m_settings.keep_alive);
+        params->setKeepAliveTimeout(Poco::Timespan(m_settings.keep_alive_timeout_ms * 1000));
+        params->setMaxKeepAliveRequests(m_settings.max_keep_alive_requests);
 
         try {
             ServerSocket svs(m_settings.port);
@@ -53,13 +61,24 @@ bool Server::start()
 void Server::stop()
 {
     m_server.reset();
+    m_parked_requests.reset(); // answers the waiting requests
 }
 
 void Server::clear()
 {
-    lock_t lock(m_message_mutex);
-    m_received_messages.clear();
-    m_host_scene.reset();
+    std::vector<MessageHolder> discard;
+    m_num_received_messages -= (int)m_received_messages.pop_all(discard);
+    {
+        lock_t lock(m_message_mutex);
+        m_host_scene.reset();
+        m_host_scene_data.reset();
+    }
+    {
+        lock_t lock(m_patch_mutex);
+        m_patch_bases.clear();
+        m_patch_base_bytes = 0;
+    }
+    m_refine_cache.clear();
 }
 
 ServerSettings& Server::getSettings()
@@ -69,151 +88,184 @@ ServerSettings& Server::getSettings()
 
 int Server::getNumMessages() const
 {
-    return (int)m_received_messages.size();
+    return m_num_received_messages;
 }
 
-int Server::processMessages(const MessageHandler& handler)
+bool Server::isDispatchable(const Message& mes) const
 {
+    switch (mes.getType()) {
+    case Message::Type::Set:
+    case Message::Type::Delete:
+        return mes.session_id == m_current_scene_session;
+    case Message::Type::Fence:
     {
-        lock_t lm(m_message_mutex);
-        // just move messages to processing list to minimize contention
-        m_processing_messages.splice(m_processing_messages.end(), m_received_messages);
+        auto& fence = static_cast<const FenceMessage&>(mes);
+        if (fence.type == FenceMessage::FenceType::SceneBegin)
+            return m_current_scene_session == InvalidID;
+        else if (fence.type == FenceMessage::FenceType::SceneEnd)
+            return m_current_scene_session == fence.session_id;
+        return true;
     }
+    default:
+        return true;
+    }
+}
 
-    int ret = 0;
-    for (auto i = m_processing_messages.begin(); i != m_processing_messages.end(); /**/) {
-        auto& holder = *i;
-        if (!holder.ready)
-            break;
-
-        if (holder.task.valid())
-            holder.task.wait();
-
-        bool skip = false;
-        auto& mes = holder.message;
-        if (!mes)
-            goto next;
-
-        if (auto get = std::dynamic_pointer_cast<GetMessage>(mes)) {
-            m_current_get_request = get;
-            handler(Message::Type::Get, *mes);
-            m_current_get_request = nullptr;
-        }
-        else if (auto set = std::dynamic_pointer_cast<SetMessage>(mes)) {
-            if (mes->session_id == m_current_scene_session)
-            {
-                handler(Message::Type::Set, *mes);
-                m_scene_cache.push_back(set);
-            }
-            else
-                skip = true;
-        }
-        else if (auto del = std::dynamic_pointer_cast<DeleteMessage>(mes)) {
-            if (mes->session_id == m_current_scene_session)
-                handler(Message::Type::Delete, *mes);
-            else
-                skip = true;
-        }
-        else if (auto fence = std::dynamic_pointer_cast<FenceMessage>(mes)) {
-            if (fence->type == FenceMessage::FenceType::SceneBegin) {
-                if (m_current_scene_session == InvalidID)
-                    m_current_scene_session = fence->session_id;
-                else
-                    skip = true;
-            }
-            else if (fence->type == FenceMessage::FenceType::SceneEnd) {
-                if (m_current_scene_session == fence->session_id)
-                    m_current_scene_session = InvalidID;
-                else
-                    skip = true;
-            }
-
-            if (!skip) {
-                handler(Message::Type::Fence, *mes);
-                if (fence->type == FenceMessage::FenceType::SceneEnd)
-                    m_scene_cache.clear();
-            }
-        }
-        else if (std::dynamic_pointer_cast<TextMessage>(mes)) {
-            handler(Message::Type::Text, *mes);
-        }
-        else if (auto shot = std::dynamic_pointer_cast<ScreenshotMessage>(mes)) {
-            m_current_screenshot_request = shot;
-            handler(Message::Type::Screenshot, *mes);
-        }
-        else if (auto q = std::dynamic_pointer_cast<QueryMessage>(mes)) {
-            handler(Message::Type::Query, *mes);
-        }
+void Server::updateSceneSession(const Message& mes)
+{
+    if (mes.getType() != Message::Type::Fence)
+        return;
+    auto& fence = static_cast<const FenceMessage&>(mes);
+    if (fence.type == FenceMessage::FenceType::SceneBegin)
+        m_current_scene_session = fence.session_id;
+    else if (fence.type == FenceMessage::FenceType::SceneEnd)
+        m_current_scene_session = InvalidID;
+}
 
-    next:
-        if (skip) {
-            ++i;
+void Server::collectMessages(std::vector<MessageHolder>& dst)
+{
+    std::vector<MessageHolder> received;
+    m_num_received_messages -= (int)m_received_messages.pop_all(received);
+
+    for (auto& holder : received) {
+        holder.seq = m_message_seq++;
+        if (!holder.message)
+            continue;
+
+        auto& mes = *holder.message;
+        if (isDispatchable(mes)) {
+            const int session = m_current_scene_session;
+            updateSceneSession(mes);
+            dst.push_back(std::move(holder));
+            if (m_current_scene_session != session)
+                collectPendingMessages(dst);
         }
         else {
-            m_processing_messages.erase(i++);
-            ++ret;
+            // another session is sending a scene. hold the message until that session becomes current
+            m_session_messages[mes.session_id].push_back(std::move(holder));
         }
     }
-    return ret;
 }
 
-void Server::serveText(HTTPServerResponse &response, const char* text, int stat)
+void Server::collectPendingMessages(std::vector<MessageHolder>& dst)
 {
-    size_t size = std::strlen(text);
+    for (;;) {
+        // the oldest held message that can be dispatched now. the number of sessions is small (one per client)
+        auto next = m_session_messages.end();
+        for (auto it = m_session_messages.begin(); it != m_session_messages.end(); ++it) {
+            auto& front = it->second.front();
+            if (isDispatchable(*front.message) && (next == m_session_messages.end() || front.seq < next->second.front().seq))
+                next = it;
+        }
+        if (next == m_session_messages.end())
+            break;
 
-    response.setStatus((HTTPResponse::HTTPStatus)stat);
-    response.setContentType("text/plain");
-    response.setContentLength(size);
+        MessageHolder holder = std::move(next->second.front());
+        next->second.pop_front();
+        if (next->second.empty())
+            m_session_messages.erase(next);
 
-    auto& os = response.send();
-    os.write(text, size);
-    os.flush();
+        updateSceneSession(*holder.message);
+        dst.push_back(std::move(holder));
+    }
 }
 
-void Server::serveBinary(Poco::Net::HTTPServerResponse & response, const void *data, size_t size, int stat)
+void Server::waitTasks(std::vector<MessageHolder>& messages)
 {
-    response.setStatus((HTTPResponse::HTTPStatus)stat);
-    response.setContentType("application/octet-stream");
-    response.setContentLength(size);
-
-    std::ostream& os = response.send();
-    os.write((const char*)data, size);
-    os.flush();
+    for (auto& holder : messages) {
+        if (holder.task.valid())
+            holder.task.wait();
+    }
 }
 
-//----------------------------------------------------------------------------------------------------------------------
-void Server::serveFiles(Poco::Net::HTTPServerResponse& response, const std::string& uri) {
-    // filename start with '.' is treated as hidden file. just return 404
-    std::string filename = mu::GetFilename(uri.c_str());
-    if (filename[0] == '.') {
-        serveText(response, "", HTTPResponse::HTTP_NOT_FOUND);
-        return;
+void Server::updateSceneCache(std::vector<MessageHolder>& messages)
+{
+    // keep SetMessages alive until the end of their scene. the host may refer to them until then.
+    for (auto& holder : messages) {
+        auto& mes = *holder.message;
+        if (mes.getType() == Message::Type::Set) {
+            m_scene_cache.push_back(std::static_pointer_cast<SetMessage>(holder.message));
+        }
+        else if (mes.getType() == Message::Type::Fence) {
+            if (static_cast<FenceMessage&>(mes).type == FenceMessage::FenceType::SceneEnd)
+                m_scene_cache.clear();
+        }
     }
+}
 
-    const std::string rootPath = GetFileRootPath();
+int Server::processMessages(const MessageHandler& handler)
+{
+    std::vector<MessageHolder> messages;
+    collectMessages(messages);
 
-    Poco::Path filePath = rootPath;
-    if (uri.empty() || uri == "/")
-        filePath.append("/index.html");
-    else {
+    for (auto& holder : messages) {
+        if (holder.task.valid())
+            holder.task.wait();
 
-        filePath.append(uri);
-        filePath = filePath.makeAbsolute();
+        auto& mes = *holder.message;
+        const Message::Type type = mes.getType();
+        switch (type) {
+        case Message::Type::Get:
+            m_current_get_request = std::static_pointer_cast<GetMessage>(holder.message);
+            handler(type, mes);
+            m_current_get_request = nullptr;
+            break;
+        case Message::Type::Screenshot:
+            m_current_screenshot_request = std::static_pointer_cast<ScreenshotMessage>(holder.message);
+            handler(type, mes);
+            break;
+        case Message::Type::Set:
+        case Message::Type::Delete:
+        case Message::Type::Fence:
+        case Message::Type::Text:
+        case Message::Type::Query:
+            handler(type, mes);
+            break;
+        default:
+            break;
+        }
     }
+    updateSceneCache(messages);
+    return (int)messages.size();
+}
 
-    //check if we are outside root;
-    std::string filePathStr = filePath.toString();
-    std::replace(filePathStr.begin(), filePathStr.end(), '\\', '/');
-    if (!StartsWith(filePathStr, rootPath)) {
-        serveText(response, "", HTTPResponse::HTTP_NOT_FOUND);
-        return;
+int Server::processMessagesBatch(const BatchMessageHandler& handler)
+{
+    std::vector<MessageHolder> messages;
+    collectMessages(messages);
+    if (messages.empty())
+        return 0;
+    waitTasks(messages);
+
+    std::vector<Message::Type> types;
+    std::vector<Message*> pointers;
+    types.reserve(messages.size());
+    pointers.reserve(messages.size());
+    for (auto& holder : messages) {
+        auto& mes = holder.message;
+        const Message::Type type = mes->getType();
+        if (type == Message::Type::Get) {
+            // only one Get request can be answered per call
+            if (m_current_get_request)
+                setReady(m_current_get_request->ready);
+            m_current_get_request = std::static_pointer_cast<GetMessage>(mes);
+        }
+        else if (type == Message::Type::Screenshot) {
+            if (m_current_screenshot_request)
+                setReady(m_current_screenshot_request->ready);
+            m_current_screenshot_request = std::static_pointer_cast<ScreenshotMessage>(mes);
+        }
+        else if (type == Message::Type::Unknown || type == Message::Type::Response) {
+            continue;
+        }
+        types.push_back(type);
+        pointers.push_back(mes.get());
     }
 
-    Poco::File f(filePath);
-    if (f.exists())
-        response.sendFile(filePathStr, getMIMEType(filePathStr));
-    else
-        serveText(response, "", HTTPResponse::HTTP_NOT_FOUND);
+    handler((int)pointers.size(), types.data(), pointers.data());
+    m_current_get_request = nullptr;
+    updateSceneCache(messages);
+    return (int)messages.size();
 }
 
 void Server::setServe(bool v)
@@ -234,7 +286,11 @@ void Server::beginServeScene()
         muLogError("m_current_get_request is null\n");
         return;
     }
-    m_host_scene = Scene::create();
+    {
+        lock_t lock(m_message_mutex);
+        m_host_scene = Scene::create();
+        m_host_scene_data.reset();
+    }
 
     auto& request = *m_current_get_request;
     request.refine_settings.scale_factor = request.scene_settings.scale_factor;
@@ -272,14 +328,19 @@ void Server::endServeScene()
         mesh.refine_settings.max_bone_influence = 0;
         mesh.refine();
     });
-    request.ready = true;
+    {
+        // a get that timed out meanwhile may have serialized the scene being built
+        lock_t lock(m_message_mutex);
+        m_host_scene_data.reset();
+    }
+    setReady(request.ready);
 }
 
 void Server::setScrrenshotFilePath(const std::string& path)
 {
     if (m_current_screenshot_request) {
         m_screenshot_file_path = path;
-        m_current_screenshot_request->ready = true;
+        setReady(m_current_screenshot_request->ready);
     }
 }
 
@@ -338,33 +399,23 @@ Scene* Server::getHostScene()
     return m_host_scene.get();
 }
 
-Server::MessageHolder* Server::queueMessage(MessagePtr mes)
+void Server::queueMessage(MessagePtr mes)
 {
-    if (!mes)
-        return nullptr;
-
-    MessageHolder t;
-    t.message = mes;
-    t.ready = true;
-
-    lock_t l(m_message_mutex);
-    m_received_messages.push_back(std::move(t));
-    return &m_received_messages.back();
+    queueMessage(mes, std::future<void>());
 }
 
-Server::MessageHolder* Server::queueMessage(MessagePtr mes, std::future<void>&& task)
+void Server::queueMessage(MessagePtr mes, std::future<void>&& task, const std::shared_ptr<void>& reservation)
 {
     if (!mes)
-        return nullptr;
+        return;
 
     MessageHolder t;
     t.message = mes;
     t.task = std::move(task);
-    t.ready = true;
+    t.reservation = reservation;
 
-    lock_t l(m_message_mutex);
-    m_received_messages.push_back(std::move(t));
-    return &m_received_messages.back();
+    m_received_messages.push(std::move(t));
+    ++m_num_received_messages;
 }
 
 void Server::queueTextMessage(const char *mes, TextMessage::Type type)
@@ -373,26 +424,195 @@ void Server::queueTextMessage(const char *mes, TextMessage::Type type)
     txt->type = type;
     txt->text = mes;
 
-    MessageHolder t;
-    t.message.reset(txt);
-    t.ready = true;
+    queueMessage(MessagePtr(txt));
+}
+
+
+// read the whole request body into dst. with Content-Length the buffer is allocated once and filled with a single read.
+// reserve is called with the new size before dst grows. returns false without reading the rest if it returns false.
+static bool ReadRequestBody(HTTPServerRequest& request, RawVector<char>& dst, const std::function<bool(size_t size)>& reserve)
+{
+    auto& is = request.stream();
+    if (request.hasContentLength()) {
+        const size_t size = (size_t)request.getContentLength64();
+        if (!reserve(size))
+            return false;
+        dst.resize_discard(size);
+        is.read(dst.data(), size);
+        if ((size_t)is.gcount() != size)
+            throw std::runtime_error("request body is shorter than Content-Length");
+    }
+    else {
+        // chunked transfer encoding. grow the buffer as data comes in
+        const size_t chunk_size = 1024 * 1024;
+        size_t size = 0;
+        dst.clear();
+        while (is) {
+            if (!reserve(size + chunk_size))
+                return false;
+            dst.resize(size + chunk_size);
+            is.read(dst.data() + size, chunk_size);
+            size += (size_t)is.gcount();
+        }
+        dst.resize(size);
+    }
+    return true;
+}
 
-    lock_t l(m_message_mutex);
-    m_received_messages.push_back(std::move(t));
+// SharedVectors deserialized from a MemoryStream point into its buffer. SetMessage hands the buffer to the scene.
+// other messages copy what they read.
+template<class MessageT>
+static void KeepRequestBody(MessageT& /*mes*/, RawVector<char>&& /*buf*/)
+{
+}
+
+static void KeepRequestBody(SetMessage& mes, RawVector<char>&& buf)
+{
+    if (mes.scene)
+        mes.scene->scene_buffers.push_back(std::move(buf));
+}
+
+// the SetMessages in a batch share the body. each scene holds a reference.
+static void KeepRequestBody(BatchMessage& batch, std::shared_ptr<void>&& buf)
+{
+    for (auto& mes : batch.messages) {
+        if (mes->getType() == Message::Type::Set) {
+            auto& scene = static_cast<SetMessage&>(*mes).scene;
+            if (scene)
+                scene->external_buffers.push_back(buf);
+        }
+    }
 }
 
+static void KeepRequestBody(BatchMessage& batch, RawVector<char>&& buf)
+{
+    KeepRequestBody(batch, std::make_shared<RawVector<char>>(std::move(buf)));
+}
 
 template<class MessageT>
-std::shared_ptr<MessageT> Server::deserializeMessage(HTTPServerRequest& request, HTTPServerResponse& response)
+static void KeepRequestBody(MessageT& /*mes*/, std::shared_ptr<mu::SharedMemory>&& /*shm*/)
+{
+}
+
+static void KeepRequestBody(SetMessage& mes, std::shared_ptr<mu::SharedMemory>&& shm)
+{
+    if (mes.scene)
+        mes.scene->external_buffers.push_back(std::move(shm));
+}
+
+static void KeepRequestBody(BatchMessage& batch, std::shared_ptr<mu::SharedMemory>&& shm)
+{
+    KeepRequestBody(batch, std::shared_ptr<void>(std::move(shm)));
+}
+
+// the body of a request from a client on the same machine may be in shared memory. see Client::post().
+// null if the request doesn't use it or it can't be opened.
+std::shared_ptr<mu::SharedMemory> Server::openRequestSharedMemory(HTTPServerRequest& request)
+{
+    if (!m_settings.shared_memory || !request.clientAddress().host().isLoopback())
+        return nullptr;
+
+    std::string name;
+    uint64_t size = 0;
+    std::istringstream(request.get(msSharedMemoryHeader)) >> name >> size;
+    auto ret = std::make_shared<mu::SharedMemory>();
+    if (name.empty() || !ret->open(name.c_str(), (size_t)size))
+        return nullptr;
+    return ret;
+}
+
+struct Server::MemoryReservation
+{
+    std::atomic<uint64_t>& counter;
+    const uint64_t max_bytes;
+    uint64_t size = 0;
+
+    MemoryReservation(std::atomic<uint64_t>& c, uint64_t max) : counter(c), max_bytes(max) {}
+    ~MemoryReservation() { counter -= size; }
+
+    // a request is always admitted if nothing else is waiting, however large it is.
+    // checked and added at once, so concurrent requests can't all pass the check.
+    bool resize(uint64_t new_size)
+    {
+        if (new_size <= size) {
+            counter -= size - new_size;
+            size = new_size;
+            return true;
+        }
+        const uint64_t add = new_size - size;
+        uint64_t current = counter;
+        do {
+            if (max_bytes != 0 && current != size && current + add > max_bytes)
+                return false;
+        } while (!counter.compare_exchange_weak(current, current + add));
+        size = new_size;
+        return true;
+    }
+};
+
+template<class MessageT>
+std::shared_ptr<MessageT> Server::deserializeMessage(HTTPServerRequest& request, HTTPServerResponse& response, MemoryReservation *reservation)
 {
     try {
+        if (request.has(msSharedMemoryHeader)) {
+            auto shm = openRequestSharedMemory(request);
+            if (!shm) {
+                // the client falls back to sending the body
+                serveText(response, "shared memory is not available", HTTPResponse::HTTP_NOT_IMPLEMENTED);
+                return nullptr;
+            }
+
+            // deserialize straight from the shared memory. vertex arrays point into it.
+            auto mes = std::make_shared<MessageT>();
+            mu::MemoryViewStream is(shm->data(), shm->size());
+            mes->deserialize(is);
+            mes->timestamp_recv = mu::Now();
+            if (reservation)
+                reservation->resize(shm->size());
+            KeepRequestBody(*mes, std::move(shm));
+            return mes;
+        }
+
+        // chunked and compressed bodies are counted as they are read. refused once they take too much
+        bool busy = false;
+        auto reserve = [reservation, &busy](size_t size) {
+            busy = reservation && !reservation->resize(size);
+            return !busy;
+        };
+
+        RawVector<char> body;
+        if (request.has("Content-Encoding")) {
+            if (!m_settings.compression || request.get("Content-Encoding") != msContentEncodingZSTD) {
+                // the client sends it as is again. the body has to be read, or the connection is reset before the
+                // client sees this response (see serveBusy())
+                request.stream().ignore(std::numeric_limits<std::streamsize>::max());
+                serveText(response, "unsupported content encoding", HTTPResponse::HTTP_UNSUPPORTED_MEDIA_TYPE);
+                return nullptr;
+            }
+            // decompressed as it comes in
+            if (!DecompressZSTDStream(body, request.stream(), reserve) && !busy)
+                throw std::runtime_error("broken ZSTD stream");
+        }
+        else {
+            ReadRequestBody(request, body, reserve);
+        }
+        if (busy) {
+            serveBusy(request, response);
+            return nullptr;
+        }
+
+        if (reservation)
+            reservation->resize(body.size());
         auto mes = std::make_shared<MessageT>();
-        mes->deserialize(request.stream());
+        mu::MemoryStream is(std::move(body));
+        mes->deserialize(is);
         mes->timestamp_recv = mu::Now();
+        KeepRequestBody(*mes, is.moveBuffer());
         return mes;
     }
     catch (const std::exception& e) {
         queueTextMessage(e.what(), TextMessage::Type::Error);
+        response.setKeepAlive(false); // the rest of the request can't be trusted
         serveText(response, e.what(), HTTPResponse::HTTP_BAD_REQUEST);
         return nullptr;
     }
@@ -404,16 +624,184 @@ void Server::sanitizeHierarchyPath(std::string& /*path*/)
 }
 
 
+static uint64_t GetMeshSize(const Mesh& mesh)
+{
+    uint64_t ret = mesh.points.size_in_byte() + mesh.normals.size_in_byte() + mesh.tangents.size_in_byte() +
+        mesh.colors.size_in_byte() + mesh.velocities.size_in_byte() +
+        mesh.counts.size_in_byte() + mesh.indices.size_in_byte() + mesh.material_ids.size_in_byte();
+    for (auto& uv : mesh.m_uv)
+        ret += uv.size_in_byte();
+    return ret;
+}
+
+// meshes sent as vertex patches are merged into the last version of them before import, which modifies meshes.
+// this has to be done in the order of arrival, so not in the import task.
+// the new bases of a request are staged and kept only if all of its patches apply. a refused request leaves the
+// bases as they were, which is what the client compares with when it sends again.
+bool Server::applyVertexPatches(const std::vector<MessagePtr>& messages)
+{
+    lock_t lock(m_patch_mutex);
+    std::map<std::string, MeshPtr> staged; // null: deleted
+    auto find_base = [&](const std::string& path) -> MeshPtr {
+        auto s = staged.find(path);
+        if (s != staged.end())
+            return s->second;
+        auto it = m_patch_bases.find(path);
+        if (it == m_patch_bases.end())
+            return nullptr;
+        it->second.last_use = ++m_patch_base_uses;
+        return it->second.mesh;
+    };
+
+    for (auto& mes : messages) {
+        if (mes->getType() == Message::Type::Delete) {
+            for (auto& id : static_cast<DeleteMessage&>(*mes).entities)
+                staged[id.name] = nullptr;
+            continue;
+        }
+        if (mes->getType() != Message::Type::Set || !static_cast<SetMessage&>(*mes).scene)
+            continue;
+        auto& scene = *static_cast<SetMessage&>(*mes).scene;
+        for (auto& e : scene.entities) {
+            if (e->getType() != EntityType::Mesh)
+                continue;
+            auto& mesh = static_cast<Mesh&>(*e);
+            if (mesh.md_flags.Get(MESH_DATA_FLAG_HAS_VERTEX_PATCH)) {
+                MeshPtr base = find_base(mesh.path);
+                if (!base || !mesh.merge(*base))
+                    return false;
+                // unpatched attributes still refer to the base
+                scene.external_buffers.push_back(base);
+            }
+            if (mesh.md_flags.Get(MESH_DATA_FLAG_PATCH_BASE))
+                staged[mesh.path] = std::static_pointer_cast<Mesh>(mesh.clone(true));
+        }
+    }
+
+    for (auto& kvp : staged) {
+        auto it = m_patch_bases.find(kvp.first);
+        if (it != m_patch_bases.end()) {
+            m_patch_base_bytes -= it->second.size;
+            m_patch_bases.erase(it);
+        }
+        if (!kvp.second)
+            continue;
+        PatchBase& base = m_patch_bases[kvp.first];
+        base.mesh = kvp.second;
+        base.size = GetMeshSize(*base.mesh);
+        base.last_use = ++m_patch_base_uses;
+        m_patch_base_bytes += base.size;
+    }
+
+    // drop the least recently used bases. patches to them are refused and the client sends those meshes in full
+    const uint64_t max_bytes = m_settings.max_patch_base_bytes;
+    while (max_bytes != 0 && m_patch_base_bytes > max_bytes && !m_patch_bases.empty()) {
+        auto lru = std::min_element(m_patch_bases.begin(), m_patch_bases.end(),
+            [](auto& a, auto& b) { return a.second.last_use < b.second.last_use; });
+        m_patch_base_bytes -= lru->second.size;
+        m_patch_bases.erase(lru);
+    }
+    return true;
+}
+
+void Server::erasePatchBases(const std::vector<Identifier>& entities)
+{
+    lock_t lock(m_patch_mutex);
+    for (auto& id : entities) {
+        auto it = m_patch_bases.find(id.name);
+        if (it != m_patch_bases.end()) {
+            m_patch_base_bytes -= it->second.size;
+            m_patch_bases.erase(it);
+        }
+    }
+}
+
+// size of the request body. the size in shared memory if it is there. 0 if unknown (chunked)
+static uint64_t GetRequestBodySize(HTTPServerRequest& request)
+{
+    if (request.has(msSharedMemoryHeader)) {
+        unsigned long long size = 0;
+        sscanf(request.get(msSharedMemoryHeader).c_str(), "%*s %llu", &size);
+        return size;
+    }
+    return request.hasContentLength() ? (uint64_t)request.getContentLength64() : 0;
+}
+
+// refuse scenes while the messages waiting for processMessages() take too much memory. the client retries later.
+// the size known from the headers is reserved before the body is read. chunked and compressed bodies grow the
+// reservation while they are read (see deserializeMessage()).
+Server::MemoryReservationPtr Server::admitRequest(HTTPServerRequest& request, HTTPServerResponse& response)
+{
+    auto ret = std::make_shared<MemoryReservation>(m_pending_bytes, m_settings.max_pending_bytes);
+    if (ret->resize(GetRequestBodySize(request)))
+        return ret;
+    serveBusy(request, response);
+    return nullptr;
+}
+
+void Server::serveBusy(HTTPServerRequest& request, HTTPServerResponse& response)
+{
+    // Poco has already answered "Expect: 100-continue", so the client is sending the body. it must be read to the end,
+    // or closing the connection with unread data resets it and the client never sees this response.
+    request.stream().ignore(std::numeric_limits<std::streamsize>::max());
+    response.set("Retry-After", std::to_string(std::max(m_settings.retry_after_sec, 1)));
+    serveText(response, "server is busy", HTTPResponse::HTTP_SERVICE_UNAVAILABLE);
+}
+
+// scenes are imported by a fixed number of threads. processMessages() waits for the returned future.
+std::future<void> Server::importAsync(SetMessagePtr mes)
+{
+    return m_import_queue->push([this, mes]() {
+        mes->scene->import(m_settings.import_settings, &m_refine_cache);
+    });
+}
+
 void Server::recvSet(HTTPServerRequest& request, HTTPServerResponse& response)
 {
-    auto mes = deserializeMessage<SetMessage>(request, response);
+    auto reservation = admitRequest(request, response);
+    if (!reservation)
+        return;
+    auto mes = deserializeMessage<SetMessage>(request, response, reservation.get());
     if (!mes)
         return;
+    if (!applyVertexPatches({ mes })) {
+        // the client has to send the mesh in full
+        serveText(response, "vertex patch doesn't match", HTTPResponse::HTTP_CONFLICT);
+        return;
+    }
 
-    auto task = std::async(std::launch::async, [this, mes]() {
-        mes->scene->import(m_settings.import_settings);
-    });
-    queueMessage(mes, std::move(task));
+    queueMessage(mes, importAsync(mes), reservation);
+    serveText(response, "ok");
+}
+
+void Server::recvBatch(HTTPServerRequest& request, HTTPServerResponse& response)
+{
+    auto reservation = admitRequest(request, response);
+    if (!reservation)
+        return;
+    auto batch = deserializeMessage<BatchMessage>(request, response, reservation.get());
+    if (!batch)
+        return;
+
+    if (!applyVertexPatches(batch->messages)) {
+        serveText(response, "vertex patch doesn't match", HTTPResponse::HTTP_CONFLICT);
+        return;
+    }
+
+    // queued one by one in order. processMessages() sees them as if they had been sent separately.
+    // the body is released when all of them have been dispatched.
+    for (auto& mes : batch->messages) {
+        mes->timestamp_recv = batch->timestamp_recv;
+        if (mes->getType() == Message::Type::Set)
+            queueMessage(mes, importAsync(std::static_pointer_cast<SetMessage>(mes)), reservation);
+        else {
+            if (mes->getType() == Message::Type::Delete) {
+                for (auto& id : static_cast<DeleteMessage&>(*mes).entities)
+                    m_refine_cache.erase(id.id);
+            }
+            queueMessage(mes, std::future<void>(), reservation);
+        }
+    }
     serveText(response, "ok");
 }
 
@@ -422,6 +810,9 @@ void Server::recvDelete(HTTPServerRequest& request, HTTPServerResponse& response
     auto mes = deserializeMessage<DeleteMessage>(request, response);
     if (!mes)
         return;
+    erasePatchBases(mes->entities);
+    for (auto& id : mes->entities)
+        m_refine_cache.erase(id.id);
     queueMessage(mes);
     serveText(response, "ok");
 }
@@ -443,34 +834,33 @@ void Server::recvGet(HTTPServerRequest& request, HTTPServerResponse& response)
 
     queueMessage(mes);
 
-    // wait for data arrive (or timeout)
-    for (int i = 0; i < 300; ++i) {
-        if (mes->ready)
-            break;
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    }
-
-    // serve data
-    {
-        lock_t l(m_message_mutex);
-        if (m_host_scene) {
-            response.setContentType("application/octet-stream");
-            response.setContentLength(ssize(*m_host_scene));
-
-            auto& os = response.send();
-            m_host_scene->serialize(os);
-            os.flush();
+    // serve data. the scene is serialized once for all the requests waiting for it
+    auto serve = [this](auto& res) {
+        std::shared_ptr<const RawVector<char>> data;
+        {
+            lock_t l(m_message_mutex);
+            if (!m_host_scene_data) {
+                auto scene = m_host_scene ? m_host_scene : Scene::create();
+                mu::MemoryStream buf;
+                scene->serialize(buf);
+                buf.flush();
+                m_host_scene_data = std::make_shared<RawVector<char>>(buf.moveBuffer());
+            }
+            data = m_host_scene_data;
         }
-        else {
-            auto empty_scene = Scene::create();
-            response.setContentType("application/octet-stream");
-            response.setContentLength(ssize(*empty_scene));
+        res.setContentType("application/octet-stream");
 
-            auto& os = response.send();
-            empty_scene->serialize(os);
-            os.flush();
-        }
-    }
+        auto& os = res.send();
+        os.write(data->cdata(), data->size());
+        os.flush();
+    };
+
+    // wait for data arrive (or timeout) without holding this thread
+    if (parkRequest(request, mes, mes->ready, 3000, [serve](bool, ParkedResponse& res) { serve(res); }))
+        return;
+    mes->ready.wait(3000);
+    response.setChunkedTransferEncoding(true);
+    serve(response);
 }
 
 void Server::recvQuery(HTTPServerRequest& request, HTTPServerResponse& response)
@@ -491,24 +881,20 @@ void Server::recvQuery(HTTPServerRequest& request, HTTPServerResponse& response)
         queueMessage(mes);
 
         // wait for data arrive (or timeout)
-        for (int i = 0; i < 300; ++i) {
-            if (mes->ready)
-                break;
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        }
+        mes->ready.wait(3000);
     }
 
     // serve data
     {
+        // content length or chunked transfer encoding must be set before send() so that the connection can be kept alive
         response.setContentType("application/octet-stream");
+        if (mes->response)
+            response.setChunkedTransferEncoding(true);
+        else
+            response.setContentLength(0);
         auto& os = response.send();
-        if (mes->response) {
-            response.setContentLength(ssize(*mes->response));
+        if (mes->response)
             mes->response->serialize(os);
-        }
-        else {
-            response.setContentLength(0);
-        }
         os.flush();
         mes->response.reset();
     }
@@ -556,17 +942,27 @@ void Server::recvText(HTTPServerRequest& request, HTTPServerResponse& response)
         serveText(response, "ok");
 }
 
-void Server::recvScreenshot(HTTPServerRequest& /*request*/, HTTPServerResponse& response)
+void Server::recvScreenshot(HTTPServerRequest& request, HTTPServerResponse& response)
 {
     auto mes = std::make_shared<ScreenshotMessage>();
     queueMessage(mes);
 
-    // wait for data arrive (or timeout)
-    for (int i = 0; i < 300; ++i) {
-        if (mes->ready)
-            break;
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    }
+    // wait for data arrive (or timeout) without holding this thread
+    auto serve = [this](bool, ParkedResponse& res) {
+        Poco::File file(m_screenshot_file_path);
+        if (!file.exists()) {
+            res.sendText("", HTTPResponse::HTTP_NOT_FOUND);
+            return;
+        }
+        Poco::FileInputStream is(m_screenshot_file_path);
+        res.set("Cache-Control", "no-store, must-revalidate");
+        res.setContentType("image/png");
+        res.setContentLength64(file.getSize());
+        Poco::StreamCopier::copyStream(is, res.send());
+    };
+    if (parkRequest(request, mes, mes->ready, 3000, serve))
+        return;
+    mes->ready.wait(3000);
 
     // serve data
     response.set("Cache-Control", "no-store, must-revalidate");
@@ -591,16 +987,19 @@ void Server::recvPoll(HTTPServerRequest& request, HTTPServerResponse& response)
         m_polls.push_back(mes);
     }
 
-    // wait for data arrive (or timeout)
-    for (int i = 0; i < 400; ++i) {
-        if (mes->ready) {
-            break;
-        }
-        std::this_thread::sleep_for(std::chrono::milliseconds(25));
-    }
+    // wait for data arrive (or timeout). hundreds of browsers can wait at once as they don't hold threads
+    auto serve = [](bool ready, ParkedResponse& res) {
+        if (ready)
+            res.sendText("ok", HTTPResponse::HTTP_OK);
+        else
+            res.sendText("timeout", HTTPResponse::HTTP_REQUEST_TIMEOUT);
+    };
+    if (parkRequest(request, mes, mes->ready, 10000, serve))
+        return;
+    const bool ready = mes->ready.wait(10000);
 
     // serve data
-    if (mes->ready) {
+    if (ready) {
         serveText(response, "ok", HTTPResponse::HTTP_OK);
     }
     else {
@@ -610,14 +1009,36 @@ void Server::recvPoll(HTTPServerRequest& request, HTTPServerResponse& response)
 
 void Server::notifyPoll(PollMessage::PollType t)
 {
+    bool notified = false;
     lock_t lock(m_poll_mutex);
     for (auto& p : m_polls) {
         if (p->poll_type == t) {
-            p->ready = true;
+            p->ready.set();
             p.reset();
+            notified = true;
         }
     }
     m_polls.erase(std::remove(m_polls.begin(), m_polls.end(), PollMessagePtr()), m_polls.end());
+    lock.unlock();
+
+    if (notified && m_parked_requests)
+        m_parked_requests->notify();
+}
+
+void Server::setReady(ReadyFlag& flag)
+{
+    flag.set();
+    if (m_parked_requests)
+        m_parked_requests->notify();
+}
+
+bool Server::parkRequest(HTTPServerRequest& request, MessagePtr mes, ReadyFlag& flag, int timeout_ms,
+    std::function<void(bool ready, ParkedResponse& response)>&& respond)
+{
+    if (!m_parked_requests)
+        return false;
+    // the flag is a member of the message. keep the message alive with it
+    return m_parked_requests->park(request, std::shared_ptr<ReadyFlag>(mes, &flag), timeout_ms, std::move(respond));
 }
 
 Server::MessageHolder::MessageHolder()
@@ -625,10 +1046,17 @@ Server::MessageHolder::MessageHolder()
 }
 
 Server::MessageHolder::MessageHolder(MessageHolder && v)
+{
+    *this = std::move(v);
+}
+
+Server::MessageHolder& Server::MessageHolder::operator=(MessageHolder && v)
 {
     message = std::move(v.message);
     task = std::move(v.task);
-    ready = v.ready.load();
+    reservation = std::move(v.reservation);
+    seq = v.seq;
+    return *this;
 }
 
 } // namespace ms
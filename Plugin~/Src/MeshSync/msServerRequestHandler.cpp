@@ -38,12 +38,15 @@ void ServerRequestHandler::handleRequest(HTTPServerRequest& request, HTTPServerR
         //
         const bool isLocal = NetworkUtils::IsInLocalNetwork(hostAndPort);
         if (!isLocal) {
+            // the request body is left unread. close the connection instead of keeping it alive
+            response.setKeepAlive(false);
             m_server->serveText(response, "", HTTPResponse::HTTP_SERVICE_UNAVAILABLE);
             return;
         }
     }
 
     if (!m_server->isServing()) {
+        response.setKeepAlive(false);
         m_server->serveText(response, "", HTTPResponse::HTTP_SERVICE_UNAVAILABLE);
         return;
     }
@@ -58,6 +61,9 @@ void ServerRequestHandler::handleRequest(HTTPServerRequest& request, HTTPServerR
     else if (uri == "fence") {
         m_server->recvFence(request, response);
     }
+    else if (uri == "batch") {
+        m_server->recvBatch(request, response);
+    }
     else if (uri == "get") {
         m_server->recvGet(request, response);
     }
@@ -75,6 +81,8 @@ void ServerRequestHandler::handleRequest(HTTPServerRequest& request, HTTPServerR
     }
     else if (StartsWith(uri, "/protocol_version")) {
         static const auto res = std::to_string(msProtocolVersion);
+        if (m_server->getSettings().compression)
+            response.set("Accept-Encoding", msContentEncodingZSTD); // see Client::isServerAvailable()
         m_server->serveText(response, res.c_str());
     }
     else if (StartsWith(uri, "/plugin_version")) {
@@ -7,12 +7,17 @@
 #include "MeshSync/SceneGraph/msAnimation.h"
 #include "MeshSync/SceneGraph/msMaterial.h"
 #include "MeshSync/SceneGraph/msMesh.h"
+#include "MeshSync/SceneGraph/msMeshRefineCache.h"
 #include "MeshSync/SceneGraph/msPoints.h"
 #include "MeshSync/SceneGraph/msScene.h"
+#include "MeshSync/SceneGraph/msTransform.h"
+#include "MeshSync/SceneGraph/msSceneImportSettings.h"
 
 #include "MeshSync/SceneCache/msSceneCache.h"
 #include "MeshSync/SceneCache/msSceneCacheSettings.h"
 #include "MeshSync/Utility/msAsyncSceneExporter.h" //AsyncSceneCacheWriter
+#include "MeshSync/Utility/msSceneDiffTracker.h"
+#include "MeshSync/msServer.h"
 
 #include "MeshSync/Utility/msMaterialExt.h"     //standardMaterial
 
@@ -74,6 +79,119 @@ TestCase(Test_SendMesh) {
     }
 }
 
+TestCase(Test_SceneImport)
+{
+    // a right-handed, Z-up scene with many meshes so that every converter and Mesh::refine() have work to do
+    std::shared_ptr<ms::Scene> src = ms::Scene::create();
+    src->settings.handedness = ms::Handedness::RightZUp;
+    src->settings.scale_factor = 100.0f;
+    for (int i = 0; i < 64; ++i) {
+        std::shared_ptr<ms::Mesh> mesh = ms::Mesh::create();
+        src->entities.push_back(mesh);
+
+        char path[64];
+        sprintf(path, "/Test/Import/Wave%d", i);
+        mesh->path = path;
+        mesh->id = i;
+        mesh->refine_settings.flags.Set(ms::MESH_REFINE_FLAG_GEN_NORMALS, true);
+        mesh->refine_settings.flags.Set(ms::MESH_REFINE_FLAG_GEN_TANGENTS, true);
+        MeshGenerator::GenerateWaveMesh(mesh->counts, mesh->indices, mesh->points, mesh->m_uv, 2.0f, 1.0f, 128, 10.0f * mu::DegToRad * i);
+        mesh->material_ids.resize(mesh->counts.size(), 0);
+        mesh->setupDataFlags();
+    }
+
+    const ms::SceneImportSettings settings;
+    const int num_try = 4;
+    auto import = [&]() {
+        ms::ScenePtr scene = src->clone(true);
+        scene->import(settings);
+    };
+
+#ifdef muEnableThreadPool
+    mu::thread_pool& pool = mu::thread_pool::instance();
+    const int num_workers = pool.get_num_workers();
+    pool.set_num_workers(0);
+    TestScope("Scene::import serial", import, num_try);
+    pool.set_num_workers(num_workers);
+    Print("    workers: %d\n", pool.get_num_workers());
+#endif
+    TestScope("Scene::import parallel", import, num_try);
+}
+
+TestCase(Test_SceneImportConversion)
+{
+    // scale, handedness and Z-up corrections are applied to vertex streams in one composed pass.
+    // the result must match applying them one after another.
+    std::shared_ptr<ms::Scene> src = ms::Scene::create();
+    src->settings.handedness = ms::Handedness::RightZUp;
+    src->settings.scale_factor = 100.0f;
+
+    std::shared_ptr<ms::Mesh> mesh = ms::Mesh::create();
+    src->entities.push_back(mesh);
+    mesh->path = "/Test/ImportConversion";
+    mesh->points = { { 100.0f, 200.0f, 300.0f }, { -400.0f, 500.0f, 600.0f }, { 700.0f, -800.0f, 900.0f } };
+    mesh->normals = { { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f } };
+    mesh->velocities = { { 10.0f, 20.0f, 30.0f }, { 40.0f, 50.0f, 60.0f }, { 70.0f, 80.0f, 90.0f } };
+    mesh->counts = { 3 };
+    mesh->indices = { 0, 1, 2 };
+    mesh->material_ids = { 0 };
+    mesh->setupDataFlags();
+
+    auto expected_point = [](mu::float3 v) { return mu::flip_z(mu::swap_yz(mu::flip_x(v * 0.01f))); };
+    auto expected_vector = [](mu::float3 v) { return mu::flip_z(mu::swap_yz(mu::flip_x(v))); };
+
+    ms::ScenePtr scene = src->clone(true);
+    scene->import(ms::SceneImportSettings());
+    auto& dst = static_cast<ms::Mesh&>(*scene->entities[0]);
+
+    bool ok = dst.points.size() == mesh->points.size() && dst.normals.size() == mesh->normals.size();
+    for (size_t i = 0; ok && i < mesh->points.size(); ++i) {
+        ok = mu::near_equal(dst.points[i], expected_point(mesh->points[i])) &&
+            mu::near_equal(dst.normals[i], expected_vector(mesh->normals[i])) &&
+            mu::near_equal(dst.velocities[i], expected_vector(mesh->velocities[i]));
+    }
+    Expect(ok);
+}
+
+TestCase(Test_DeserializeTruncated)
+{
+    // array sizes in a truncated body point past its end. reading must fail with an exception, not read past the buffer
+    std::shared_ptr<ms::Scene> src = ms::Scene::create();
+    std::shared_ptr<ms::Mesh> mesh = ms::Mesh::create();
+    src->entities.push_back(mesh);
+    mesh->path = "/Test/Truncated";
+    MeshGenerator::GenerateWaveMesh(mesh->counts, mesh->indices, mesh->points, mesh->m_uv, 2.0f, 1.0f, 64, 0.0f);
+    mesh->setupDataFlags();
+
+    mu::MemoryStream os;
+    src->serialize(os);
+    os.flush();
+    const RawVector<char>& data = os.getBuffer();
+
+    for (size_t cut : { data.size() / 4, data.size() / 2, data.size() - 4 }) {
+        for (int view = 0; view < 2; ++view) {
+            RawVector<char> buf;
+            buf.assign(data.cdata(), data.cdata() + cut);
+            bool thrown = false;
+            try {
+                ms::ScenePtr dst = ms::Scene::create();
+                if (view) {
+                    mu::MemoryViewStream is(buf.cdata(), buf.size());
+                    dst->deserialize(is);
+                }
+                else {
+                    mu::MemoryStream is(std::move(buf));
+                    dst->deserialize(is);
+                }
+            }
+            catch (const std::runtime_error&) {
+                thrown = true;
+            }
+            Expect(thrown);
+        }
+    }
+}
+
 TestCase(Test_SceneCacheRead)
 {
     ms::ISceneCacheSettings iscs;
@@ -95,6 +213,326 @@ TestCase(Test_SceneCacheRead)
     }
 }
 
+TestCase(Test_SceneCacheMemoryMap)
+{
+    // read the whole cache with and without memory mapping. results must be identical
+    for (const char *path : { "wave_c0.sc", "wave_c2.sc" }) {
+        uint64_t vertex_counts[2] = {};
+        for (int mm = 0; mm < 2; ++mm) {
+            ms::ISceneCacheSettings iscs;
+            iscs.enable_diff = false;
+            iscs.memory_map = mm;
+            ms::ISceneCachePtr isc = ms::OpenISceneCacheFile(path, iscs);
+            Expect(isc);
+            if (!isc)
+                return;
+
+            const std::string name = std::string(path) + (mm ? " mapped" : " stream");
+            TestScope(name.c_str(), [&]() {
+                const size_t n = isc->getNumScenes();
+                for (size_t i = 0; i < n; ++i) {
+                    const ms::ScenePtr scene = isc->getByIndex(i);
+                    for (auto& e : scene->entities)
+                        vertex_counts[mm] += e->vertexCount();
+                }
+            });
+        }
+        Expect(vertex_counts[0] == vertex_counts[1]);
+    }
+}
+
+TestCase(Test_SceneCacheOpen)
+{
+    // 10k small scenes. open time is dominated by enumerating scene records
+    const int num_frames = 10000;
+    const char *paths[] = { "open_noindex.sc", "open_index.sc" };
+    for (int wi = 0; wi < 2; ++wi) {
+        ms::OSceneCacheSettings oscs;
+        oscs.strip_unchanged = 0;
+        oscs.apply_refinement = 0;
+        oscs.max_scene_segments = 1;
+        oscs.max_queue_size = num_frames;
+        oscs.write_index = wi == 1;
+
+        ms::OSceneCachePtr osc = ms::OpenOSceneCacheFile(paths[wi], oscs);
+        Expect(osc);
+        if (!osc)
+            return;
+        for (int i = 0; i < num_frames; ++i) {
+            ms::ScenePtr scene = ms::Scene::create();
+            std::shared_ptr<ms::Transform> node = ms::Transform::create();
+            node->path = "/Test/Open";
+            node->position = { (float)i, 0.0f, 0.0f };
+            scene->entities.push_back(node);
+            osc->addScene(scene, (float)i / 30.0f);
+        }
+    }
+
+    for (int wi = 0; wi < 2; ++wi) {
+        ms::ISceneCacheSettings iscs;
+        for (int mm = 0; mm < 2; ++mm) {
+            iscs.memory_map = mm;
+            const std::string name = std::string(wi ? "open with index" : "open without index") + (mm ? " (mapped)" : " (stream)");
+            ms::ISceneCachePtr isc;
+            TestScope(name.c_str(), [&]() { isc = ms::OpenISceneCacheFile(paths[wi], iscs); }, 10);
+            Expect(isc && isc->getNumScenes() == num_frames);
+        }
+    }
+}
+
+TestCase(Test_SceneCacheTruncated)
+{
+    // a cache cut off in the middle. scenes that are not complete must be dropped, not read out of the mapping
+    const char *src_path = "wave_c0.sc";
+    const char *dst_path = "wave_truncated.sc";
+    {
+        std::ifstream fin(src_path, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+        Expect(!data.empty());
+        if (data.empty())
+            return;
+        std::ofstream fout(dst_path, std::ios::binary);
+        fout.write(data.data(), data.size() / 2);
+    }
+
+    for (int mm = 0; mm < 2; ++mm) {
+        ms::ISceneCacheSettings iscs;
+        iscs.enable_diff = false;
+        iscs.memory_map = mm;
+        ms::ISceneCachePtr isc = ms::OpenISceneCacheFile(dst_path, iscs);
+        if (!isc)
+            continue;
+        const size_t n = isc->getNumScenes();
+        bool ok = true;
+        for (size_t i = 0; i < n; ++i)
+            ok = ok && isc->getByIndex(i) != nullptr;
+        Print("    %s: %d scenes\n", mm ? "mapped" : "stream", (int)n);
+        Expect(ok);
+    }
+}
+
+TestCase(Test_SceneCacheLegacyHeader)
+{
+    // files written before the cache layout had its own version have 123 in the header and may have garbage in
+    // the flag bits that were added later. those bits must be ignored
+    const char *src_path = "wave_c0.sc";
+    const char *dst_path = "wave_legacy.sc";
+    std::string data;
+    {
+        std::ifstream fin(src_path, std::ios::binary);
+        data.assign((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+    }
+    const size_t settings_offset = sizeof(char[4]) + sizeof(int); // magic, version
+    Expect(data.size() > settings_offset + sizeof(ms::OSceneCacheSettingsBase));
+    if (data.size() <= settings_offset + sizeof(ms::OSceneCacheSettingsBase))
+        return;
+    {
+        const int legacy_version = 123;
+        memcpy(&data[sizeof(char[4])], &legacy_version, sizeof(int));
+        auto& oscs = *(ms::OSceneCacheSettingsBase*)&data[settings_offset];
+        oscs.quantize_points = oscs.quantize_normals = oscs.temporal_delta = 1;
+        std::ofstream fout(dst_path, std::ios::binary);
+        fout.write(data.data(), data.size());
+    }
+
+    ms::ISceneCacheSettings iscs;
+    iscs.enable_diff = false;
+    ms::ISceneCachePtr src = ms::OpenISceneCacheFile(src_path, iscs);
+    ms::ISceneCachePtr legacy = ms::OpenISceneCacheFile(dst_path, iscs);
+    Expect(src && legacy && src->getNumScenes() == legacy->getNumScenes());
+    if (!src || !legacy)
+        return;
+
+    bool ok = true;
+    for (size_t i = 0; ok && i < src->getNumScenes(); ++i) {
+        const ms::ScenePtr s0 = src->getByIndex(i);
+        const ms::ScenePtr s1 = legacy->getByIndex(i);
+        ok = s0 && s1 && s0->entities.size() == s1->entities.size();
+        for (size_t ei = 0; ok && ei < s0->entities.size(); ++ei)
+            ok = s0->entities[ei]->vertexCount() == s1->entities[ei]->vertexCount();
+    }
+    Expect(ok);
+}
+
+TestCase(Test_SceneCacheQuantize)
+{
+    // same scenes with and without quantized vertex arrays. compare file size, read time and error
+    const int num_frames = 16;
+    const char *paths[] = { "wave_float.sc", "wave_quantized.sc" };
+    for (int qi = 0; qi < 2; ++qi) {
+        ms::OSceneCacheSettings oscs;
+        oscs.strip_unchanged = 0;
+        oscs.max_queue_size = num_frames;
+        oscs.quantize_points = oscs.quantize_normals = oscs.quantize_tangents = oscs.quantize_uv = qi;
+
+        ms::OSceneCachePtr osc = ms::OpenOSceneCacheFile(paths[qi], oscs);
+        Expect(osc);
+        if (!osc)
+            return;
+        for (int i = 0; i < num_frames; ++i) {
+            ms::ScenePtr scene = ms::Scene::create();
+            std::shared_ptr<ms::Mesh> mesh = ms::Mesh::create();
+            scene->entities.push_back(mesh);
+
+            mesh->path = "/Test/Wave";
+            mesh->refine_settings.flags.Set(ms::MESH_REFINE_FLAG_GEN_NORMALS, true);
+            mesh->refine_settings.flags.Set(ms::MESH_REFINE_FLAG_GEN_TANGENTS, true);
+            MeshGenerator::GenerateWaveMesh(mesh->counts, mesh->indices, mesh->points, mesh->m_uv, 2.0f, 1.0f, 128, 30.0f * mu::DegToRad * i);
+            mesh->material_ids.resize(mesh->counts.size(), 0);
+            mesh->setupDataFlags();
+            osc->addScene(scene, (float)i / 30.0f);
+        }
+    }
+
+    std::vector<ms::ScenePtr> scenes[2];
+    for (int qi = 0; qi < 2; ++qi) {
+        std::ifstream fin(paths[qi], std::ios::binary | std::ios::ate);
+        Print("    %s: %u byte\n", paths[qi], (uint32_t)fin.tellg());
+
+        ms::ISceneCacheSettings iscs;
+        iscs.enable_diff = false;
+        ms::ISceneCachePtr isc = ms::OpenISceneCacheFile(paths[qi], iscs);
+        Expect(isc && isc->getNumScenes() == num_frames);
+        if (!isc)
+            return;
+        TestScope(paths[qi], [&]() {
+            for (int i = 0; i < num_frames; ++i)
+                scenes[qi].push_back(isc->getByIndex(i));
+        });
+    }
+
+    float max_error = 0.0f;
+    for (int i = 0; i < num_frames; ++i) {
+        const auto& m0 = static_cast<const ms::Mesh&>(*scenes[0][i]->entities[0]);
+        const auto& m1 = static_cast<const ms::Mesh&>(*scenes[1][i]->entities[0]);
+        Expect(m0.points.size() == m1.points.size() && m0.normals.size() == m1.normals.size() && m0.tangents.size() == m1.tangents.size());
+        for (size_t vi = 0; vi < m0.points.size(); ++vi)
+            max_error = std::max(max_error, mu::length(m0.points[vi] - m1.points[vi]));
+    }
+    Print("    max error: %f\n", max_error);
+    Expect(max_error < 1e-3f);
+}
+
+TestCase(Test_SceneCacheTemporalDelta)
+{
+    // slowly deforming mesh with and without temporal delta. decoded points must be bit-exact
+    const int num_frames = 32;
+    const char *paths[] = { "wave_nodelta.sc", "wave_delta.sc" };
+    for (int di = 0; di < 2; ++di) {
+        ms::OSceneCacheSettings oscs;
+        oscs.max_queue_size = num_frames;
+        oscs.temporal_delta = di;
+        oscs.keyframe_interval = 8;
+
+        ms::OSceneCachePtr osc = ms::OpenOSceneCacheFile(paths[di], oscs);
+        Expect(osc);
+        if (!osc)
+            return;
+        for (int i = 0; i < num_frames; ++i) {
+            ms::ScenePtr scene = ms::Scene::create();
+            std::shared_ptr<ms::Mesh> mesh = ms::Mesh::create();
+            scene->entities.push_back(mesh);
+
+            mesh->path = "/Test/Wave";
+            mesh->refine_settings.flags.Set(ms::MESH_REFINE_FLAG_GEN_NORMALS, true);
+            MeshGenerator::GenerateWaveMesh(mesh->counts, mesh->indices, mesh->points, mesh->m_uv, 2.0f, 1.0f, 128, 0.5f * mu::DegToRad * i);
+            mesh->material_ids.resize(mesh->counts.size(), 0);
+            mesh->setupDataFlags();
+            osc->addScene(scene, (float)i / 30.0f);
+        }
+    }
+
+    ms::ISceneCachePtr iscs[2];
+    for (int di = 0; di < 2; ++di) {
+        std::ifstream fin(paths[di], std::ios::binary | std::ios::ate);
+        Print("    %s: %u byte\n", paths[di], (uint32_t)fin.tellg());
+
+        ms::ISceneCacheSettings settings;
+        settings.enable_diff = false;
+        iscs[di] = ms::OpenISceneCacheFile(paths[di], settings);
+        Expect(iscs[di] && iscs[di]->getNumScenes() == num_frames);
+        if (!iscs[di])
+            return;
+    }
+
+    // random seek. each scene is reconstructed from its keyframe
+    bool identical = true;
+    for (int i : { 13, 31, 0, 7, 8, 22, 9 }) {
+        const ms::ScenePtr s0 = iscs[0]->getByIndex(i);
+        const ms::ScenePtr s1 = iscs[1]->getByIndex(i);
+        const auto& m0 = static_cast<const ms::Mesh&>(*s0->entities[0]);
+        const auto& m1 = static_cast<const ms::Mesh&>(*s1->entities[0]);
+        identical = identical && m0.points.size() == m1.points.size() &&
+            memcmp(m0.points.cdata(), m1.points.cdata(), m0.points.size_in_byte()) == 0;
+    }
+    Expect(identical);
+}
+
+TestCase(Test_SceneCacheDictionary)
+{
+    // many small segments. a dictionary trained from the first scenes should make them smaller
+    const int num_frames = 32;
+    const char *paths[] = { "small_nodict.sc", "small_dict.sc" };
+    for (int di = 0; di < 2; ++di) {
+        ms::OSceneCacheSettings oscs;
+        oscs.strip_unchanged = 0;
+        oscs.max_queue_size = num_frames;
+        oscs.zstd_dictionary = di;
+        oscs.dictionary_scenes = 8;
+        oscs.compression_workers = di * 2;
+
+        ms::OSceneCachePtr osc = ms::OpenOSceneCacheFile(paths[di], oscs);
+        Expect(osc);
+        if (!osc)
+            return;
+        for (int i = 0; i < num_frames; ++i) {
+            ms::ScenePtr scene = ms::Scene::create();
+            for (int mi = 0; mi < 16; ++mi) {
+                std::shared_ptr<ms::Mesh> mesh = ms::Mesh::create();
+                scene->entities.push_back(mesh);
+
+                mesh->path = "/Test/Wave" + std::to_string(mi);
+                mesh->id = mi;
+                mesh->position = { (float)mi, 0.0f, 0.0f };
+                MeshGenerator::GenerateWaveMesh(mesh->counts, mesh->indices, mesh->points, mesh->m_uv, 2.0f, 1.0f, 8, 10.0f * mu::DegToRad * (i + mi));
+                mesh->material_ids.resize(mesh->counts.size(), 0);
+                mesh->setupDataFlags();
+            }
+            osc->addScene(scene, (float)i / 30.0f);
+        }
+    }
+
+    ms::ISceneCachePtr iscs[2];
+    uint32_t sizes[2];
+    for (int di = 0; di < 2; ++di) {
+        std::ifstream fin(paths[di], std::ios::binary | std::ios::ate);
+        sizes[di] = (uint32_t)fin.tellg();
+        Print("    %s: %u byte\n", paths[di], sizes[di]);
+
+        ms::ISceneCacheSettings settings;
+        settings.enable_diff = false;
+        iscs[di] = ms::OpenISceneCacheFile(paths[di], settings);
+        Expect(iscs[di] && iscs[di]->getNumScenes() == num_frames);
+        if (!iscs[di])
+            return;
+    }
+    Expect(sizes[1] < sizes[0]);
+
+    bool identical = true;
+    for (int i = 0; i < num_frames; ++i) {
+        const ms::ScenePtr s0 = iscs[0]->getByIndex(i);
+        const ms::ScenePtr s1 = iscs[1]->getByIndex(i);
+        identical = identical && s0->entities.size() == s1->entities.size();
+        for (size_t ei = 0; identical && ei < s0->entities.size(); ++ei) {
+            const auto& m0 = static_cast<const ms::Mesh&>(*s0->entities[ei]);
+            const auto& m1 = static_cast<const ms::Mesh&>(*s1->entities[ei]);
+            identical = m0.points.size() == m1.points.size() &&
+                memcmp(m0.points.cdata(), m1.points.cdata(), m0.points.size_in_byte()) == 0;
+        }
+    }
+    Expect(identical);
+}
+
 TestCase(Test_Animation)
 {
     std::shared_ptr<ms::Scene> scene = ms::Scene::create();
@@ -166,6 +604,84 @@ TestCase(Test_MeshMerge)
     TestUtility::Send(scene);
 }
 
+TestCase(Test_MeshRefineCache)
+{
+    // frames of a deforming mesh must come out the same with and without the cache. only the first one is re-indexed.
+    auto make_frame = [](int frame, int resolution) {
+        auto mesh = ms::Mesh::create();
+        mesh->path = "/Test/RefineCache";
+        mesh->id = 1;
+        MeshGenerator::GenerateWaveMesh(mesh->counts, mesh->indices, mesh->points, mesh->m_uv, 2.0f, 0.1f, resolution, 0.1f * frame);
+        mesh->setupDataFlags();
+        auto& mrs = mesh->refine_settings;
+        mrs.flags.Set(ms::MESH_REFINE_FLAG_SPLIT, true);
+        mrs.split_unit = 5000;
+        mrs.flags.Set(ms::MESH_REFINE_FLAG_GEN_NORMALS_WITH_SMOOTH_ANGLE, true);
+        mrs.smooth_angle = 60.0f;
+        return mesh;
+    };
+
+    ms::MeshRefineCache cache;
+    const int num_frames = 8;
+    bool identical = true;
+    mu::nanosec time_plain = 0, time_cached = 0;
+    for (int frame = 0; frame < num_frames; ++frame) {
+        auto plain = make_frame(frame, 256);
+        auto cached = make_frame(frame, 256);
+        mu::nanosec begin = mu::Now();
+        plain->refine();
+        time_plain += mu::Now() - begin;
+        begin = mu::Now();
+        cached->refine(&cache);
+        time_cached += mu::Now() - begin;
+
+        identical = identical &&
+            plain->points == cached->points && plain->normals == cached->normals && plain->m_uv[0] == cached->m_uv[0] &&
+            plain->indices == cached->indices && plain->submeshes.size() == cached->submeshes.size();
+    }
+    Expect(identical);
+    Expect(cache.getNumHits() == num_frames - 1);
+    Print("    refine %d frames: %.2f ms, with cache %.2f ms\n", num_frames, mu::NS2MS(time_plain), mu::NS2MS(time_cached));
+
+    // different topology with the same id is re-indexed and replaces the record
+    auto other = make_frame(0, 128);
+    auto expected = make_frame(0, 128);
+    other->refine(&cache);
+    expected->refine();
+    Expect(cache.getNumHits() == num_frames - 1);
+    Expect(other->indices == expected->indices && other->points == expected->points);
+
+    // per-index uvs across splits. a corner that no longer has the uv of its vertex must not take the record
+    auto make_expanded = [&](int seam_corner) {
+        auto mesh = make_frame(0, 64);
+        mesh->refine_settings.split_unit = 1000;
+        auto& uv = mesh->m_uv[0];
+        SharedVector<mu::float2> expanded_uv;
+        expanded_uv.resize_discard(mesh->indices.size());
+        for (size_t ii = 0; ii < mesh->indices.size(); ++ii)
+            expanded_uv[ii] = uv[mesh->indices[ii]];
+        if (seam_corner >= 0)
+            expanded_uv[seam_corner] += mu::float2{ 0.5f, 0.5f };
+        uv = std::move(expanded_uv);
+        mesh->setupDataFlags();
+        return mesh;
+    };
+    const int hits = cache.getNumHits();
+    const int last_corner = (int)make_expanded(-1)->indices.size() - 1;
+    bool expanded_identical = true;
+    for (int seam_corner : { -1, -1, last_corner, last_corner }) {
+        auto plain = make_expanded(seam_corner);
+        auto cached = make_expanded(seam_corner);
+        plain->refine();
+        cached->refine(&cache);
+        expanded_identical = expanded_identical &&
+            plain->points == cached->points && plain->m_uv[0] == cached->m_uv[0] && plain->indices == cached->indices;
+    }
+    Expect(expanded_identical);
+    // the seam splits a vertex the record has welded, so that frame is re-indexed. the ones after each change hit
+    Expect(cache.getNumHits() == hits + 2);
+}
+
 TestCase(Test_Points)
 {
     Random rand;
@@ -408,3 +924,533 @@ TestCase(Test_Query)
 #undef SendQuery
 }
 
+
+TestCase(Test_ClientKeepAlive)
+{
+    // messages per second against a local server, with and without keep-alive connections
+    ms::ServerSettings server_settings;
+    server_settings.port = 8091;
+    ms::Server server(server_settings);
+    if (!server.start()) {
+        Print("could not start server on port %d\n", (int)server_settings.port);
+        return;
+    }
+
+    const int num_messages = 1000;
+    for (int max_connections : { 0, 4 }) {
+        ms::ClientSettings client_settings;
+        client_settings.port = server_settings.port;
+        client_settings.max_connections = max_connections;
+        ms::Client client(client_settings);
+
+        bool succeeded = true;
+        const mu::nanosec begin = mu::Now();
+        for (int i = 0; i < num_messages; ++i) {
+            ms::FenceMessage mes;
+            mes.message_id = i;
+            mes.type = i % 2 == 0 ? ms::FenceMessage::FenceType::SceneBegin : ms::FenceMessage::FenceType::SceneEnd;
+            succeeded = succeeded && client.send(mes);
+        }
+        const float elapsed = mu::NS2MS(mu::Now() - begin);
+        Print("    max_connections %d: %.0f messages/sec\n", max_connections, num_messages / (elapsed / 1000.0f));
+        Expect(succeeded);
+
+        server.processMessages([](ms::Message::Type, ms::Message&) {});
+    }
+}
+
+TestCase(Test_LargeMessage)
+{
+    // bodies around and above Poco's 4 KB stream buffer. larger ones are written straight to the socket
+    ms::ServerSettings server_settings;
+    server_settings.port = 8097;
+    ms::Server server(server_settings);
+    if (!server.start()) {
+        Print("could not start server on port %d\n", (int)server_settings.port);
+        return;
+    }
+
+    ms::ClientSettings client_settings;
+    client_settings.port = server_settings.port;
+    ms::Client client(client_settings);
+
+    for (int num_points : { 16, 320, 336, 340, 344, 360, 1000, 100000 }) {
+        ms::SetMessage mes;
+        mes.scene = ms::Scene::create();
+        auto mesh = ms::Mesh::create();
+        mesh->path = "/Test/LargeMessage";
+        mesh->id = 1;
+        for (int i = 0; i < num_points; ++i)
+            mesh->points.push_back({ (float)i, (float)(i * 2), (float)(i * 3) });
+        mesh->setupDataFlags();
+        mes.scene->entities.push_back(mesh);
+
+        const bool sent = client.send(mes);
+        bool intact = false;
+        server.processMessages([&](ms::Message::Type type, ms::Message& data) {
+            if (type != ms::Message::Type::Set)
+                return;
+            auto& entities = static_cast<ms::SetMessage&>(data).scene->entities;
+            intact = entities.size() == 1 && static_cast<ms::Mesh&>(*entities[0]).points == mesh->points;
+        });
+        if (!sent || !intact)
+            Print("    %d points: %s\n", num_points, sent ? "broken" : client.getErrorMessage().c_str());
+        Expect(sent && intact);
+    }
+}
+
+TestCase(Test_ServerBusy)
+{
+    // the server refuses a scene with 503 while another one waits for processMessages(). through the socket the body
+    // is compressed and chunked, so its size is only known as it is read.
+    ms::ServerSettings server_settings;
+    server_settings.port = 8098;
+    server_settings.max_pending_bytes = 1024 * 1024;
+    ms::Server server(server_settings);
+    if (!server.start()) {
+        Print("could not start server on port %d\n", (int)server_settings.port);
+        return;
+    }
+
+    ms::SetMessage mes;
+    mes.scene = ms::Scene::create();
+    auto mesh = ms::Mesh::create();
+    mesh->path = "/Test/ServerBusy";
+    mesh->id = 1;
+    MeshGenerator::GenerateWaveMesh(mesh->counts, mesh->indices, mesh->points, mesh->m_uv, 2.0f, 1.0f, 512, 0.0f);
+    mesh->setupDataFlags();
+    mes.scene->entities.push_back(mesh);
+
+    int received = 0;
+    auto handler = [&](ms::Message::Type type, ms::Message&) {
+        if (type == ms::Message::Type::Set)
+            ++received;
+    };
+
+    for (bool shared_memory : { true, false }) {
+        ms::ClientSettings client_settings;
+        client_settings.port = server_settings.port;
+        client_settings.timeout_ms = 1500; // one retry after Retry-After
+        client_settings.shared_memory = shared_memory;
+        ms::Client client(client_settings);
+
+        // the first one is admitted as nothing is waiting. the second one has to get the 503, not a reset connection
+        received = 0;
+        Expect(client.send(mes));
+        const bool busy_sent = client.send(mes);
+        const std::string busy_error = client.getErrorMessage();
+        Print("    %s, while busy: %s\n", shared_memory ? "shared memory" : "socket", busy_sent ? "sent" : busy_error.c_str());
+        Expect(!busy_sent && busy_error == "Server is busy.");
+
+        server.processMessages(handler);
+        Expect(received == 1);
+        Expect(client.send(mes));
+        server.processMessages(handler);
+        Expect(received == 2);
+    }
+}
+
+TestCase(Test_CompressionRefused)
+{
+    // compression is turned off on the server after the client found it accepted. the compressed message is refused
+    // with 415 and the client has to get it through by sending it again as is.
+    ms::ServerSettings server_settings;
+    server_settings.port = 8099;
+    ms::Server server(server_settings);
+    if (!server.start()) {
+        Print("could not start server on port %d
+", (int)server_settings.port);
+        return;
+    }
+
+    ms::ClientSettings client_settings;
+    client_settings.port = server_settings.port;
+    client_settings.shared_memory = false;
+    ms::Client client(client_settings);
+    Expect(client.isServerAvailable());
+    server.getSettings().compression = false;
+
+    ms::SetMessage mes;
+    mes.scene = ms::Scene::create();
+    auto mesh = ms::Mesh::create();
+    mesh->path = "/Test/CompressionRefused";
+    mesh->id = 1;
+    MeshGenerator::GenerateWaveMesh(mesh->counts, mesh->indices, mesh->points, mesh->m_uv, 2.0f, 1.0f, 256, 0.0f);
+    mesh->setupDataFlags();
+    mes.scene->entities.push_back(mesh);
+
+    auto expected = ms::Scene::create();
+    expected->entities.push_back(std::static_pointer_cast<ms::Transform>(mesh->clone(true)));
+    expected->import(server_settings.import_settings);
+    auto& expected_mesh = static_cast<ms::Mesh&>(*expected->entities[0]);
+
+    for (int i = 0; i < 2; ++i) {
+        const bool sent = client.send(mes);
+        bool intact = false;
+        server.processMessages([&](ms::Message::Type type, ms::Message& data) {
+            if (type != ms::Message::Type::Set)
+                return;
+            auto& entities = static_cast<ms::SetMessage&>(data).scene->entities;
+            intact = entities.size() == 1 && near_equal(static_cast<ms::Mesh&>(*entities[0]).points, expected_mesh.points);
+        });
+        if (!sent)
+            Print("    send %d: %s\n", i, client.getErrorMessage().c_str());
+        Expect(sent && intact);
+    }
+}
+
+TestCase(Test_SharedMemoryTransport)
+{
+    // a large SetMessage to a local server through the socket and through shared memory
+    ms::ServerSettings server_settings;
+    server_settings.port = 8092;
+    ms::Server server(server_settings);
+    if (!server.start()) {
+        Print("could not start server on port %d\n", (int)server_settings.port);
+        return;
+    }
+
+    ms::SetMessage mes;
+    mes.scene = ms::Scene::create();
+    auto mesh = ms::Mesh::create();
+    mesh->path = "/Test/SharedMemory";
+    mesh->id = 1;
+    MeshGenerator::GenerateWaveMesh(mesh->counts, mesh->indices, mesh->points, mesh->m_uv, 2.0f, 1.0f, 512, 0.0f);
+    mesh->material_ids.resize(mesh->counts.size(), 0);
+    mesh->setupDataFlags();
+    mes.scene->entities.push_back(mesh);
+
+    for (bool shared_memory : { false, true }) {
+        ms::ClientSettings client_settings;
+        client_settings.port = server_settings.port;
+        client_settings.shared_memory = shared_memory;
+        ms::Client client(client_settings);
+
+        const int num_messages = 8;
+        bool succeeded = true;
+        const mu::nanosec begin = mu::Now();
+        for (int i = 0; i < num_messages; ++i)
+            succeeded = succeeded && client.send(mes);
+        const float elapsed = mu::NS2MS(mu::Now() - begin);
+        Print("    shared_memory %d: %.2f ms per message\n", (int)shared_memory, elapsed / num_messages);
+        Expect(succeeded);
+
+        // the scene hash is validated on deserialization. with shared memory the vertex arrays live in the shared segments.
+        int num_received = 0;
+        bool intact = true;
+        server.processMessages([&](ms::Message::Type type, ms::Message& data) {
+            if (type != ms::Message::Type::Set)
+                return;
+            auto& received = static_cast<ms::SetMessage&>(data);
+            ++num_received;
+            auto& entities = received.scene->entities;
+            intact = intact && entities.size() == 1 && !static_cast<ms::Mesh&>(*entities[0]).points.empty();
+        });
+        Expect(num_received == num_messages);
+        Expect(intact);
+    }
+}
+
+TestCase(Test_CompressedTransport)
+{
+    // the client compresses only after the server has told it accepts it, and falls back when it stops accepting it
+    ms::ServerSettings server_settings;
+    server_settings.port = 8095;
+    ms::Server server(server_settings);
+    if (!server.start()) {
+        Print("could not start server on port %d\n", (int)server_settings.port);
+        return;
+    }
+
+    ms::SetMessage mes;
+    mes.scene = ms::Scene::create();
+    auto mesh = ms::Mesh::create();
+    mesh->path = "/Test/Compression";
+    mesh->id = 1;
+    MeshGenerator::GenerateWaveMesh(mesh->counts, mesh->indices, mesh->points, mesh->m_uv, 2.0f, 1.0f, 256, 0.0f);
+    mesh->setupDataFlags();
+    mes.scene->entities.push_back(mesh);
+
+    ms::ClientSettings client_settings;
+    client_settings.port = server_settings.port;
+    client_settings.compression = true;
+    ms::Client client(client_settings);
+    Expect(client.isServerAvailable());
+
+    for (bool compression : { true, false }) {
+        server.getSettings().compression = compression;
+        const mu::nanosec begin = mu::Now();
+        Expect(client.send(mes));
+        Print("    server accepts compression %d: %.2f ms\n", (int)compression, mu::NS2MS(mu::Now() - begin));
+
+        bool intact = false;
+        server.processMessages([&](ms::Message::Type type, ms::Message& data) {
+            if (type != ms::Message::Type::Set)
+                return;
+            auto& entities = static_cast<ms::SetMessage&>(data).scene->entities;
+            intact = entities.size() == 1 && static_cast<ms::Mesh&>(*entities[0]).points.size() == mesh->points.size();
+        });
+        Expect(intact);
+    }
+}
+
+TestCase(Test_ParkedRequests)
+{
+    // get requests wait for the host without holding HTTP threads. a set must get through while they wait.
+    ms::ServerSettings server_settings;
+    server_settings.port = 8096;
+    server_settings.max_threads = 2;
+    ms::Server server(server_settings);
+    if (!server.start()) {
+        Print("could not start server on port %d\n", (int)server_settings.port);
+        return;
+    }
+
+    ms::ClientSettings client_settings;
+    client_settings.port = server_settings.port;
+    ms::Client client(client_settings);
+
+    const int num_gets = 8;
+    std::atomic_int num_served{ 0 };
+    std::vector<std::thread> getters;
+    for (int i = 0; i < num_gets; ++i) {
+        getters.emplace_back([&]() {
+            ms::GetMessage get;
+            if (client.send(get))
+                ++num_served;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    ms::SetMessage set;
+    set.scene = ms::Scene::create();
+    auto transform = ms::Transform::create();
+    transform->path = "/Test/Parked";
+    set.scene->entities.push_back(transform);
+
+    const mu::nanosec begin = mu::Now();
+    Expect(client.send(set));
+    const float elapsed = mu::NS2MS(mu::Now() - begin);
+    Print("    set while %d gets wait: %.2f ms\n", num_gets, elapsed);
+    Expect(elapsed < 1000.0f);
+
+    server.processMessages([&](ms::Message::Type type, ms::Message& /*data*/) {
+        if (type == ms::Message::Type::Get) {
+            server.beginServeScene();
+            server.endServeScene();
+        }
+    });
+    for (auto& t : getters)
+        t.join();
+    Expect(num_served == num_gets);
+}
+
+TestCase(Test_BatchMessage)
+{
+    // fence, sets, delete and fence in one request. the server must queue them in the order they were packed.
+    ms::ServerSettings server_settings;
+    server_settings.port = 8093;
+    ms::Server server(server_settings);
+    if (!server.start()) {
+        Print("could not start server on port %d\n", (int)server_settings.port);
+        return;
+    }
+
+    const int session_id = 1;
+    const int num_meshes = 16;
+    ms::BatchMessage batch;
+    auto add = [&](std::shared_ptr<ms::Message> mes) {
+        mes->session_id = session_id;
+        mes->message_id = (int)batch.messages.size();
+        batch.messages.push_back(mes);
+    };
+
+    auto begin = std::make_shared<ms::FenceMessage>();
+    begin->type = ms::FenceMessage::FenceType::SceneBegin;
+    add(begin);
+    for (int i = 0; i < num_meshes; ++i) {
+        auto mes = std::make_shared<ms::SetMessage>();
+        auto mesh = ms::Mesh::create();
+        mesh->path = "/Test/Batch/Mesh" + std::to_string(i);
+        mesh->id = i;
+        MeshGenerator::GenerateWaveMesh(mesh->counts, mesh->indices, mesh->points, mesh->m_uv, 2.0f, 1.0f, 8, 0.0f);
+        mesh->setupDataFlags();
+        mes->scene->entities.push_back(mesh);
+        add(mes);
+    }
+    auto del = std::make_shared<ms::DeleteMessage>();
+    del->entities.push_back(ms::Identifier("/Test/Batch/Deleted", 100));
+    add(del);
+    auto end = std::make_shared<ms::FenceMessage>();
+    end->type = ms::FenceMessage::FenceType::SceneEnd;
+    add(end);
+
+    ms::ClientSettings client_settings;
+    client_settings.port = server_settings.port;
+    ms::Client client(client_settings);
+    Expect(client.send(batch));
+
+    std::vector<int> received_ids;
+    server.processMessages([&](ms::Message::Type, ms::Message& mes) {
+        received_ids.push_back(mes.message_id);
+    });
+    bool ordered = received_ids.size() == batch.messages.size();
+    for (size_t i = 0; ordered && i < received_ids.size(); ++i)
+        ordered = received_ids[i] == (int)i;
+    Expect(ordered);
+}
+
+TestCase(Test_SceneDiffTracker)
+{
+    auto create_meshes = [](float angle) {
+        std::vector<ms::TransformPtr> ret;
+        for (int i = 0; i < 3; ++i) {
+            auto mesh = ms::Mesh::create();
+            mesh->path = "/Test/Diff/Mesh" + std::to_string(i);
+            mesh->id = i;
+            MeshGenerator::GenerateWaveMesh(mesh->counts, mesh->indices, mesh->points, mesh->m_uv, 2.0f, 1.0f, 16, i == 2 ? angle : 0.0f);
+            mesh->setupDataFlags();
+            ret.push_back(mesh);
+        }
+        return ret;
+    };
+
+    ms::SceneDiffTracker tracker;
+    auto entities = create_meshes(0.0f);
+    tracker.filter(entities);
+    Expect(entities.size() == 3);
+    tracker.commit();
+
+    // mesh 0: unchanged. mesh 1: moved. mesh 2: deformed
+    entities = create_meshes(30.0f * mu::DegToRad);
+    entities[1]->position = { 1.0f, 0.0f, 0.0f };
+    tracker.filter(entities);
+    Expect(entities.size() == 2);
+    if (entities.size() == 2) {
+        auto& moved = static_cast<ms::Mesh&>(*entities[0]);
+        Expect(moved.path == "/Test/Diff/Mesh1");
+        Expect(moved.md_flags.Get(ms::MESH_DATA_FLAG_UNCHANGED) && !moved.td_flags.Get(ms::TRANSFORM_DATA_FLAG_UNCHANGED));
+        Expect(moved.points.empty() && moved.indices.empty());
+
+        auto& deformed = static_cast<ms::Mesh&>(*entities[1]);
+        Expect(deformed.path == "/Test/Diff/Mesh2");
+        Expect(!deformed.md_flags.Get(ms::MESH_DATA_FLAG_UNCHANGED) && !deformed.points.empty());
+    }
+
+    // not committed: the same changes are found again
+    tracker.discard();
+    entities = create_meshes(30.0f * mu::DegToRad);
+    entities[1]->position = { 1.0f, 0.0f, 0.0f };
+    tracker.filter(entities);
+    Expect(entities.size() == 2);
+    tracker.commit();
+
+    // permutations keep the sum of the data. they must still be found: flipped winding of a face and swapped points
+    entities = create_meshes(30.0f * mu::DegToRad);
+    entities[1]->position = { 1.0f, 0.0f, 0.0f };
+    {
+        auto& flipped = static_cast<ms::Mesh&>(*entities[0]);
+        std::swap(flipped.indices[1], flipped.indices[2]);
+        auto& swapped = static_cast<ms::Mesh&>(*entities[1]);
+        std::swap(swapped.points[0], swapped.points[1]);
+    }
+    tracker.filter(entities);
+    Expect(entities.size() == 2);
+    if (entities.size() == 2) {
+        Expect(!static_cast<ms::Mesh&>(*entities[0]).indices.empty());
+        Expect(!static_cast<ms::Mesh&>(*entities[1]).points.empty());
+    }
+}
+
+TestCase(Test_VertexPatch)
+{
+    // a brush stroke on a large mesh. the second send carries only the modified vertices and the server patches
+    // them into the mesh it kept from the first send.
+    ms::ServerSettings server_settings;
+    server_settings.port = 8094;
+    ms::Server server(server_settings);
+    if (!server.start()) {
+        Print("could not start server on port %d\n", (int)server_settings.port);
+        return;
+    }
+
+    auto mesh = ms::Mesh::create();
+    mesh->path = "/Test/VertexPatch";
+    mesh->id = 1;
+    MeshGenerator::GenerateWaveMesh(mesh->counts, mesh->indices, mesh->points, mesh->m_uv, 2.0f, 1.0f, 1024, 0.0f);
+    mesh->normals.resize(mesh->points.size(), { 0.0f, 1.0f, 0.0f });
+    mesh->setupDataFlags();
+
+    ms::ClientSettings client_settings;
+    client_settings.port = server_settings.port;
+    ms::Client client(client_settings);
+    ms::SceneDiffTracker tracker;
+    tracker.vertex_patches = true;
+
+    auto send = [&](const char* label) {
+        const mu::nanosec begin = mu::Now();
+        std::vector<ms::TransformPtr> entities{ std::static_pointer_cast<ms::Transform>(mesh->clone()) };
+        tracker.filter(entities);
+
+        ms::SetMessage mes;
+        mes.scene = ms::Scene::create();
+        mes.scene->entities = entities;
+        const uint64_t size = ms::ssize(mes);
+        bool succeeded = client.send(mes);
+        tracker.commit();
+
+        bool received = false;
+        ms::MeshPtr result;
+        server.processMessages([&](ms::Message::Type type, ms::Message& data) {
+            if (type != ms::Message::Type::Set)
+                return;
+            received = true;
+            result = std::static_pointer_cast<ms::Mesh>(static_cast<ms::SetMessage&>(data).scene->entities[0]->clone(true));
+        });
+        const float elapsed = mu::NS2MS(mu::Now() - begin);
+
+        // the mesh the server passes to the host must be the whole mesh as edited, imported
+        auto expected = ms::Scene::create();
+        expected->entities.push_back(std::static_pointer_cast<ms::Transform>(mesh->clone(true)));
+        expected->import(server_settings.import_settings);
+        auto& expected_mesh = static_cast<ms::Mesh&>(*expected->entities[0]);
+        const bool intact = received && result &&
+            near_equal(result->points, expected_mesh.points) && near_equal(result->normals, expected_mesh.normals);
+        Print("    %s: %llu bytes, %.2f ms\n", label, (unsigned long long)size, elapsed);
+        Expect(succeeded);
+        Expect(intact);
+        return size;
+    };
+
+    const uint64_t full_size = send("full");
+
+    // push vertices in a small circle
+    const mu::float3 center = mesh->points[mesh->points.size() / 2 + 512];
+    for (auto& p : mesh->points) {
+        if (length(p - center) < 0.05f)
+            p.y += 0.1f;
+    }
+    const uint64_t patch_size = send("patch");
+    Expect(patch_size < full_size / 10);
+
+    // deleting the mesh drops the server's copy. a patch to it is refused and the mesh goes in full again
+    {
+        ms::DeleteMessage del;
+        del.entities.push_back(ms::Identifier(mesh->path, mesh->id));
+        Expect(client.send(del));
+        server.processMessages([](ms::Message::Type, ms::Message&) {});
+
+        for (auto& p : mesh->points) {
+            if (length(p - center) < 0.05f)
+                p.y -= 0.1f;
+        }
+        std::vector<ms::TransformPtr> entities{ std::static_pointer_cast<ms::Transform>(mesh->clone()) };
+        tracker.filter(entities);
+        ms::SetMessage mes;
+        mes.scene = ms::Scene::create();
+        mes.scene->entities = entities;
+        Expect(!client.send(mes));
+        tracker.discard();
+    }
+    Expect(send("full after delete") > full_size / 2);
+}
@@ -109,6 +109,78 @@ TestCase(TestMeshRefiner)
 }
 
 
+TestCase(TestMeshRefinerWelding)
+{
+    // 512x512 quads (1M+ indices) with 2 uv sets and colors, all per-index.
+    // uv0 has a seam every 16 columns and colors change every 32 rows. anything else must be welded.
+    const int quads = 512;
+    const int res = quads + 1;
+    RawVector<float3> points(res * res);
+    for (int y = 0; y < res; ++y)
+        for (int x = 0; x < res; ++x)
+            points[y * res + x] = { (float)x, 0.0f, (float)y };
+
+    RawVector<int> counts;
+    counts.resize(quads * quads, 4);
+    RawVector<int> indices;
+    RawVector<float2> uv0, uv1;
+    RawVector<float4> colors;
+    for (int fy = 0; fy < quads; ++fy) {
+        for (int fx = 0; fx < quads; ++fx) {
+            const int corners[4][2] = { { fx, fy }, { fx, fy + 1 }, { fx + 1, fy + 1 }, { fx + 1, fy } };
+            for (auto& c : corners) {
+                const int tile = fx / 16;
+                indices.push_back(c[1] * res + c[0]);
+                uv0.push_back({ (float)(c[0] - tile * 16) / 16.0f, (float)c[1] / quads });
+                uv1.push_back({ (float)c[0] / quads, (float)c[1] / quads });
+                colors.push_back((fy / 32) % 2 ? float4{ 1.0f, 0.0f, 0.0f, 1.0f } : float4{ 0.0f, 0.0f, 1.0f, 1.0f });
+            }
+        }
+    }
+    const int seams_u = quads / 16 - 1, seams_c = quads / 32 - 1;
+    const int expected_vertices = res * res + seams_u * res + seams_c * res + seams_u * seams_c;
+
+    RawVector<float2> new_uv0, new_uv1;
+    RawVector<float4> new_colors;
+    RawVector<int> remap_uv0, remap_uv1, remap_colors;
+    auto refine = [&](int split_unit) {
+        mu::MeshRefiner refiner;
+        refiner.split_unit = split_unit;
+        refiner.counts = counts;
+        refiner.indices = indices;
+        refiner.points = points;
+        refiner.addExpandedAttribute<float2>(uv0, new_uv0, remap_uv0);
+        refiner.addExpandedAttribute<float2>(uv1, new_uv1, remap_uv1);
+        refiner.addExpandedAttribute<float4>(colors, new_colors, remap_colors);
+
+        const mu::nanosec begin = mu::Now();
+        refiner.refine();
+        refiner.retopology(false);
+        refiner.genSubmeshes();
+        const mu::nanosec elapsed = mu::Now() - begin;
+        Print("    %d indices, split_unit %d: %d vertices, %d splits, %.2f ms\n",
+            (int)indices.size(), split_unit, (int)refiner.new_points.size(), (int)refiner.splits.size(), mu::NS2MS(elapsed));
+
+        // every index must land on a vertex with its own point and attributes
+        bool intact = true;
+        for (auto& split : refiner.splits) {
+            intact = intact && (split_unit == 0 || split.vertex_count <= split_unit);
+            for (int i = 0; i < split.index_count; ++i) {
+                const int ii = split.index_offset + i;
+                const int ni = refiner.new_indices[ii];
+                intact = intact && ni >= split.vertex_offset && ni < split.vertex_offset + split.vertex_count &&
+                    refiner.new_points[ni] == points[indices[ii]] &&
+                    new_uv0[ni] == uv0[ii] && new_uv1[ni] == uv1[ii] && new_colors[ni] == colors[ii];
+            }
+        }
+        Expect(intact);
+        return (int)refiner.new_points.size();
+    };
+    Expect(refine(0) == expected_vertices);
+    refine(65000);
+}
+
+
 TestCase(TestNormalsAndTangents)
 {
     RawVector<int> indices, counts;
@@ -225,6 +297,17 @@ TestCase(TestNormalsAndTangents)
     ValidateNormals(normals[5]);
 #endif
 
+    RawVector<float3> normals_poly, normals_smooth;
+    TestScope("GenerateNormals polygon", [&]() {
+        GenerateNormalsPoly(normals_poly, points, counts, indices, false);
+    }, num_try);
+    ValidateNormals(normals_poly);
+
+    TestScope("GenerateNormals smooth angle", [&]() {
+        GenerateNormalsWithSmoothAngle(normals_smooth, points, counts, indices, 60.0f, false);
+    }, num_try);
+    Expect(normals_smooth.size() == indices.size());
+
 
     // generate tangents
 
@@ -269,6 +352,12 @@ TestCase(TestNormalsAndTangents)
     ValidateTangents(tangents[5]);
 #endif
 
+    RawVector<float4> tangents_poly;
+    TestScope("GenerateTangents polygon", [&]() {
+        GenerateTangentsPoly(tangents_poly, points, uv[uvIndex], normals[0], counts, indices);
+    }, num_try);
+    ValidateTangents(tangents_poly);
+
     // try to call CalculateTangents() in Unity.exe
     {
         void* unity_exe = GetModule("Unity.exe");
@@ -726,7 +815,49 @@ TestCase(TestEdge)
             Print(" %d", e);
         }
         Print("\n");
+
+        // same result with the connection built above
+        RawVector<int> edges_reused;
+        SelectEdge(indices, counts, offsets, points, connection, vi, [&](int vi) { edges_reused.push_back(vi); });
+        Expect(edges_reused == edges);
+    }
+}
+
+TestCase(TestWeldMap)
+{
+    // quads that don't share vertices, like a mesh split at every edge. 4 vertices are at each grid point
+    const int res = 256;
+    RawVector<float3> points;
+    RawVector<int> counts, indices;
+    for (int yi = 0; yi < res; ++yi) {
+        for (int xi = 0; xi < res; ++xi) {
+            const float3 corners[4] = {
+                { (float)xi, 0.0f, (float)yi }, { (float)xi + 1, 0.0f, (float)yi },
+                { (float)xi + 1, 0.0f, (float)yi + 1 }, { (float)xi, 0.0f, (float)yi + 1 },
+            };
+            for (auto& c : corners) {
+                indices.push_back((int)points.size());
+                points.push_back(c);
+            }
+            counts.push_back(4);
+        }
+    }
+    points[0].y = -0.0f; // equal to +0
+
+    MeshConnectionInfo connection;
+    const mu::nanosec begin = mu::Now();
+    connection.buildConnection(indices, counts, points, true);
+    Print("    %d vertices welded in %.2f ms\n", (int)points.size(), mu::NS2MS(mu::Now() - begin));
+
+    // every vertex must map to the first vertex at its position
+    std::map<std::pair<float, float>, int> first;
+    bool ok = true;
+    for (int vi = 0; vi < (int)points.size(); ++vi) {
+        auto it = first.insert({ { points[vi].x, points[vi].z }, vi }).first;
+        ok = ok && connection.weld_map[vi] == it->second;
     }
+    Expect(ok);
+    Expect(connection.weld_counts[0] == 1 && connection.weld_counts[1] == 2 && connection.weld_counts[2] == 4);
 }
 
 TestCase(TestHandedness)
@@ -1114,6 +1245,158 @@ TestCase(Test_BoundedArray)
     Expect(NearEqual(data_tangents.data(), tmp_tangents.data(), N, eps));
 }
 
+TestCase(Test_BitShuffle)
+{
+    Random rnd;
+    for (size_t n : { 0, 1, 7, 8, 9, 1000, 1003 }) {
+        RawVector<uint32_t> src(n), dst(n);
+        RawVector<uint8_t> shuffled(n * 4);
+        for (auto& v : src)
+            v = (uint32_t)(rnd.f01() * 4294967295.0);
+
+        BitShuffle32(shuffled.data(), src.cdata(), n);
+        BitUnshuffle32(dst.data(), shuffled.cdata(), n);
+        Expect(src == dst);
+    }
+
+    // bit 5 of the 4th word goes to plane 5
+    uint32_t words[8] = {};
+    uint8_t planes[32];
+    words[3] = 1 << 5;
+    BitShuffle32(planes, words, 8);
+    Expect(planes[5] == (1 << 3));
+}
+
+TestCase(Test_MPSCQueue)
+{
+    // each producer pushes increasing values. the consumer must see all of them, in order per producer
+    const int num_producers = 4;
+    const int num_values = 10000;
+    mpsc_queue<std::pair<int, int>> queue;
+
+    std::vector<std::thread> producers;
+    for (int pi = 0; pi < num_producers; ++pi) {
+        producers.emplace_back([&queue, pi]() {
+            for (int i = 0; i < num_values; ++i)
+                queue.push(std::make_pair(pi, i));
+        });
+    }
+
+    std::vector<std::pair<int, int>> received;
+    std::vector<int> next(num_producers, 0);
+    bool ordered = true;
+    while (received.size() < num_producers * num_values) {
+        size_t begin = received.size();
+        queue.pop_all(received);
+        for (size_t i = begin; i < received.size(); ++i) {
+            auto& v = received[i];
+            ordered = ordered && v.second == next[v.first];
+            next[v.first] = v.second + 1;
+        }
+    }
+    for (auto& t : producers)
+        t.join();
+    Expect(ordered);
+    Expect(queue.empty());
+}
+
+TestCase(Test_TaskQueue)
+{
+    // tasks run on a fixed number of threads and all of them complete
+    const int num_threads = 3;
+    const int num_tasks = 100;
+    std::atomic<int> done{ 0 }, running{ 0 }, max_running{ 0 };
+    std::vector<std::future<void>> futures;
+    {
+        task_queue queue(num_threads);
+        Expect(queue.get_num_threads() == num_threads);
+        for (int i = 0; i < num_tasks; ++i) {
+            futures.push_back(queue.push([&]() {
+                int r = ++running;
+                int m = max_running;
+                while (r > m && !max_running.compare_exchange_weak(m, r)) {}
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                --running;
+                ++done;
+            }));
+        }
+        futures.front().wait();
+    }
+    // the destructor finishes the queued tasks before joining
+    for (auto& f : futures)
+        f.get();
+    Expect(done == num_tasks);
+    Expect(max_running <= num_threads);
+}
+
+TestCase(Test_ParallelForEach)
+{
+    // non-random-access iterators. every element is visited exactly once
+    const int num_elements = 200000;
+    std::list<int> values(num_elements, 0);
+    std::atomic<int> visited{ 0 };
+    TestScope("parallel_for_each (list)", [&]() {
+        parallel_for_each(values.begin(), values.end(), [&](int& v) {
+            ++v;
+            ++visited;
+        });
+    });
+    Expect(visited == num_elements);
+    Expect(std::all_of(values.begin(), values.end(), [](int v) { return v == 1; }));
+}
+
+TestCase(Test_CounterStream)
+{
+    // mix of small writes that go through the put area and large writes that bypass it
+    RawVector<char> data;
+    data.resize(1024 * 1024 + 3);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = (char)i;
+
+    CounterStream c;
+    MemoryStream m;
+    for (int i = 0; i < 4; ++i) {
+        for (auto *os : { (std::ostream*)&c, (std::ostream*)&m }) {
+            os->put('a');
+            os->write(data.data(), 17);
+            os->write(data.data(), data.size() >> i);
+        }
+    }
+    c.flush();
+    m.flush();
+    Expect(c.size() == m.getWCount());
+}
+
+TestCase(Test_GatherStream)
+{
+    RawVector<char> data;
+    data.resize(1024 * 1024 + 3);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = (char)i;
+
+    // small writes are copied, writeRef() keeps references. concatenated segments must match plain serialization.
+    GatherStream g;
+    MemoryStream m;
+    for (int i = 0; i < 4; ++i) {
+        size_t size = data.size() >> i;
+        g.put('a');
+        g.write(data.data(), 17);
+        g.writeRef(data.data(), size);
+        m.put('a');
+        m.write(data.data(), 17);
+        m.write(data.data(), size);
+    }
+    m.flush();
+
+    auto& segments = g.getSegments();
+    RawVector<char> gathered;
+    for (auto& seg : segments)
+        gathered.insert(gathered.end(), seg.data, seg.data + seg.size);
+    Expect(g.size() == m.getWCount());
+    Expect(gathered.size() == m.getWCount() && memcmp(gathered.cdata(), m.getBuffer().cdata(), gathered.size()) == 0);
+    Expect(segments[1].data == data.cdata()); // referenced, not copied
+}
+
 TestCase(Test_RemoveNamespace)
 {
     auto remove_namespace = [](std::string path) {
@@ -50,6 +50,59 @@ struct noncopyable
 };
 
 
+// read-only view of a whole file. pages are loaded by the OS on access.
+// the file is not locked. if another process truncates it while it is mapped, accessing the lost pages
+// raises SIGBUS on POSIX (an in-page error on Windows).
+class MemoryMappedFile : private noncopyable
+{
+public:
+    MemoryMappedFile();
+    ~MemoryMappedFile();
+    bool open(const char *path);
+    void close();
+
+    bool valid() const { return m_data != nullptr; }
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void *m_file = nullptr;
+    void *m_mapping = nullptr;
+#else
+    int m_fd = -1;
+#endif
+};
+
+
+// named shared memory that other processes on the same machine can open by name.
+// the name is removed when the creator closes it. processes that have it open keep their view.
+class SharedMemory : private noncopyable
+{
+public:
+    SharedMemory();
+    ~SharedMemory();
+    bool create(const char *name, size_t size); // read-write
+    bool open(const char *name, size_t size); // read-only
+    void close();
+
+    bool valid() const { return m_data != nullptr; }
+    char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    char *m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void *m_mapping = nullptr;
+#else
+    std::string m_name; // non-empty if this object created it
+#endif
+};
+
+
 enum class MemoryFlags
 {
     ExecuteRead,
@@ -5,32 +5,50 @@
 
 namespace mu {
 
+// exclusive prefix sum of counts
+static void CalcFaceOffsets(RawVector<int>& dst, const IArray<int> counts)
+{
+    const int num_faces = (int)counts.size();
+    dst.resize_discard(num_faces);
+    int offset = 0;
+    for (int fi = 0; fi < num_faces; ++fi) {
+        dst[fi] = offset;
+        offset += counts[fi];
+    }
+}
+
+// vertex ranges are processed in parallel. each range computes the normals of the faces that touch it and sums them
+// in face order, so the result doesn't depend on the number of threads.
 bool GenerateNormalsPoly(RawVector<float3>& dst,
     const IArray<float3> points, const IArray<int> counts, const IArray<int> indices, bool flip)
 {
-    const size_t num_faces = counts.size();
+    const int num_faces = (int)counts.size();
+    const int num_points = (int)points.size();
     const int i1 = flip ? 2 : 1;
     const int i2 = flip ? 1 : 2;
 
-    dst.resize_discard(points.size());
+    dst.resize_discard(num_points);
     dst.zeroclear();
+    impl::EachVertexRange(num_points, [&](int vbegin, int vend) {
+        int offset = 0;
+        for (int fi = 0; fi < num_faces; ++fi) {
+            const int ngon = counts[fi];
+            const int *face = &indices[offset];
+            offset += ngon;
+            if (ngon < 3 || std::none_of(face, face + ngon, [&](int vi) { return impl::InRange(vi, vbegin, vend); }))
+                continue;
 
-    int offset = 0;
-    for (size_t fi = 0; fi < num_faces; ++fi) {
-        const int ngon = counts[fi];
-        if (ngon < 3)
-            continue;
-
-        const int *face = &indices[offset];
-        float3 p0 = points[face[0]];
-        float3 p1 = points[face[i1]];
-        float3 p2 = points[face[i2]];
-        float3 n = cross(p1 - p0, p2 - p0);
-        for (int ci = 0; ci < ngon; ++ci)
-            dst[face[ci]] += n;
-        offset += ngon;
-    }
-    Normalize(dst.data(), dst.size());
+            float3 p0 = points[face[0]];
+            float3 p1 = points[face[i1]];
+            float3 p2 = points[face[i2]];
+            float3 n = cross(p1 - p0, p2 - p0);
+            for (int ci = 0; ci < ngon; ++ci) {
+                if (impl::InRange(face[ci], vbegin, vend))
+                    dst[face[ci]] += n;
+            }
+        }
+        Normalize(dst.data() + vbegin, vend - vbegin);
+    });
     return true;
 }
 
@@ -39,64 +57,116 @@ void GenerateNormalsWithSmoothAngle(RawVector<float3>& dst,
 {
     MeshConnectionInfo connection;
     connection.buildConnection(indices, counts, points);
+    GenerateNormalsWithSmoothAngle(dst, connection, points, counts, indices, smooth_angle, flip);
+}
 
-    const size_t num_faces = counts.size();
+void GenerateNormalsWithSmoothAngle(RawVector<float3>& dst, const MeshConnectionInfo& connection,
+    const IArray<float3> points, const IArray<int> counts, const IArray<int> indices, float smooth_angle, bool flip)
+{
+    const int num_faces = (int)counts.size();
     const int i1 = flip ? 2 : 1;
     const int i2 = flip ? 1 : 2;
 
+    RawVector<int> offsets;
+    CalcFaceOffsets(offsets, counts);
+
     // gen face normals
-    int offset = 0;
     RawVector<float3> face_normals;
-    face_normals.resize_zeroclear(num_faces);
-    for (size_t fi = 0; fi < num_faces; ++fi)
-    {
-        int count = counts[fi];
-        if (count < 3)
-            continue;
-
-        const int *face = &indices[offset];
-        float3 p0 = points[face[0]];
-        float3 p1 = points[face[i1]];
-        float3 p2 = points[face[i2]];
-        float3 n = cross(p1 - p0, p2 - p0);
-        face_normals[fi] = n;
-        offset += count;
-    }
-    Normalize(face_normals.data(), face_normals.size());
+    face_normals.resize_discard(num_faces);
+    parallel_for_blocked(0, num_faces, 4096, [&](int begin, int end) {
+        for (int fi = begin; fi < end; ++fi) {
+            if (counts[fi] < 3) {
+                face_normals[fi] = float3::zero();
+                continue;
+            }
+            const int *face = &indices[offsets[fi]];
+            float3 p0 = points[face[0]];
+            float3 p1 = points[face[i1]];
+            float3 p2 = points[face[i2]];
+            face_normals[fi] = cross(p1 - p0, p2 - p0);
+        }
+        Normalize(face_normals.data() + begin, end - begin);
+    });
 
-    // gen vertex normals
-    dst.resize_discard(indices.size());
-    dst.zeroclear();
-    offset = 0;
+    // gen vertex normals. each block of faces writes and normalizes its own range of indices
+    dst.resize_zeroclear(indices.size());
     const float angle = std::cos(smooth_angle * DegToRad) - 0.001f;
-    for (size_t fi = 0; fi < num_faces; ++fi)
-    {
-        int count = counts[fi];
-        if (count < 3)
-            continue;
+    parallel_for_blocked(0, num_faces, 4096, [&](int begin, int end) {
+        for (int fi = begin; fi < end; ++fi) {
+            const int count = counts[fi];
+            if (count < 3)
+                continue;
 
-        const int *face = &indices[offset];
-        auto& face_normal = face_normals[fi];
-        for (int ci = 0; ci < count; ++ci) {
-            int vi = face[ci];
-            auto normal = float3::zero();
-            connection.eachConnectedFaces(vi, [&](int fi2, int) {
-                float3 n = face_normals[fi2];
-                if (dot(face_normal, n) > angle) {
-                    normal += n;
+            const int offset = offsets[fi];
+            const int *face = &indices[offset];
+            auto& face_normal = face_normals[fi];
+            for (int ci = 0; ci < count; ++ci) {
+                int vi = face[ci];
+                auto normal = float3::zero();
+                connection.eachConnectedFaces(vi, [&](int fi2, int) {
+                    float3 n = face_normals[fi2];
+                    if (dot(face_normal, n) > angle) {
+                        normal += n;
+                    }
+                });
+                dst[offset + ci] = normal;
+            }
+        }
+        if (begin < end) {
+            const int first = offsets[begin];
+            const int last = offsets[end - 1] + counts[end - 1];
+            Normalize(dst.data() + first, last - first);
+        }
+    });
+}
+
+bool GenerateTangentsPoly(RawVector<float4>& dst,
+    const IArray<float3> points, const IArray<float2> uv, const IArray<float3> normals,
+    const IArray<int> counts, const IArray<int> indices)
+{
+    const int num_faces = (int)counts.size();
+    const int num_points = (int)points.size();
+
+    // same as GenerateNormalsPoly(): each vertex range takes the triangles of the faces that touch it
+    RawVector<float3> tangents, binormals;
+    tangents.resize_zeroclear(num_points);
+    binormals.resize_zeroclear(num_points);
+    dst.resize_discard(num_points);
+    impl::EachVertexRange(num_points, [&](int vbegin, int vend) {
+        int offset = 0;
+        for (int fi = 0; fi < num_faces; ++fi) {
+            const int count = counts[fi];
+            const int *face = &indices[offset];
+            offset += count;
+            if (std::none_of(face, face + count, [&](int vi) { return impl::InRange(vi, vbegin, vend); }))
+                continue;
+
+            const int num_triangles = count - 2;
+            for (int ti = 0; ti < num_triangles; ++ti) {
+                int idx[3] = { face[0], face[ti + 1], face[ti + 2] };
+                float3 v[3] = { points[idx[0]], points[idx[1]], points[idx[2]] };
+                float2 u[3] = { uv[idx[0]], uv[idx[1]], uv[idx[2]] };
+                float3 t[3];
+                float3 b[3];
+                compute_triangle_tangent(v, u, t, b);
+
+                for (int i = 0; i < 3; ++i) {
+                    if (impl::InRange(idx[i], vbegin, vend)) {
+                        tangents[idx[i]] += t[i];
+                        binormals[idx[i]] += b[i];
+                    }
                 }
-            });
-            dst[offset + ci] = normal;
+            }
         }
-        offset += count;
-    }
 
-    // normalize
-    Normalize(dst.data(), dst.size());
+        for (int vi = vbegin; vi < vend; ++vi) {
+            dst[vi] = orthogonalize_tangent(tangents[vi], binormals[vi], normals[vi]);
+        }
+    });
+    return true;
 }
 
 
-
 void QuadifyTriangles(const IArray<float3> points, const IArray<int> indices, bool full_search, float threshold_angle,
     RawVector<int>& dst_indices, RawVector<int>& dst_counts)
 {
@@ -30,6 +30,16 @@ void GenerateNormalsWithSmoothAngle(RawVector<float3>& dst,
     const IArray<float3> points,
     const IArray<int> counts, const IArray<int> indices,
     float smooth_angle, bool flip);
+// connection must be built from counts and indices. it only depends on the topology, so it can be kept across frames
+void GenerateNormalsWithSmoothAngle(RawVector<float3>& dst, const MeshConnectionInfo& connection,
+    const IArray<float3> points,
+    const IArray<int> counts, const IArray<int> indices,
+    float smooth_angle, bool flip);
+
+// uv and normals are per-vertex
+bool GenerateTangentsPoly(RawVector<float4>& dst,
+    const IArray<float3> points, const IArray<float2> uv, const IArray<float3> normals,
+    const IArray<int> counts, const IArray<int> indices);
 
 
 // PointsIter: indexed_iterator<const float3*, int*> or indexed_iterator_s<const float3*, int*>
@@ -55,6 +65,9 @@ void SelectEdge(const IArray<int>& indices, int ngon, const IArray<float3>& vert
 template<class Handler>
 void SelectEdge(const IArray<int>& indices, const IArray<int>& counts, const IArray<int>& offsets, const IArray<float3>& vertices,
     const IArray<int>& vertex_indices, const Handler& handler);
+template<class Handler>
+void SelectEdge(const IArray<int>& indices, const IArray<int>& counts, const IArray<int>& offsets, const IArray<float3>& vertices,
+    const MeshConnectionInfo& connection, const IArray<int>& vertex_indices, const Handler& handler);
 
 template<class Handler>
 void SelectHole(const IArray<int>& indices, int ngon, const IArray<float3>& vertices,
@@ -62,6 +75,9 @@ void SelectHole(const IArray<int>& indices, int ngon, const IArray<float3>& vert
 template<class Handler>
 void SelectHole(const IArray<int>& indices, const IArray<int>& counts, const IArray<int>& offsets, const IArray<float3>& vertices,
     const IArray<int>& vertex_indices, const Handler& handler);
+template<class Handler>
+void SelectHole(const IArray<int>& indices, const IArray<int>& counts, const IArray<int>& offsets, const IArray<float3>& vertices,
+    const MeshConnectionInfo& connection, const IArray<int>& vertex_indices, const Handler& handler);
 
 template<class Handler>
 void SelectConnected(const IArray<int>& indices, int ngon, const IArray<float3>& vertices,
@@ -69,6 +85,9 @@ void SelectConnected(const IArray<int>& indices, int ngon, const IArray<float3>&
 template<class Handler>
 void SelectConnected(const IArray<int>& indices, const IArray<int>& counts, const IArray<int>& offsets, const IArray<float3>& vertices,
     const IArray<int>& vertex_indices, const Handler& handler);
+template<class Handler>
+void SelectConnected(const IArray<int>& indices, const IArray<int>& counts, const IArray<int>& offsets, const IArray<float3>& vertices,
+    const MeshConnectionInfo& connection, const IArray<int>& vertex_indices, const Handler& handler);
 
 
 // ------------------------------------------------------------
@@ -34,95 +34,190 @@ struct OffsetsC
 };
 
 
+// splits [0, num_points) into one range per thread and calls body(vbegin, vend) for each range in parallel.
+// bodies that scan all faces in order and only write to vertices in their range produce the same per-vertex results as
+// a serial loop, without atomics. the scans are sequential reads and cheap compared to the scattered writes.
+template<class Body>
+inline void EachVertexRange(int num_points, const Body& body)
+{
+    const int num_ranges = std::max<int>(std::min<int>(get_num_threads(), num_points / 4096), 1);
+    parallel_for(0, num_ranges, [&](int ri) {
+        body((int)((int64_t)num_points * ri / num_ranges), (int)((int64_t)num_points * (ri + 1) / num_ranges));
+    });
+}
+
+inline bool InRange(int vi, int vbegin, int vend)
+{
+    return (uint32_t)(vi - vbegin) < (uint32_t)(vend - vbegin);
+}
+
+// Body: [](int face_index, int index_index, int vertex_index) -> void
+// called in face order for the indices of each vertex range
+template<class Indices, class Counts, class Body>
+inline void EachIndexByVertexRange(const Indices& indices, const Counts& counts, int num_points, const Body& body)
+{
+    const int num_faces = (int)counts.size();
+    EachVertexRange(num_points, [&](int vbegin, int vend) {
+        int ii = 0;
+        for (int fi = 0; fi < num_faces; ++fi) {
+            const int c = counts[fi];
+            for (int ci = 0; ci < c; ++ci, ++ii) {
+                const int vi = indices[ii];
+                if (InRange(vi, vbegin, vend))
+                    body(fi, ii, vi);
+            }
+        }
+    });
+}
+
+// dst[i] = sum of src[0, i). returns the total. dst can be src.
+// blocks are summed in parallel, then each block is scanned from its own starting value.
+inline int ExclusiveScan(int *dst, const int *src, int n)
+{
+    const int num_blocks = std::max<int>(std::min<int>(get_num_threads(), n / 65536), 1);
+    RawVector<int> block_offsets;
+    block_offsets.resize_discard(num_blocks + 1);
+    auto block_begin = [&](int bi) { return (int)((int64_t)n * bi / num_blocks); };
+
+    if (num_blocks > 1) {
+        parallel_for(0, num_blocks, [&](int bi) {
+            int sum = 0;
+            for (int i = block_begin(bi), e = block_begin(bi + 1); i < e; ++i)
+                sum += src[i];
+            block_offsets[bi + 1] = sum;
+        });
+    }
+    block_offsets[0] = 0;
+    for (int bi = 1; bi < num_blocks; ++bi)
+        block_offsets[bi] += block_offsets[bi - 1];
+
+    int total = 0;
+    parallel_for(0, num_blocks, [&](int bi) {
+        int offset = block_offsets[bi];
+        for (int i = block_begin(bi), e = block_begin(bi + 1); i < e; ++i) {
+            int c = src[i];
+            dst[i] = offset;
+            offset += c;
+        }
+        if (bi == num_blocks - 1)
+            total = offset;
+    });
+    return total;
+}
+
+// counting sort of items [0, num_items) into buckets [0, num_buckets) by key(item).
+// items of each bucket are in ascending order. both passes run in parallel over bucket ranges.
+template<class Key>
+inline void BucketSort(RawVector<int>& counts, RawVector<int>& offsets, RawVector<int>& items,
+    int num_items, int num_buckets, const Key& key)
+{
+    counts.resize_zeroclear(num_buckets);
+    offsets.resize_discard(num_buckets);
+    items.resize_discard(num_items);
+
+    EachVertexRange(num_buckets, [&](int bbegin, int bend) {
+        for (int i = 0; i < num_items; ++i) {
+            int b = key(i);
+            if (InRange(b, bbegin, bend))
+                counts[b]++;
+        }
+    });
+    ExclusiveScan(offsets.data(), counts.data(), num_buckets);
+
+    counts.zeroclear();
+    EachVertexRange(num_buckets, [&](int bbegin, int bend) {
+        for (int i = 0; i < num_items; ++i) {
+            int b = key(i);
+            if (InRange(b, bbegin, bend))
+                items[offsets[b] + counts[b]++] = i;
+        }
+    });
+}
+
 template<class Indices, class Counts>
 inline void BuildConnection(
     MeshConnectionInfo& connection, const Indices& indices, const Counts& counts, const IArray<float3>& vertices)
 {
-    size_t num_points = vertices.size();
-    size_t num_faces = counts.size();
+    int num_points = (int)vertices.size();
     size_t num_indices = indices.size();
 
     connection.v2f_offsets.resize_discard(num_points);
     connection.v2f_faces.resize_discard(num_indices);
     connection.v2f_indices.resize_discard(num_indices);
 
+    // counting sort by vertex. both passes run in parallel over vertex ranges
     connection.v2f_counts.resize_zeroclear(num_points);
-    {
-        int ii = 0;
-        for (size_t fi = 0; fi < num_faces; ++fi) {
-            int c = counts[fi];
-            for (int ci = 0; ci < c; ++ci) {
-                connection.v2f_counts[indices[ii + ci]]++;
-            }
-            ii += c;
-        }
+    EachIndexByVertexRange(indices, counts, num_points, [&](int, int, int vi) {
+        connection.v2f_counts[vi]++;
+    });
 
-        int offset = 0;
-        for (size_t i = 0; i < num_points; ++i) {
-            connection.v2f_offsets[i] = offset;
-            offset += connection.v2f_counts[i];
-        }
-    }
+    ExclusiveScan(connection.v2f_offsets.data(), connection.v2f_counts.data(), num_points);
 
     connection.v2f_counts.zeroclear();
-    {
-        int i = 0;
-        for (int fi = 0; fi < (int)num_faces; ++fi) {
-            int c = counts[fi];
-            for (int ci = 0; ci < c; ++ci) {
-                int vi = indices[i + ci];
-                int ti = connection.v2f_offsets[vi] + connection.v2f_counts[vi]++;
-                connection.v2f_faces[ti] = fi;
-                connection.v2f_indices[ti] = i + ci;
-            }
-            i += c;
-        }
+    EachIndexByVertexRange(indices, counts, num_points, [&](int fi, int ii, int vi) {
+        int ti = connection.v2f_offsets[vi] + connection.v2f_counts[vi]++;
+        connection.v2f_faces[ti] = fi;
+        connection.v2f_indices[ti] = ii;
+    });
+}
+
+// spatial hash of a position. -0 and +0 are equal positions and must share a slot
+inline uint32_t HashPosition(const float3& p)
+{
+    uint32_t h = 0x811c9dc5;
+    for (int i = 0; i < 3; ++i) {
+        float v = p[i] == 0.0f ? 0.0f : p[i];
+        uint32_t k;
+        memcpy(&k, &v, sizeof(k));
+        h = (h ^ k) * 0x01000193;
     }
+    return h ^ (h >> 16);
 }
 
+// maps every vertex to the first vertex at the same position.
+// positions are hashed into a grid of about one slot per vertex, so each vertex only compares against the vertices
+// that share its slot instead of all the preceding ones.
 inline void BuildWeldMap(
     MeshConnectionInfo& connection, const IArray<float3>& vertices)
 {
     auto& weld_map = connection.weld_map;
-    auto& weld_counts = connection.weld_counts;
-    auto& weld_offsets = connection.weld_offsets;
-    auto& weld_indices = connection.weld_indices;
 
     int n = (int)vertices.size();
+    int num_slots = 1;
+    while (num_slots < n)
+        num_slots *= 2;
+    const uint32_t slot_mask = (uint32_t)num_slots - 1;
+
+    RawVector<int> slots;
+    slots.resize_discard(n);
+    parallel_for_blocked(0, n, 16384, [&](int begin, int end) {
+        for (int vi = begin; vi < end; ++vi)
+            slots[vi] = (int)(HashPosition(vertices[vi]) & slot_mask);
+    });
+
+    RawVector<int> slot_counts, slot_offsets, slot_vertices;
+    BucketSort(slot_counts, slot_offsets, slot_vertices, n, num_slots, [&](int vi) { return slots[vi]; });
+
+    // slots list their vertices in ascending order, so the first match is the lowest index
     weld_map.resize_discard(n);
-    weld_counts.resize_discard(n);
-    weld_offsets.resize_discard(n);
-    weld_indices.resize_discard(n);
-
-    parallel_for(0, n, [&](int vi) {
-        int r = vi;
-        float3 p = vertices[vi];
-        for (int i = 0; i < vi; ++i) {
-            if (vertices[i] == p) {
-                r = i;
-                break;
+    parallel_for_blocked(0, n, 16384, [&](int begin, int end) {
+        for (int vi = begin; vi < end; ++vi) {
+            int r = vi;
+            float3 p = vertices[vi];
+            const int slot = slots[vi];
+            const int *candidates = &slot_vertices[slot_offsets[slot]];
+            for (int i = 0, c = slot_counts[slot]; i < c && candidates[i] < vi; ++i) {
+                if (vertices[candidates[i]] == p) {
+                    r = candidates[i];
+                    break;
+                }
             }
+            weld_map[vi] = r;
         }
-        weld_map[vi] = r;
     });
 
-    weld_counts.zeroclear();
-    for (int vi : weld_map) {
-        weld_counts[vi]++;
-    }
-
-    int offset = 0;
-    for (int vi = 0; vi < n; ++vi) {
-        weld_offsets[vi] = offset;
-        offset += weld_counts[vi];
-    }
-
-    weld_counts.zeroclear();
-    for (int vi = 0; vi < n; ++vi) {
-        int mvi = weld_map[vi];
-        int i = weld_offsets[mvi] + weld_counts[mvi]++;
-        weld_indices[i] = vi;
-    }
+    BucketSort(connection.weld_counts, connection.weld_offsets, connection.weld_indices, n, n,
+        [&](int vi) { return weld_map[vi]; });
 }
 
 template<class Indices, class Counts, class Offsets>
@@ -316,7 +411,13 @@ inline void SelectEdge(const IArray<int>& indices, const IArray<int>& counts, co
 {
     MeshConnectionInfo connection;
     impl::BuildConnection(connection, indices, counts, vertices);
+    SelectEdge(indices, counts, offsets, vertices, connection, vertex_indices, handler);
+}
 
+template<class Handler>
+inline void SelectEdge(const IArray<int>& indices, const IArray<int>& counts, const IArray<int>& offsets, const IArray<float3>& vertices,
+    const MeshConnectionInfo& connection, const IArray<int>& vertex_indices, const Handler& handler)
+{
     impl::SelectEdgeImpl<decltype(indices), decltype(counts), decltype(offsets)>
         impl(indices, counts, offsets, vertices, connection);
 
@@ -348,15 +449,20 @@ inline void SelectHole(const IArray<int>& indices_, int ngon, const IArray<float
 }
 
 template<class Handler>
-inline void SelectHole(const IArray<int>& indices_, const IArray<int>& counts, const IArray<int>& offsets, const IArray<float3>& vertices,
+inline void SelectHole(const IArray<int>& indices, const IArray<int>& counts, const IArray<int>& offsets, const IArray<float3>& vertices,
     const IArray<int>& vertex_indices, const Handler& handler)
 {
     MeshConnectionInfo connection;
-    impl::BuildWeldMap(connection, vertices);
+    connection.buildConnection(indices, counts, vertices, true);
+    SelectHole(indices, counts, offsets, vertices, connection, vertex_indices, handler);
+}
 
+// connection must be built with welding
+template<class Handler>
+inline void SelectHole(const IArray<int>& indices_, const IArray<int>& counts, const IArray<int>& offsets, const IArray<float3>& vertices,
+    const MeshConnectionInfo& connection, const IArray<int>& vertex_indices, const Handler& handler)
+{
     impl::IndicesW indices{ indices_, connection.weld_map };
-    impl::BuildConnection(connection, indices, counts, vertices);
-
     impl::SelectEdgeImpl<decltype(indices), decltype(counts), decltype(offsets)>
         impl(indices, counts, offsets, vertices, connection);
 
@@ -390,7 +496,13 @@ inline void SelectConnected(const IArray<int>& indices, const IArray<int>& count
 {
     MeshConnectionInfo connection;
     impl::BuildConnection(connection, indices, counts, vertices);
+    SelectConnected(indices, counts, offsets, vertices, connection, vertex_indices, handler);
+}
 
+template<class Handler>
+inline void SelectConnected(const IArray<int>& indices, const IArray<int>& counts, const IArray<int>& offsets, const IArray<float3>& vertices,
+    const MeshConnectionInfo& connection, const IArray<int>& vertex_indices, const Handler& handler)
+{
     impl::SelectEdgeImpl<decltype(indices), decltype(counts), decltype(offsets)>
         impl(indices, counts, offsets, vertices, connection);
 
@@ -418,7 +530,7 @@ void GenerateNormalsPoly(float3 *dst,
         }
 
         const int *face = &indices[offsets[fi]];
-        int num_triangles = (fi - 2) * 3;
+        int num_triangles = count - 2;
         for (int ti = 0; ti < num_triangles; ++ti) {
             int tidx[3] = { 0, ti + 1, ti + 2 };
             float3 p0 = face_vertices[tidx[0]];
@@ -458,7 +570,7 @@ void GenerateTangentsPoly(float4 *dst,
         }
 
         const int *face = &indices[offsets[fi]];
-        int num_triangles = (fi - 2) * 3;
+        int num_triangles = count - 2;
         for (int ti = 0; ti < num_triangles; ++ti) {
             int tidx[3] = { 0, ti + 1, ti + 2 };
             float3 v[3] = { face_vertices[tidx[0]], face_vertices[tidx[1]], face_vertices[tidx[2]] };
@@ -468,8 +580,8 @@ void GenerateTangentsPoly(float4 *dst,
             compute_triangle_tangent(v, u, t, b);
 
             for (int i = 0; i < 3; ++i) {
-                tangents[face[tidx[i]]] += t[tidx[i]];
-                binormals[face[tidx[i]]] += b[tidx[i]];
+                tangents[face[tidx[i]]] += t[i];
+                binormals[face[tidx[i]]] += b[i];
             }
         }
     }
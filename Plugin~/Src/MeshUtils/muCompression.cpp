@@ -14,43 +14,79 @@ static_assert(sizeof(quat32) == 4, "");
 static_assert(sizeof(snormx3_32) == 4, "");
 
 
-template<class DstType, class SrcType>
-static inline void convert(RawVector<DstType>& dst, const RawVector<SrcType>& src)
+// fast paths for normalized types. (U16ToF32() etc. are ISPC kernels if available)
+// dst and src are treated as flat scalar arrays.
+template<class PackedType, class PlainType>
+struct NormDecoder
+{
+    static bool decode(PlainType * /*dst*/, const PackedType * /*src*/, size_t /*num*/) { return false; }
+};
+#define DefNormDecoder(Packed, Plain, Scalar, Kernel, Dim)\
+    template<> struct NormDecoder<Packed, Plain> {\
+        static bool decode(Plain *dst, const Packed *src, size_t num) { Kernel((float*)dst, (const Scalar*)src, num * Dim); return true; }\
+    };
+DefNormDecoder(snorm8, float, snorm8, S8ToF32, 1)
+DefNormDecoder(snorm8x2, float2, snorm8, S8ToF32, 2)
+DefNormDecoder(unorm8, float, unorm8, U8ToF32, 1)
+DefNormDecoder(unorm8x2, float2, unorm8, U8ToF32, 2)
+DefNormDecoder(unorm8x3, float3, unorm8, U8ToF32, 3)
+DefNormDecoder(unorm8x4, float4, unorm8, U8ToF32, 4)
+DefNormDecoder(snorm16x2, float2, snorm16, S16ToF32, 2)
+DefNormDecoder(snorm16x3, float3, snorm16, S16ToF32, 3)
+DefNormDecoder(snorm16x4, float4, snorm16, S16ToF32, 4)
+DefNormDecoder(unorm16, float, unorm16, U16ToF32, 1)
+DefNormDecoder(unorm16x2, float2, unorm16, U16ToF32, 2)
+DefNormDecoder(unorm16x3, float3, unorm16, U16ToF32, 3)
+DefNormDecoder(unorm16x4, float4, unorm16, U16ToF32, 4)
+#undef DefNormDecoder
+
+
+template<class PackedType, class PlainType>
+void encode(PackedArray<PackedType>& dst, const PlainType *src, size_t num)
 {
-    enumerate(dst, src, [](auto& d, const auto& s) { d = to<DstType>(s); });
+    dst.packed.resize_discard(num);
+    auto *d = dst.packed.data();
+    for (size_t i = 0; i < num; ++i)
+        d[i] = to<PackedType>(src[i]);
 }
 
 template<class PackedType, class PlainType>
-void encode(PackedArray<PackedType>& dst, const RawVector<PlainType>& src)
+void decode(PlainType *dst, const PackedArray<PackedType>& src)
 {
-    dst.packed.resize_discard(src.size());
-    if (dst.packed.empty())
+    size_t num = src.packed.size();
+    auto *s = src.packed.cdata();
+    if (num == 0 || NormDecoder<PackedType, PlainType>::decode(dst, s, num))
         return;
+    for (size_t i = 0; i < num; ++i)
+        dst[i] = to<PlainType>(s[i]);
+}
 
-    convert(dst.packed, src);
+template<class PackedType, class PlainType>
+void encode(PackedArray<PackedType>& dst, const RawVector<PlainType>& src)
+{
+    encode(dst, src.cdata(), src.size());
 }
 
 template<class PackedType, class PlainType>
 void decode(RawVector<PlainType>& dst, const PackedArray<PackedType>& src)
 {
     dst.resize_discard(src.packed.size());
-    if (src.packed.empty())
-        return;
-
-    convert(dst, src.packed);
+    decode(dst.data(), src);
 }
 
-template void encode(PackedArray<snorm8>& src, const RawVector<float>& dst);
-template void encode(PackedArray<snorm8x2>& src, const RawVector<float2>& dst);
-template void encode(PackedArray<snorm16x3>& src, const RawVector<float3>& dst);
-template void encode(PackedArray<snormx3_32>& src, const RawVector<float3>& dst);
-template void encode(PackedArray<snormx3_32>& src, const RawVector<float4>& dst);
-
-template void decode(RawVector<float>& dst, const PackedArray<snorm8>& src);
-template void decode(RawVector<float2>& dst, const PackedArray<snorm8x2>& src);
-template void decode(RawVector<float3>& dst, const PackedArray<snorm16x3>& src);
-template void decode(RawVector<float3>& dst, const PackedArray<snormx3_32>& src);
-template void decode(RawVector<float4>& dst, const PackedArray<snormx3_32>& src);
+#define Instantiate(Packed, Plain)\
+    template void encode(PackedArray<Packed>& dst, const RawVector<Plain>& src);\
+    template void decode(RawVector<Plain>& dst, const PackedArray<Packed>& src);\
+    template void encode(PackedArray<Packed>& dst, const Plain *src, size_t num);\
+    template void decode(Plain *dst, const PackedArray<Packed>& src);
+Instantiate(snorm8, float)
+Instantiate(snorm8x2, float2)
+Instantiate(snorm16x2, float2)
+Instantiate(snorm16x3, float3)
+Instantiate(snorm16x4, float4)
+Instantiate(snormx3_32, float3)
+Instantiate(snormx3_32, float4)
+#undef Instantiate
 
 
 template<class T> static void zeroclear(T& v) { v = T::zero(); }
@@ -64,101 +100,166 @@ struct EncodeImpl;
 template<class PackedType, class PlainType>
 struct EncodeImpl<PackedType, PlainType, true>
 {
-    static inline void encode(BoundedArray<PackedType, PlainType>& dst, const RawVector<PlainType>& src)
+    static inline void encode(BoundedArray<PackedType, PlainType>& dst, const PlainType *src, size_t num)
     {
         zeroclear(dst.bound_min);
         zeroclear(dst.bound_max);
-        dst.packed.resize_discard(src.size());
-        if (dst.packed.empty())
+        dst.packed.resize_discard(num);
+        if (num == 0)
             return;
 
-        MinMax(src.data(), src.size(), dst.bound_min, dst.bound_max);
+        MinMax(src, num, dst.bound_min, dst.bound_max);
 
+        // flat axes have zero extent. clamp it to avoid inf * 0.
+        using scalar_t = get_scalar_type<PlainType>;
         auto bmin = dst.bound_min;
-        auto rsize = rcp(dst.bound_max - dst.bound_min);
-        enumerate(dst.packed, src, [bmin, rsize](auto& d, const auto& s) {
-            d = to<PackedType>((s - bmin) * rsize);
-        });
+        auto rsize = rcp(max(dst.bound_max - dst.bound_min, std::numeric_limits<scalar_t>::min()));
+        auto *d = dst.packed.data();
+        for (size_t i = 0; i < num; ++i)
+            d[i] = to<PackedType>((src[i] - bmin) * rsize);
     }
 
-    static inline void decode(RawVector<PlainType>& dst, const BoundedArray<PackedType, PlainType>& src)
+    static inline void decode(PlainType *dst, const BoundedArray<PackedType, PlainType>& src)
     {
-        dst.resize_discard(src.packed.size());
-        if (src.packed.empty())
+        size_t num = src.packed.size();
+        if (num == 0)
             return;
 
         auto bmin = src.bound_min;
         auto size = (src.bound_max - src.bound_min);
-        enumerate(dst, src.packed, [bmin, size](auto& d, const auto& s) {
-            d = to<PlainType>(s) * size + bmin;
-        });
+        auto *s = src.packed.cdata();
+        if (NormDecoder<PackedType, PlainType>::decode(dst, s, num)) {
+            for (size_t i = 0; i < num; ++i)
+                dst[i] = dst[i] * size + bmin;
+        }
+        else {
+            for (size_t i = 0; i < num; ++i)
+                dst[i] = to<PlainType>(s[i]) * size + bmin;
+        }
     }
 };
 
 template<class PackedType, class PlainType>
 struct EncodeImpl<PackedType, PlainType, false>
 {
-    static inline void encode(BoundedArray<PackedType, PlainType>& dst, const RawVector<PlainType>& src)
+    static inline void encode(BoundedArray<PackedType, PlainType>& dst, const PlainType *src, size_t num)
     {
         zeroclear(dst.bound_min);
         zeroclear(dst.bound_max);
-        dst.packed.resize_discard(src.size());
-        if (dst.packed.empty())
+        dst.packed.resize_discard(num);
+        if (num == 0)
             return;
 
-        MinMax(src.data(), src.size(), dst.bound_min, dst.bound_max);
+        MinMax(src, num, dst.bound_min, dst.bound_max);
 
         auto bmin = dst.bound_min;
-        enumerate(dst.packed, src, [bmin](auto& d, const auto& s) {
-            d = (PackedType)(s - bmin);
-        });
+        auto *d = dst.packed.data();
+        for (size_t i = 0; i < num; ++i)
+            d[i] = (PackedType)(src[i] - bmin);
     }
 
-    static inline void decode(RawVector<PlainType>& dst, const BoundedArray<PackedType, PlainType>& src)
+    static inline void decode(PlainType *dst, const BoundedArray<PackedType, PlainType>& src)
     {
-        dst.resize_discard(src.packed.size());
-        if (src.packed.empty())
-            return;
-
+        size_t num = src.packed.size();
         auto bmin = src.bound_min;
-        enumerate(dst, src.packed, [bmin](auto& d, const auto& s) {
-            d = (PlainType)(s) + bmin;
-        });
+        auto *s = src.packed.cdata();
+        for (size_t i = 0; i < num; ++i)
+            dst[i] = (PlainType)(s[i]) + bmin;
     }
 };
 
 template<class PackedType, class PlainType>
-inline void encode(BoundedArray<PackedType, PlainType>& dst, const RawVector<PlainType>& src)
+void encode(BoundedArray<PackedType, PlainType>& dst, const PlainType *src, size_t num)
 {
-    EncodeImpl<PackedType, PlainType>::encode(dst, src);
+    EncodeImpl<PackedType, PlainType>::encode(dst, src, num);
 }
 
 template<class PackedType, class PlainType>
-inline void decode(RawVector<PlainType>& dst, const BoundedArray<PackedType, PlainType>& src)
+void decode(PlainType *dst, const BoundedArray<PackedType, PlainType>& src)
 {
     EncodeImpl<PackedType, PlainType>::decode(dst, src);
 }
 
-template void encode(BoundedArray<uint8_t, int>& dst, const RawVector<int>& src);
-template void encode(BoundedArray<uint16_t, int>& dst, const RawVector<int>& src);
-template void encode(BoundedArray<unorm8, float>& dst, const RawVector<float>& src);
-template void encode(BoundedArray<unorm16, float>& dst, const RawVector<float>& src);
-template void encode(BoundedArray<unorm8x2, float2>& dst, const RawVector<float2>& src);
-template void encode(BoundedArray<unorm16x2, float2>& dst, const RawVector<float2>& src);
-template void encode(BoundedArray<unorm8x3, float3>& dst, const RawVector<float3>& src);
-template void encode(BoundedArray<unorm16x3, float3>& dst, const RawVector<float3>& src);
-template void encode(BoundedArray<unorm8x4, float4>& dst, const RawVector<float4>& src);
-template void encode(BoundedArray<unorm16x4, float4>& dst, const RawVector<float4>& src);
-
-template void decode(RawVector<int>& dst, const BoundedArray<uint8_t, int>& src);
-template void decode(RawVector<int>& dst, const BoundedArray<uint16_t, int>& src);
-template void decode(RawVector<float>& dst, const BoundedArray<unorm8, float>& src);
-template void decode(RawVector<float>& dst, const BoundedArray<unorm16, float>& src);
-template void decode(RawVector<float2>& dst, const BoundedArray<unorm8x2, float2>& src);
-template void decode(RawVector<float2>& dst, const BoundedArray<unorm16x2, float2>& src);
-template void decode(RawVector<float3>& dst, const BoundedArray<unorm8x3, float3>& src);
-template void decode(RawVector<float3>& dst, const BoundedArray<unorm16x3, float3>& src);
-template void decode(RawVector<float4>& dst, const BoundedArray<unorm8x4, float4>& src);
-template void decode(RawVector<float4>& dst, const BoundedArray<unorm16x4, float4>& src);
+template<class PackedType, class PlainType>
+void encode(BoundedArray<PackedType, PlainType>& dst, const RawVector<PlainType>& src)
+{
+    EncodeImpl<PackedType, PlainType>::encode(dst, src.cdata(), src.size());
+}
+
+template<class PackedType, class PlainType>
+void decode(RawVector<PlainType>& dst, const BoundedArray<PackedType, PlainType>& src)
+{
+    dst.resize_discard(src.packed.size());
+    EncodeImpl<PackedType, PlainType>::decode(dst.data(), src);
+}
+
+#define Instantiate(Packed, Plain)\
+    template void encode(BoundedArray<Packed, Plain>& dst, const RawVector<Plain>& src);\
+    template void decode(RawVector<Plain>& dst, const BoundedArray<Packed, Plain>& src);\
+    template void encode(BoundedArray<Packed, Plain>& dst, const Plain *src, size_t num);\
+    template void decode(Plain *dst, const BoundedArray<Packed, Plain>& src);
+Instantiate(uint8_t, int)
+Instantiate(uint16_t, int)
+Instantiate(unorm8, float)
+Instantiate(unorm16, float)
+Instantiate(unorm8x2, float2)
+Instantiate(unorm16x2, float2)
+Instantiate(unorm8x3, float3)
+Instantiate(unorm16x3, float3)
+Instantiate(unorm8x4, float4)
+Instantiate(unorm16x4, float4)
+#undef Instantiate
+
+
+// transpose 8x8 bit matrix. byte i of the result holds bit i of each input byte.
+static inline uint64_t Transpose8x8(uint64_t x)
+{
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAull;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCull;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ull;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+void BitShuffle32(uint8_t *dst, const uint32_t *src, size_t num)
+{
+    const size_t num_groups = num / 8;
+    for (size_t g = 0; g < num_groups; ++g) {
+        const uint32_t *words = src + g * 8;
+        for (int k = 0; k < 4; ++k) {
+            uint64_t x = 0;
+            for (int j = 0; j < 8; ++j)
+                x |= (uint64_t)((words[j] >> (k * 8)) & 0xff) << (j * 8);
+            x = Transpose8x8(x);
+            for (int b = 0; b < 8; ++b)
+                dst[(k * 8 + b) * num_groups + g] = (uint8_t)(x >> (b * 8));
+        }
+    }
+    const size_t tail = num_groups * 8;
+    memcpy(dst + tail * 4, src + tail, (num - tail) * 4);
+}
+
+void BitUnshuffle32(uint32_t *dst, const uint8_t *src, size_t num)
+{
+    const size_t num_groups = num / 8;
+    for (size_t g = 0; g < num_groups; ++g) {
+        uint32_t *words = dst + g * 8;
+        for (int j = 0; j < 8; ++j)
+            words[j] = 0;
+        for (int k = 0; k < 4; ++k) {
+            uint64_t x = 0;
+            for (int b = 0; b < 8; ++b)
+                x |= (uint64_t)src[(k * 8 + b) * num_groups + g] << (b * 8);
+            x = Transpose8x8(x);
+            for (int j = 0; j < 8; ++j)
+                words[j] |= (uint32_t)((x >> (j * 8)) & 0xff) << (k * 8);
+        }
+    }
+    const size_t tail = num_groups * 8;
+    memcpy(dst + tail, src + tail * 4, (num - tail) * 4);
+}
 
 } // namespace mu
\ No newline at end of file
@@ -15,10 +15,15 @@ struct PackedArray
 };
 template<class PackedType, class PlainType> void encode(PackedArray<PackedType>& dst, const RawVector<PlainType>& src);
 template<class PackedType, class PlainType> void decode(RawVector<PlainType>& dst, const PackedArray<PackedType>& src);
+// pointer versions. decode() writes src.packed.size() elements to dst.
+template<class PackedType, class PlainType> void encode(PackedArray<PackedType>& dst, const PlainType *src, size_t num);
+template<class PackedType, class PlainType> void decode(PlainType *dst, const PackedArray<PackedType>& src);
 
 using PackedArrayS8    = PackedArray<snorm8>;
 using PackedArrayS8x2  = PackedArray<snorm8x2>;
+using PackedArrayS16x2 = PackedArray<snorm16x2>;
 using PackedArrayS16x3 = PackedArray<snorm16x3>;
+using PackedArrayS16x4 = PackedArray<snorm16x4>;
 using PackedArrayS3_32 = PackedArray<snormx3_32>;
 
 
@@ -33,6 +38,8 @@ struct BoundedArray
 };
 template<class PackedType, class PlainType> void encode(BoundedArray<PackedType, PlainType>& dst, const RawVector<PlainType>& src);
 template<class PackedType, class PlainType> void decode(RawVector<PlainType>& dst, const BoundedArray<PackedType, PlainType>& src);
+template<class PackedType, class PlainType> void encode(BoundedArray<PackedType, PlainType>& dst, const PlainType *src, size_t num);
+template<class PackedType, class PlainType> void decode(PlainType *dst, const BoundedArray<PackedType, PlainType>& src);
 
 using BoundedArrayU8I   = BoundedArray<uint8_t, int>;
 using BoundedArrayU16I  = BoundedArray<uint16_t, int>;
@@ -45,4 +52,11 @@ using BoundedArrayU16x3 = BoundedArray<unorm16x3, float3>;
 using BoundedArrayU8x4  = BoundedArray<unorm8x4, float4>;
 using BoundedArrayU16x4 = BoundedArray<unorm16x4, float4>;
 
+
+// bit-plane transpose of 32 bit words. bit b of every word goes to plane b, which makes runs of zero bits
+// (e.g. xor-ed floats that differ only in low mantissa bits) compressible by byte oriented coders.
+// dst must have num * 4 bytes. words that don't fill a group of 8 are stored as-is at the end.
+void BitShuffle32(uint8_t *dst, const uint32_t *src, size_t num);
+void BitUnshuffle32(uint32_t *dst, const uint8_t *src, size_t num);
+
 } // namespace mu
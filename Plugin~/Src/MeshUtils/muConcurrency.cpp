@@ -0,0 +1,270 @@
+#include "pch.h"
+#include "muConcurrency.h"
+#include <deque>
+#include <exception>
+
+#ifdef muEnableThreadPool
+namespace mu {
+
+// index of the worker running on the current thread. -1 if it is not a worker.
+static thread_local int g_worker_index = -1;
+
+struct thread_pool::job
+{
+    const std::function<void(int)> *body = nullptr;
+    int num_tasks = 0;
+    std::atomic_int next{ 0 };
+    std::atomic_int num_done{ 0 };
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::exception_ptr exception;
+
+    // grab remaining indices until there are none left.
+    // helpers that get popped after the job has completed return immediately without touching body.
+    void execute()
+    {
+        for (;;) {
+            int i = next++;
+            if (i >= num_tasks)
+                break;
+            try {
+                (*body)(i);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!exception)
+                    exception = std::current_exception();
+            }
+            if (++num_done == num_tasks) {
+                std::lock_guard<std::mutex> lock(mutex);
+                cond.notify_all();
+            }
+        }
+    }
+
+    bool done() const { return num_done == num_tasks; }
+};
+
+struct thread_pool::queue
+{
+    std::mutex mutex;
+    std::deque<job_ptr> jobs;
+};
+
+
+thread_pool& thread_pool::instance()
+{
+    static thread_pool s_instance;
+    return s_instance;
+}
+
+thread_pool::thread_pool()
+{
+    start(-1);
+}
+
+thread_pool::~thread_pool()
+{
+    stop();
+}
+
+void thread_pool::set_num_workers(int n)
+{
+    stop();
+    start(n);
+}
+
+int thread_pool::get_num_workers() const
+{
+    return (int)m_workers.size();
+}
+
+void thread_pool::start(int num_workers)
+{
+    if (num_workers < 0)
+        num_workers = std::max<int>((int)std::thread::hardware_concurrency() - 1, 0);
+
+    m_stop = false;
+    m_num_queued = 0;
+    for (int i = 0; i < num_workers + 1; ++i)
+        m_queues.emplace_back(new queue());
+    for (int i = 0; i < num_workers; ++i)
+        m_workers.emplace_back([this, i]() { worker_main(i); });
+}
+
+void thread_pool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    for (auto& t : m_workers)
+        t.join();
+    m_workers.clear();
+    m_queues.clear();
+}
+
+void thread_pool::run(int num_tasks, const std::function<void(int)>& body)
+{
+    if (num_tasks <= 0)
+        return;
+    if (m_workers.empty() || num_tasks == 1) {
+        for (int i = 0; i < num_tasks; ++i)
+            body(i);
+        return;
+    }
+
+    auto j = std::make_shared<job>();
+    j->body = &body;
+    j->num_tasks = num_tasks;
+    push(j, std::min<int>(num_tasks - 1, (int)m_workers.size()));
+    j->execute();
+
+    // all indices are claimed at this point. while the rest of them are running elsewhere,
+    // help with other queued work (nested parallel_* calls typically) instead of just blocking.
+    while (!j->done()) {
+        if (run_one())
+            continue;
+        std::unique_lock<std::mutex> lock(j->mutex);
+        j->cond.wait_for(lock, std::chrono::milliseconds(1), [&j]() { return j->done(); });
+    }
+    if (j->exception)
+        std::rethrow_exception(j->exception);
+}
+
+void thread_pool::push(const job_ptr& j, int count)
+{
+    if (count <= 0)
+        return;
+
+    queue& q = g_worker_index >= 0 ? *m_queues[g_worker_index] : *m_queues.back();
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        for (int i = 0; i < count; ++i)
+            q.jobs.push_back(j);
+    }
+    m_num_queued += count;
+
+    // workers check m_num_queued under m_mutex. taking it here guarantees the notification is not lost.
+    { std::lock_guard<std::mutex> lock(m_mutex); }
+    if (count == 1)
+        m_cond.notify_one();
+    else
+        m_cond.notify_all();
+}
+
+// take the newest job from the queue of the current thread
+bool thread_pool::pop(job_ptr& dst)
+{
+    queue& q = g_worker_index >= 0 ? *m_queues[g_worker_index] : *m_queues.back();
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.jobs.empty())
+        return false;
+    dst = std::move(q.jobs.back());
+    q.jobs.pop_back();
+    --m_num_queued;
+    return true;
+}
+
+// take the oldest job from other queues
+bool thread_pool::steal(job_ptr& dst)
+{
+    int num_queues = (int)m_queues.size();
+    int self = g_worker_index >= 0 ? g_worker_index : num_queues - 1;
+    for (int i = 1; i < num_queues; ++i) {
+        queue& q = *m_queues[(self + i) % num_queues];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.jobs.empty())
+            continue;
+        dst = std::move(q.jobs.front());
+        q.jobs.pop_front();
+        --m_num_queued;
+        return true;
+    }
+    return false;
+}
+
+bool thread_pool::run_one()
+{
+    job_ptr j;
+    if (pop(j) || steal(j)) {
+        j->execute();
+        return true;
+    }
+    return false;
+}
+
+void thread_pool::worker_main(int index)
+{
+    g_worker_index = index;
+    for (;;) {
+        if (run_one())
+            continue;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this]() { return m_stop || m_num_queued > 0; });
+        if (m_stop)
+            break;
+    }
+    g_worker_index = -1;
+}
+
+} // namespace mu
+#endif // muEnableThreadPool
+
+namespace mu {
+
+task_queue::task_queue(int num_threads)
+{
+    if (num_threads <= 0)
+        num_threads = std::max<int>(std::thread::hardware_concurrency(), 1);
+    for (int i = 0; i < num_threads; ++i)
+        m_threads.emplace_back([this]() { thread_main(); });
+}
+
+task_queue::~task_queue()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    for (auto& t : m_threads)
+        t.join();
+}
+
+std::future<void> task_queue::push(std::function<void()>&& task)
+{
+    std::packaged_task<void()> pt(std::move(task));
+    auto ret = pt.get_future();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(pt));
+    }
+    m_cond.notify_one();
+    return ret;
+}
+
+int task_queue::get_num_threads() const
+{
+    return (int)m_threads.size();
+}
+
+void task_queue::thread_main()
+{
+    for (;;) {
+        std::packaged_task<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+            if (m_tasks.empty())
+                return; // stopped and drained
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task(); // exceptions are stored in the future
+    }
+}
+
+} // namespace mu
@@ -2,14 +2,87 @@
 
 #include "muConfig.h"
 #include <atomic>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #if defined(muEnablePPL)
     #include <ppl.h>
 #elif defined(muEnableTBB)
     #include <tbb/tbb.h>
+#else
+    #define muEnableThreadPool
 #endif
 
 namespace mu {
 
+#ifdef muEnableThreadPool
+// Built-in work-stealing thread pool. Used as the parallel_* backend when neither PPL nor TBB is enabled.
+// The calling thread always takes part in the work, so nested parallel_* calls from inside a task are fine.
+class thread_pool
+{
+public:
+    static thread_pool& instance();
+
+    // n < 0: std::thread::hardware_concurrency() - 1 workers. 0: everything runs serially on the calling thread.
+    // must not be called while parallel work is in flight.
+    void set_num_workers(int n);
+    int get_num_workers() const;
+
+    // calls body(i) for i in [0, num_tasks) and returns when all of them have completed.
+    void run(int num_tasks, const std::function<void(int)>& body);
+
+private:
+    struct job;
+    struct queue;
+    using job_ptr = std::shared_ptr<job>;
+
+    thread_pool();
+    ~thread_pool();
+    void start(int num_workers);
+    void stop();
+    void push(const job_ptr& j, int count);
+    bool pop(job_ptr& dst);
+    bool steal(job_ptr& dst);
+    bool run_one();
+    void worker_main(int index);
+
+    std::vector<std::thread> m_workers;
+    std::vector<std::unique_ptr<queue>> m_queues; // [0, num_workers): per worker, [num_workers]: external threads
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::atomic_int m_num_queued{ 0 };
+    bool m_stop = false;
+};
+
+// splits [0, num_elements) into blocks of at least granularity elements, a few blocks per thread.
+inline int calc_num_blocks(int num_elements, int granularity)
+{
+    int num_threads = thread_pool::instance().get_num_workers() + 1;
+    granularity = std::max<int>(granularity, 1);
+    int num_blocks = std::min<int>((num_elements + granularity - 1) / granularity, num_threads * 4);
+    return std::max<int>(num_blocks, 1);
+}
+#endif
+
+// number of threads parallel_* bodies can run on, including the calling thread
+inline int get_num_threads()
+{
+#if defined(muEnablePPL)
+    return (int)concurrency::GetProcessorCount();
+#elif defined(muEnableTBB)
+    return tbb::this_task_arena::max_concurrency();
+#else
+    return thread_pool::instance().get_num_workers() + 1;
+#endif
+}
+
 template<class Index, class Body>
 inline void parallel_for(Index begin, Index end, const Body& body)
 {
@@ -18,7 +91,15 @@ inline void parallel_for(Index begin, Index end, const Body& body)
 #elif defined(muEnableTBB)
     tbb::parallel_for(begin, end, body);
 #else
-    for (; begin != end; ++begin) { body(begin); }
+    int num_elements = (int)(end - begin);
+    if (num_elements <= 0)
+        return;
+    int num_blocks = calc_num_blocks(num_elements, 1);
+    thread_pool::instance().run(num_blocks, [&](int bi) {
+        Index b = begin + (Index)((int64_t)num_elements * bi / num_blocks);
+        Index e = begin + (Index)((int64_t)num_elements * (bi + 1) / num_blocks);
+        for (; b != e; ++b) { body(b); }
+    });
 #endif
 }
 
@@ -38,15 +119,34 @@ inline void parallel_for(int begin, int end, int granularity, const Body& body)
 }
 #else
 template<class Body>
-inline void parallel_for(int begin, int end, int /*granularity*/, const Body& body)
+inline void parallel_for(int begin, int end, int granularity, const Body& body)
 {
-    for (; begin != end; ++begin) { body(begin); }
+    int num_elements = end - begin;
+    if (num_elements <= 0)
+        return;
+    int num_blocks = calc_num_blocks(num_elements, granularity);
+    thread_pool::instance().run(num_blocks, [&](int bi) {
+        int b = begin + (int)((int64_t)num_elements * bi / num_blocks);
+        int e = begin + (int)((int64_t)num_elements * (bi + 1) / num_blocks);
+        for (; b != e; ++b) { body(b); }
+    });
 }
 #endif
 
 template<class Body>
 inline void parallel_for_blocked(int begin, int end, int granularity, const Body& body)
 {
+#ifdef muEnableThreadPool
+    int num_elements = end - begin;
+    if (num_elements <= 0)
+        return;
+    int num_blocks = calc_num_blocks(num_elements, granularity);
+    thread_pool::instance().run(num_blocks, [&](int bi) {
+        int b = begin + (int)((int64_t)num_elements * bi / num_blocks);
+        int e = begin + (int)((int64_t)num_elements * (bi + 1) / num_blocks);
+        body(b, e);
+    });
+#else
     int num_elements = end - begin;
     int num_blocks = ceildiv(num_elements, granularity);
     parallel_for(0, num_blocks, [&](int i) {
@@ -54,6 +154,7 @@ inline void parallel_for_blocked(int begin, int end, int granularity, const Body
         int end = std::min<int>(granularity * (i + 1), num_elements);
         body(begin, end);
     });
+#endif
 }
 
 template<class Iter, class Body>
@@ -64,7 +165,21 @@ inline void parallel_for_each(Iter begin, Iter end, const Body& body)
 #elif defined(muEnableTBB)
     tbb::parallel_for_each(begin, end, body);
 #else
-    for (; begin != end; ++begin) { body(*begin); }
+    int num_elements = (int)std::distance(begin, end);
+    if (num_elements <= 0)
+        return;
+    // find where each block starts in one pass. advancing from begin in every task would be O(n^2) on lists
+    int num_blocks = calc_num_blocks(num_elements, 1);
+    std::vector<Iter> block_begins(num_blocks + 1);
+    block_begins[0] = begin;
+    for (int bi = 0; bi < num_blocks; ++bi) {
+        Iter it = block_begins[bi];
+        std::advance(it, (int)((int64_t)num_elements * (bi + 1) / num_blocks - (int64_t)num_elements * bi / num_blocks));
+        block_begins[bi + 1] = it;
+    }
+    thread_pool::instance().run(num_blocks, [&](int bi) {
+        for (Iter it = block_begins[bi]; it != block_begins[bi + 1]; ++it) { body(*it); }
+    });
 #endif
 }
 
@@ -81,13 +196,11 @@ inline void parallel_invoke(Bodies... bodies) { tbb::parallel_invoke(bodies...);
 
 #else
 
-template <class Body>
-inline void parallel_invoke(const Body& body) { body(); }
-
-template<typename Body, typename... Args>
-void parallel_invoke(const Body& first, Args... args) {
-    first();
-    parallel_invoke(args...);
+template <class... Bodies>
+inline void parallel_invoke(Bodies... bodies)
+{
+    const std::function<void()> tasks[] = { bodies... };
+    thread_pool::instance().run((int)sizeof...(Bodies), [&](int i) { tasks[i](); });
 }
 
 #endif
@@ -128,5 +241,100 @@ private:
     std::atomic_flag lck = ATOMIC_FLAG_INIT;
 };
 
-} // namespace ms
+// lock-free multi-producer single-consumer queue.
+// producers push onto an intrusive stack with a CAS. the consumer takes the whole stack at once and reverses it,
+// so each element is touched a constant number of times.
+template<class T>
+class mpsc_queue
+{
+public:
+    mpsc_queue() {}
+    mpsc_queue(const mpsc_queue&) = delete;
+    mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+    ~mpsc_queue()
+    {
+        release(m_head.exchange(nullptr));
+    }
+
+    // any thread
+    void push(T&& v)
+    {
+        node *n = new node{ std::move(v), m_head.load(std::memory_order_relaxed) };
+        while (!m_head.compare_exchange_weak(n->next, n, std::memory_order_release, std::memory_order_relaxed)) {}
+    }
+
+    bool empty() const
+    {
+        return m_head.load(std::memory_order_acquire) == nullptr;
+    }
+
+    // consumer thread only. appends all queued elements to dst in the order they were pushed
+    template<class Container>
+    size_t pop_all(Container& dst)
+    {
+        node *n = m_head.exchange(nullptr, std::memory_order_acquire);
+
+        // reverse to restore push order
+        node *prev = nullptr;
+        while (n) {
+            node *next = n->next;
+            n->next = prev;
+            prev = n;
+            n = next;
+        }
+
+        size_t count = 0;
+        for (n = prev; n; ++count) {
+            dst.push_back(std::move(n->value));
+            node *next = n->next;
+            delete n;
+            n = next;
+        }
+        return count;
+    }
+
+private:
+    struct node
+    {
+        T value;
+        node *next;
+    };
+
+    static void release(node *n)
+    {
+        while (n) {
+            node *next = n->next;
+            delete n;
+            n = next;
+        }
+    }
+
+    std::atomic<node*> m_head{ nullptr };
+};
+
+// a fixed number of threads running tasks in the order they are pushed. unlike thread_pool, push() doesn't wait.
+// tasks may use parallel_* inside.
+class task_queue
+{
+public:
+    // num_threads <= 0: std::thread::hardware_concurrency()
+    explicit task_queue(int num_threads = 0);
+    ~task_queue(); // runs the remaining tasks before returning
+    task_queue(const task_queue&) = delete;
+    task_queue& operator=(const task_queue&) = delete;
+
+    std::future<void> push(std::function<void()>&& task);
+    int get_num_threads() const;
+
+private:
+    void thread_main();
+
+    std::vector<std::thread> m_threads;
+    std::deque<std::packaged_task<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stop = false;
+};
 
+} // namespace mu
@@ -6,6 +6,7 @@
 // available options:
 //   muEnablePPL
 //   muEnableTBB
+//   (muEnableThreadPool is defined by muConcurrency.h when neither of the above is)
 //   muEnableAMP
 //   muEnableSymbol
 
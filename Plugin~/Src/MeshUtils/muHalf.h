@@ -125,7 +125,7 @@ struct snorm16
     int16_t value;
 
     snorm16() {}
-    snorm16(const snorm16& v) : value(v.value) {}
+    snorm16(const snorm16& v) = default; // trivially copyable. RawVector moves elements with memcpy()
     snorm16(float v) : value(int16_t(clamp11(v) * C)) {}
 
     snorm16& operator=(float v)
@@ -148,7 +148,7 @@ struct unorm16
     uint16_t value;
 
     unorm16() {}
-    unorm16(const unorm16& v) : value(v.value) {}
+    unorm16(const unorm16& v) = default; // trivially copyable. RawVector moves elements with memcpy()
     unorm16(float v) : value(uint16_t(clamp01(v) * C)) {}
 
     unorm16& operator=(float v)
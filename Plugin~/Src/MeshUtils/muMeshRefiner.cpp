@@ -106,37 +106,56 @@ void MeshRefiner::retopology(bool flip_faces)
     new_indices_lines.resize_discard(getLinesIndexCountTotal());
     new_indices_points.resize_discard(getPointsIndexCountTotal());
 
-    auto& src = new_indices;
-    auto dst_tri = new_indices_tri.data();
-    auto dst_lines = new_indices_lines.data();
-    auto dst_points = new_indices_points.data();
+    // splits write to their own ranges and are processed in parallel
+    const int num_splits = (int)splits.size();
+    RawVector<int> offsets_tri, offsets_lines, offsets_points;
+    offsets_tri.resize_discard(num_splits);
+    offsets_lines.resize_discard(num_splits);
+    offsets_points.resize_discard(num_splits);
+    {
+        int tri = 0, lines = 0, pts = 0;
+        for (int spi = 0; spi < num_splits; ++spi) {
+            auto& split = splits[spi];
+            offsets_tri[spi] = tri;
+            offsets_lines[spi] = lines;
+            offsets_points[spi] = pts;
+            tri += split.index_count_tri;
+            lines += split.index_count_lines;
+            pts += split.index_count_points;
+        }
+    }
 
     const int i1 = flip_faces ? 2 : 1;
     const int i2 = flip_faces ? 1 : 2;
-    size_t num_faces = new_counts.size();
-
-    int n = 0;
-    for (size_t fi = 0; fi < num_faces; ++fi) {
-        int count = new_counts[fi];
-        if (count >= 3) {
-            if (!gen_triangles)continue;
-            for (int ni = 0; ni < count - 2; ++ni) {
-                *(dst_tri++) = src[n + 0];
-                *(dst_tri++) = src[n + ni + i1];
-                *(dst_tri++) = src[n + ni + i2];
+
+    parallel_for(0, num_splits, [&](int spi) {
+        auto& split = splits[spi];
+        auto& src = new_indices;
+        auto dst_tri = new_indices_tri.data() + offsets_tri[spi];
+        auto dst_lines = new_indices_lines.data() + offsets_lines[spi];
+        auto dst_points = new_indices_points.data() + offsets_points[spi];
+
+        int n = split.index_offset;
+        const int face_end = split.face_offset + split.face_count;
+        for (int fi = split.face_offset; fi < face_end; ++fi) {
+            int count = new_counts[fi];
+            if (count >= 3 && gen_triangles) {
+                for (int ni = 0; ni < count - 2; ++ni) {
+                    *(dst_tri++) = src[n + 0];
+                    *(dst_tri++) = src[n + ni + i1];
+                    *(dst_tri++) = src[n + ni + i2];
+                }
             }
+            else if (count == 2 && gen_lines) {
+                for (int ni = 0; ni < 2; ++ni)
+                    *(dst_lines++) = src[n + ni];
+            }
+            else if (count == 1 && gen_points) {
+                *(dst_points++) = src[n];
+            }
+            n += count;
         }
-        else if (count == 2) {
-            if (!gen_lines)continue;
-            for (int ni = 0; ni < 2; ++ni)
-                *(dst_lines++) = src[n + ni];
-        }
-        else if (count == 1) {
-            if (!gen_points)continue;
-            *(dst_points++) = src[n];
-        }
-        n += count;
-    }
+    });
 }
 
 void MeshRefiner::genSubmeshes(const IArray<int>& material_ids, bool has_face_group)
@@ -323,14 +342,10 @@ void MeshRefiner::clear()
     counts.reset();
     indices.reset();
     points.reset();
-    for (auto& attr : attributes) {
-        attr->clear();
-        // attributes are placement new-ed, so need to call destructor manually
-        attr->~IAttribute();
-    }
     attributes.clear();
 
     old2new_indices.clear();
+    new2old_indices.clear();
     new2old_points.clear();
 
     new_counts.clear();
@@ -346,18 +361,86 @@ void MeshRefiner::clear()
     connection.clear();
 }
 
+// only used to reject candidates quickly. matches are always compared in full
+static inline uint32_t HashMix(uint32_t h, uint32_t k)
+{
+    return (h ^ k) * 0x01000193;
+}
+
+static inline bool EqualBytes(const char *a, const char *b, int size)
+{
+    // constant sizes let the compiler inline the compares
+    switch (size) {
+    case 8: return memcmp(a, b, 8) == 0;
+    case 12: return memcmp(a, b, 12) == 0;
+    case 16: return memcmp(a, b, 16) == 0;
+    default: return memcmp(a, b, size) == 0;
+    }
+}
+
+uint32_t MeshRefiner::hashIndex(int ii) const
+{
+    uint32_t h = 0x811c9dc5;
+    for (auto& attr : attributes) {
+        const char *v = attr.get(ii);
+        int i = 0;
+        for (; i + 4 <= attr.value_size; i += 4) {
+            uint32_t k;
+            memcpy(&k, v + i, 4);
+            h = HashMix(h, k);
+        }
+        for (; i < attr.value_size; ++i)
+            h = HashMix(h, (uint8_t)v[i]);
+    }
+    return h ^ (h >> 15);
+}
+
+// i1 and i2 must refer to the same point
+bool MeshRefiner::compareIndices(int i1, int i2) const
+{
+    for (auto& attr : attributes) {
+        if (!EqualBytes(attr.get(i1), attr.get(i2), attr.value_size))
+            return false;
+    }
+    return true;
+}
+
 void MeshRefiner::refine()
 {
-    buildConnection();
+    const int num_indices = (int)indices.size();
+    const int num_faces_total = (int)counts.size();
+
+    // hash the attributes of every index up front. the welding loop below is sequential as the splits depend
+    // on how many vertices have been emitted, so keep it down to table lookups.
+    RawVector<uint32_t> hashes;
+    if (!attributes.empty()) {
+        hashes.resize_discard(num_indices);
+        parallel_for_blocked(0, num_indices, 8192, [&](int begin, int end) {
+            for (int ii = begin; ii < end; ++ii)
+                hashes[ii] = hashIndex(ii);
+        });
+    }
 
-    int num_indices = (int)indices.size();
-    new_points.reserve(num_indices);
-    new_indices.reserve(num_indices);
-    for (auto& attr : attributes) { attr->prepare((int)points.size(), (int)indices.size()); }
+    // vertices emitted for each point in the current split, chained from the latest. candidates are checked by hash
+    // first. vertices of earlier splits have smaller indices, so a chain ends at the first one below the split.
+    RawVector<int> point_heads, next_vertices;
+    point_heads.resize_discard(points.size());
+    memset(point_heads.data(), -1, point_heads.size_in_byte());
+    next_vertices.reserve(num_indices);
 
-    old2new_indices.resize(num_indices, -1);
+    new_points.clear();
+    new_indices.clear();
+    new_counts.clear();
+    new2old_points.clear();
+    new2old_indices.clear();
+    splits.clear();
+    new_indices.reserve(num_indices);
+    new2old_points.reserve(num_indices);
+    new2old_indices.reserve(num_indices);
+    new_counts.reserve(num_faces_total);
+    old2new_indices.resize_discard(num_indices);
+    memset(old2new_indices.data(), -1, old2new_indices.size_in_byte());
 
-    int num_faces_total = (int)counts.size();
     int offset_faces = 0;
     int offset_indices = 0;
     int offset_vertices = 0;
@@ -375,7 +458,7 @@ void MeshRefiner::refine()
         split.index_count_tri = num_indices_tri;
         split.index_count_lines = num_indices_lines;
         split.index_count_points = num_indices_points;
-        split.vertex_count = (int)new_points.size() - offset_vertices;
+        split.vertex_count = (int)new2old_points.size() - offset_vertices;
         split.index_count = (int)new_indices.size() - offset_indices;
         splits.push_back(split);
 
@@ -389,51 +472,43 @@ void MeshRefiner::refine()
         num_indices_points = 0;
     };
 
-    auto compare_all_attributes = [&](int ni, int ii) {
-        for (auto& attr : attributes) {
-            if (!attr->compare(ni, ii))
-                return false;
+    auto find_or_emit_vertex = [&](int ii) {
+        const int vi = indices[ii];
+        if (attributes.empty()) {
+            if (point_heads[vi] >= offset_vertices)
+                return point_heads[vi];
         }
-        return true;
-    };
-
-    auto find_or_emit_vertex = [&](int vi, int ii) {
-        int offset = connection.v2f_offsets[vi];
-        int connection_count = connection.v2f_counts[vi];
-        for (int ci = 0; ci < connection_count; ++ci) {
-            int& ni = old2new_indices[connection.v2f_indices[offset + ci]];
-            if (ni != -1 && compare_all_attributes(ni, ii)) {
-                return ni;
-            }
-            else {
-                ni = (int)new_points.size();
-                new_points.push_back(points[vi]);
-                new2old_points.push_back(vi);
-                for (auto& attr : attributes)
-                    attr->emit(ii);
-                return ni;
+        else {
+            const uint32_t h = hashes[ii];
+            for (int ni = point_heads[vi]; ni >= offset_vertices; ni = next_vertices[ni]) {
+                const int src = new2old_indices[ni];
+                if (hashes[src] == h && compareIndices(src, ii))
+                    return ni;
             }
         }
-        return 0;
+
+        int ni = (int)new2old_points.size();
+        new2old_points.push_back(vi);
+        new2old_indices.push_back(ii);
+        next_vertices.push_back(point_heads[vi]);
+        point_heads[vi] = ni;
+        return ni;
     };
 
-    new_counts.reserve(counts.size());
     int offset = 0;
     for (int fi = 0; fi < num_faces_total; ++fi) {
         int count = counts[fi];
         if ((count >= 3 && gen_triangles) || (count == 2 && gen_lines) || (count == 1 && gen_points))
         {
-            if (split_unit > 0 && (int)new_points.size() - offset_vertices + count > split_unit) {
+            if (split_unit > 0 && (int)new2old_points.size() - offset_vertices + count > split_unit) {
                 add_new_split();
-
-                // clear vertex cache
-                memset(old2new_indices.data(), -1, old2new_indices.size() * sizeof(int));
             }
 
             for (int ci = 0; ci < count; ++ci) {
                 int ii = offset + ci;
-                int vi = indices[ii];
-                new_indices.push_back(find_or_emit_vertex(vi, ii));
+                int ni = find_or_emit_vertex(ii);
+                old2new_indices[ii] = ni;
+                new_indices.push_back(ni);
             }
             ++num_faces;
             new_counts.push_back(count);
@@ -448,6 +523,18 @@ void MeshRefiner::refine()
         offset += count;
     }
     add_new_split();
+
+    // gather points and attributes of the new vertices
+    const int num_new_vertices = (int)new2old_points.size();
+    new_points.resize_discard(num_new_vertices);
+    for (auto& attr : attributes)
+        attr.resize(attr, num_new_vertices);
+    parallel_for_blocked(0, num_new_vertices, 8192, [&](int begin, int end) {
+        for (int ni = begin; ni < end; ++ni)
+            new_points[ni] = points[new2old_points[ni]];
+        for (auto& attr : attributes)
+            attr.gather(attr, new2old_indices.data(), begin, end);
+    });
 }
 
 void MeshRefiner::buildConnection()
@@ -2,7 +2,6 @@
 
 #include <cassert>
 
-#include "MeshUtils/MeshUtilsConstants.h" //MAX_MESH_REFINER_ATTRIBUTES
 #include "muMath.h"
 #include "muRawVector.h"
 #include "muIntrusiveArray.h"
@@ -107,7 +106,7 @@ struct MeshRefiner
     IArray<float3> points;
 
     // outputs
-    RawVector<int> old2new_indices; // old index to new index
+    RawVector<int> old2new_indices; // old index to new vertex. -1 if the face was skipped
     RawVector<int> new2old_points;  // new index to old vertex
     RawVector<int> new_counts;
     RawVector<int> new_indices;     // non-triangulated new indices
@@ -122,22 +121,18 @@ struct MeshRefiner
 
 //----------------------------------------------------------------------------------------------------------------------
     // attributes
+    // indices that refer to the same point and have bitwise identical attributes are welded into one vertex.
     template<class T>
     void addIndexedAttribute(const IArray<T>& values, const IArray<int>& indices, RawVector<T>& new_values, RawVector<int>& new2old)
     {
-        IndexedAttribute<T>* attr = newAttribute<IndexedAttribute<T>>();
-        attr->values = values;
-        attr->indices = indices;
-        attr->new_values = &new_values;
-        attr->new2old = &new2old;
+        Attribute attr = makeAttribute(values, new_values, new2old);
+        attr.indices = indices.data();
+        attributes.push_back(attr);
     }
 
     template<class T>
     void addExpandedAttribute(const IArray<T>& values, RawVector<T>& new_values, RawVector<int>& new2old) {
-        ExpandedAttribute<T>* attr = newAttribute<ExpandedAttribute<T>>();
-        attr->values = values;
-        attr->new_values = &new_values;
-        attr->new2old = &new2old;
+        attributes.push_back(makeAttribute(values, new_values, new2old));
     }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -157,99 +152,59 @@ struct MeshRefiner
 private:
     void setupSubmeshes();
 
-    class IAttribute
+    // type-erased attribute. values are hashed and compared as raw bytes, so every attribute set goes through
+    // the same welding loop. only resizing and gathering the outputs need the type.
+    struct Attribute
     {
-    public:
-        virtual ~IAttribute() {}
-        virtual void prepare(int vertex_count, int index_count) = 0;
-        virtual bool compare(int vertex_index, int index_index) = 0;
-        virtual void emit(int index_index) = 0;
-        virtual void clear() = 0;
+        const char *values = nullptr;
+        const int *indices = nullptr; // null if values are per-index (expanded)
+        int value_size = 0;
+        void *new_values = nullptr; // RawVector<T>*
+        RawVector<int> *new2old = nullptr;
+        void (*resize)(const Attribute& attr, int size) = nullptr;
+        void (*gather)(const Attribute& attr, const int *src_indices, int begin, int end) = nullptr;
+
+        const char* get(int ii) const { return values + (size_t)value_size * (indices ? indices[ii] : ii); }
     };
 
     template<class T>
-    class IndexedAttribute : public IAttribute
+    static void resizeAttribute(const Attribute& attr, int size)
     {
-    public:
-        void prepare(int /*vertex_count*/, int /*index_count*/) override
-        {
-            clear();
-        }
-
-        bool compare(int ni, int ii) override
-        {
-            return (*new_values)[ni] == values[indices[ii]];
-        }
-
-        void emit(int ii) override
-        {
-            int i = indices[ii];
-            new_values->push_back(values[i]);
-            new2old->push_back(i);
-        }
-
-        void clear() override
-        {
-            new_values->clear();
-            new2old->clear();
-        }
-
-        IArray<T> values;
-        IArray<int> indices;
-        RawVector<T> *new_values = nullptr;
-        RawVector<int> *new2old = nullptr;
-    };
+        ((RawVector<T>*)attr.new_values)->resize_discard(size);
+        attr.new2old->resize_discard(size);
+    }
 
     template<class T>
-    class ExpandedAttribute : public IAttribute
+    static void gatherAttribute(const Attribute& attr, const int *src_indices, int begin, int end)
     {
-    public:
-        void prepare(int /*vertex_count*/, int /*index_count*/) override
-        {
-            clear();
+        auto *dst = ((RawVector<T>*)attr.new_values)->data();
+        auto *dst_map = attr.new2old->data();
+        auto *src = (const T*)attr.values;
+        for (int ni = begin; ni < end; ++ni) {
+            int i = attr.indices ? attr.indices[src_indices[ni]] : src_indices[ni];
+            dst[ni] = src[i];
+            dst_map[ni] = i;
         }
+    }
 
-        bool compare(int ni, int ii) override
-        {
-            return (*new_values)[ni] == values[ii];
-        }
-
-        void emit(int ii) override
-        {
-            new_values->push_back(values[ii]);
-            new2old->push_back(ii);
-        }
-
-        void clear() override
-        {
-            new_values->clear();
-        }
-
-        IArray<T> values;
-        RawVector<T> *new_values = nullptr;
-        RawVector<int> *new2old = nullptr;
-    };
-
-    template<class AttrType>
-    AttrType* newAttribute()
+    template<class T>
+    static Attribute makeAttribute(const IArray<T>& values, RawVector<T>& new_values, RawVector<int>& new2old)
     {
-        const int size_attr = sizeof(IndexedAttribute<char>);
-        const uint32_t maxMeshRefinerAttributes = mu::MeshUtilsConstants::MAX_MESH_REFINER_ATTRIBUTES;
-        if (buf_attributes.empty()) {
-            buf_attributes.resize(size_attr * maxMeshRefinerAttributes);
-        }
-
-        const size_t i = attributes.size();
-        assert(i < maxMeshRefinerAttributes && "Need to increase MAX_MESH_REFINER_ATTRIBUTES");
-        if (i >= maxMeshRefinerAttributes)
-            return nullptr;
-        AttrType *ret = new (&buf_attributes[size_attr * i]) AttrType();
-        attributes.push_back(ret);
-        return ret;
+        Attribute attr;
+        attr.values = (const char*)values.data();
+        attr.value_size = sizeof(T);
+        attr.new_values = &new_values;
+        attr.new2old = &new2old;
+        attr.resize = &resizeAttribute<T>;
+        attr.gather = &gatherAttribute<T>;
+        return attr;
     }
 
-    RawVector<IAttribute*> attributes;
-    RawVector<char> buf_attributes;
+    uint32_t hashIndex(int ii) const;
+    bool compareIndices(int i1, int i2) const;
+
+    RawVector<Attribute> attributes;
+    RawVector<int> new2old_indices; // new vertex to the old index it was emitted from
 };
 
 } // namespace mu
@@ -6,7 +6,9 @@
     #pragma comment(lib, "dbghelp.lib")
 #else
     #include <unistd.h>
+    #include <fcntl.h>
     #include <sys/mman.h>
+    #include <sys/stat.h>
 #endif
 
 namespace mu {
@@ -359,6 +361,193 @@ void* FindSymbolByName(const char *name, const char *module_name)
 #endif //_WIN32
 }
 
+MemoryMappedFile::MemoryMappedFile()
+{
+}
+
+MemoryMappedFile::~MemoryMappedFile()
+{
+    close();
+}
+
+bool MemoryMappedFile::open(const char *path)
+{
+    close();
+    if (!path)
+        return false;
+
+#ifdef _WIN32
+    // don't stop other processes from rewriting or deleting the file while it is mapped
+    HANDLE file = ::CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    m_file = file;
+
+    LARGE_INTEGER size;
+    if (!::GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        close();
+        return false;
+    }
+    m_mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping) {
+        close();
+        return false;
+    }
+    m_data = (const char*)::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_data) {
+        close();
+        return false;
+    }
+    m_size = (size_t)size.QuadPart;
+#else
+    m_fd = ::open(path, O_RDONLY);
+    if (m_fd == -1)
+        return false;
+
+    struct stat st;
+    if (::fstat(m_fd, &st) != 0 || st.st_size == 0) {
+        close();
+        return false;
+    }
+    void *data = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED) {
+        close();
+        return false;
+    }
+    m_data = (const char*)data;
+    m_size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+void MemoryMappedFile::close()
+{
+#ifdef _WIN32
+    if (m_data)
+        ::UnmapViewOfFile(m_data);
+    if (m_mapping)
+        ::CloseHandle(m_mapping);
+    if (m_file)
+        ::CloseHandle(m_file);
+    m_mapping = m_file = nullptr;
+#else
+    if (m_data)
+        ::munmap((void*)m_data, m_size);
+    if (m_fd != -1)
+        ::close(m_fd);
+    m_fd = -1;
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
+
+SharedMemory::SharedMemory()
+{
+}
+
+SharedMemory::~SharedMemory()
+{
+    close();
+}
+
+bool SharedMemory::create(const char *name, size_t size)
+{
+    close();
+    if (!name || size == 0)
+        return false;
+
+#ifdef _WIN32
+    std::string path = std::string("Local\\") + name;
+    m_mapping = ::CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+        (DWORD)((uint64_t)size >> 32), (DWORD)((uint64_t)size & 0xffffffff), path.c_str());
+    if (!m_mapping || ::GetLastError() == ERROR_ALREADY_EXISTS) {
+        close();
+        return false;
+    }
+    m_data = (char*)::MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!m_data) {
+        close();
+        return false;
+    }
+#else
+    std::string path = std::string("/") + name;
+    int fd = ::shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1)
+        return false;
+    m_name = path;
+    if (::ftruncate(fd, (off_t)size) != 0) {
+        ::close(fd);
+        close();
+        return false;
+    }
+    void *data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps the memory
+    if (data == MAP_FAILED) {
+        close();
+        return false;
+    }
+    m_data = (char*)data;
+#endif
+    m_size = size;
+    return true;
+}
+
+bool SharedMemory::open(const char *name, size_t size)
+{
+    close();
+    if (!name || size == 0)
+        return false;
+
+#ifdef _WIN32
+    std::string path = std::string("Local\\") + name;
+    m_mapping = ::OpenFileMappingA(FILE_MAP_READ, FALSE, path.c_str());
+    if (!m_mapping)
+        return false;
+    m_data = (char*)::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, size);
+    if (!m_data) {
+        close();
+        return false;
+    }
+#else
+    std::string path = std::string("/") + name;
+    int fd = ::shm_open(path.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || (size_t)st.st_size < size) {
+        ::close(fd);
+        return false;
+    }
+    void *data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+    m_data = (char*)data;
+#endif
+    m_size = size;
+    return true;
+}
+
+void SharedMemory::close()
+{
+#ifdef _WIN32
+    if (m_data)
+        ::UnmapViewOfFile(m_data);
+    if (m_mapping)
+        ::CloseHandle(m_mapping);
+    m_mapping = nullptr;
+#else
+    if (m_data)
+        ::munmap(m_data, m_size);
+    if (!m_name.empty())
+        ::shm_unlink(m_name.c_str());
+    m_name.clear();
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
+
 void SetMemoryProtection(void *addr, size_t size, MemoryFlags flags)
 {
 #ifdef _WIN32
@@ -290,6 +290,27 @@ uint64_t SumInt32(const void *src, size_t num)
 }
 #endif
 
+// FNV-1a style on 32 bit words with 4 independent lanes to hide the multiply latency
+uint64_t HashInt32(const void *src_, size_t num, uint64_t seed)
+{
+    auto *src = (const uint32_t*)src_;
+    const size_t n = num / sizeof(uint32_t);
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t h0 = seed, h1 = seed + 1, h2 = seed + 2, h3 = seed + 3;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        h0 = (h0 ^ src[i + 0]) * prime;
+        h1 = (h1 ^ src[i + 1]) * prime;
+        h2 = (h2 ^ src[i + 2]) * prime;
+        h3 = (h3 ^ src[i + 3]) * prime;
+    }
+    for (; i < n; ++i)
+        h0 = (h0 ^ src[i]) * prime;
+    for (size_t bi = n * sizeof(uint32_t); bi < num; ++bi)
+        h0 = (h0 ^ ((const uint8_t*)src_)[bi]) * prime;
+    return (((h0 * prime) ^ h1) * prime ^ h2) * prime ^ h3 ^ n;
+}
+
 #if defined(muSIMD_Float_Half_Conversion) || !defined(muEnableISPC)
 void F32ToF16(half *dst, const float *src, size_t num) { Forward(F32ToF16, dst, src, num); }
 void F16ToF32(float *dst, const half *src, size_t num) { Forward(F16ToF32, dst, src, num); }
@@ -7,6 +7,8 @@
 namespace mu {
 
 uint64_t SumInt32(const void *src, size_t num);
+// order sensitive, unlike SumInt32(). num is in byte. chain calls by passing the last result as seed
+uint64_t HashInt32(const void *src, size_t num, uint64_t seed = 0xcbf29ce484222325ULL);
 
 // float <-> half
 void F32ToF16(half *dst, const float *src, size_t num);
@@ -1,4 +1,5 @@
 #include "pch.h"
+#include <stdexcept>
 #include "muStream.h"
 
 namespace mu {
@@ -38,13 +39,18 @@ std::ios::pos_type MemoryStreamBuf::seekoff(off_type off, std::ios_base::seekdir
 {
     auto *p = buffer.data();
     auto *e = p + buffer.size();
+    auto *g = this->gptr();
     if (dir == std::ios::beg)
-        this->setg(p, buffer.data() + off, e);
+        g = p + off;
     if (dir == std::ios::cur)
-        this->setg(p, this->gptr() + off, e);
+        g += off;
     if (dir == std::ios::end)
-        this->setg(p, e - off, e);
-    return uint64_t(this->gptr() - this->eback());
+        g = e - off;
+    // offsets may come from the data being read. never move outside the buffer
+    if (g < p || g > e)
+        return pos_type(off_type(-1));
+    this->setg(p, g, e);
+    return uint64_t(g - p);
 }
 
 std::ios::pos_type MemoryStreamBuf::seekpos(pos_type pos, std::ios_base::openmode /*mode*/)
@@ -102,11 +108,61 @@ uint64_t MemoryStream::getRCount() const { return m_buf.rcount; }
 char* MemoryStream::gskip(size_t n)
 {
     auto ret = m_buf.gptr();
+    if (n > size_t(m_buf.egptr() - ret))
+        throw std::runtime_error("MemoryStream: read past the end of the buffer");
     m_buf.seekoff((std::streamoff)n, std::ios::cur, std::ios::binary);
     return ret;
 }
 
 
+MemoryViewStreamBuf::MemoryViewStreamBuf(const char *data, size_t size)
+    : m_begin((char*)data), m_end((char*)data + size)
+{
+    this->setg(m_begin, m_begin, m_end);
+}
+
+std::ios::pos_type MemoryViewStreamBuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode /*mode*/)
+{
+    char *p = this->gptr();
+    if (dir == std::ios::beg)
+        p = m_begin + off;
+    if (dir == std::ios::cur)
+        p += off;
+    if (dir == std::ios::end)
+        p = m_end + off;
+    if (p < m_begin || p > m_end)
+        return pos_type(off_type(-1));
+    this->setg(m_begin, p, m_end);
+    return uint64_t(p - m_begin);
+}
+
+std::ios::pos_type MemoryViewStreamBuf::seekpos(pos_type pos, std::ios_base::openmode mode)
+{
+    return seekoff(off_type(pos), std::ios::beg, mode);
+}
+
+int MemoryViewStreamBuf::underflow()
+{
+    return traits_type::eof();
+}
+
+const char* MemoryViewStreamBuf::gskip(size_t n)
+{
+    char *ret = this->gptr();
+    if (n > size_t(m_end - ret))
+        throw std::runtime_error("MemoryViewStream: read past the end of the buffer");
+    this->setg(m_begin, ret + n, m_end);
+    return ret;
+}
+
+MemoryViewStream::MemoryViewStream(const char *data, size_t size)
+    : std::istream(&m_buf), m_buf(data, size)
+{
+}
+
+const char* MemoryViewStream::gskip(size_t n) { return m_buf.gskip(n); }
+
+
 static RawVector<char> s_dummy_buf;
 
 CounterStreamBuf::CounterStreamBuf()
@@ -123,6 +179,13 @@ int CounterStreamBuf::overflow(int c)
     return c;
 }
 
+std::streamsize CounterStreamBuf::xsputn(const char * /*s*/, std::streamsize n)
+{
+    // only the size matters. count without copying into the dummy buffer.
+    m_size += uint64_t(n);
+    return n;
+}
+
 int CounterStreamBuf::sync()
 {
     m_size += uint64_t(this->pptr() - this->pbase());
@@ -140,4 +203,93 @@ CounterStream::CounterStream() : std::ostream(&m_buf) {}
 uint64_t CounterStream::size() const { return m_buf.m_size; }
 void CounterStream::reset() { m_buf.reset(); }
 
+
+
+GatherStreamBuf::GatherStreamBuf()
+{
+    reset();
+}
+
+int GatherStreamBuf::overflow(int c)
+{
+    closeSegment();
+
+    // continue in the next block. blocks are kept and reused after reset()
+    ++m_current;
+    if (m_current == m_blocks.end())
+        m_current = m_blocks.insert(m_blocks.end(), RawVector<char>(default_bufsize));
+    auto *p = m_current->data();
+    this->setp(p, p + m_current->size());
+    m_segment_begin = p;
+
+    if (c != traits_type::eof()) {
+        *this->pptr() = (char)c;
+        this->pbump(1);
+    }
+    return c;
+}
+
+int GatherStreamBuf::sync()
+{
+    closeSegment();
+    return 0;
+}
+
+void GatherStreamBuf::reset()
+{
+    segments.clear();
+    wcount = 0;
+    if (m_blocks.empty())
+        m_blocks.emplace_back(size_t(default_bufsize));
+    m_current = m_blocks.begin();
+    auto *p = m_current->data();
+    this->setp(p, p + m_current->size());
+    m_segment_begin = p;
+}
+
+void GatherStreamBuf::addRef(const char *data, size_t size)
+{
+    if (size == 0)
+        return;
+    closeSegment();
+    segments.push_back({ data, size });
+    wcount += size;
+}
+
+void GatherStreamBuf::closeSegment()
+{
+    char *end = this->pptr();
+    if (end == m_segment_begin)
+        return;
+
+    size_t size = size_t(end - m_segment_begin);
+    if (!segments.empty() && segments.back().data + segments.back().size == m_segment_begin)
+        segments.back().size += size; // contiguous with the previous segment
+    else
+        segments.push_back({ m_segment_begin, size });
+    wcount += size;
+    m_segment_begin = end;
+}
+
+
+GatherStream::GatherStream() : std::ostream(&m_buf) {}
+void GatherStream::reset() { m_buf.reset(); clear(); }
+
+void GatherStream::writeRef(const void *data, size_t size)
+{
+    m_buf.addRef((const char*)data, size);
+}
+
+const std::vector<GatherStream::Segment>& GatherStream::getSegments()
+{
+    flush();
+    return m_buf.segments;
+}
+
+uint64_t GatherStream::size()
+{
+    flush();
+    return m_buf.wcount;
+}
+
 } // namespace mu
@@ -1,5 +1,7 @@
 #pragma once
 #include <iostream>
+#include <list>
+#include <vector>
 #include "muRawVector.h"
 
 namespace mu {
@@ -41,13 +43,41 @@ public:
     uint64_t getWCount() const;
     uint64_t getRCount() const;
 
-    char* gskip(size_t n); // return current read pointer and advance n byte
+    char* gskip(size_t n); // return current read pointer and advance n byte. throws std::runtime_error past the end
 
 private:
     MemoryStreamBuf m_buf;
 };
 
 
+// read-only stream over memory owned by someone else (e.g. a memory-mapped file). no copy.
+class MemoryViewStreamBuf : public std::streambuf
+{
+public:
+    MemoryViewStreamBuf(const char *data, size_t size);
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode mode) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode mode) override;
+    int underflow() override;
+
+    const char* gskip(size_t n);
+
+private:
+    char *m_begin, *m_end;
+};
+
+class MemoryViewStream : public std::istream
+{
+public:
+    MemoryViewStream(const char *data, size_t size);
+
+    const char* gskip(size_t n); // return current read pointer and advance n byte. throws std::runtime_error past the end
+
+private:
+    MemoryViewStreamBuf m_buf;
+};
+
+
 class CounterStreamBuf : public std::streambuf
 {
 public:
@@ -55,6 +85,7 @@ public:
 
     CounterStreamBuf();
     int overflow(int c) override;
+    std::streamsize xsputn(const char *s, std::streamsize n) override;
     int sync() override;
     void reset();
 
@@ -72,4 +103,56 @@ private:
     CounterStreamBuf m_buf;
 };
 
+
+// write-only stream that copies small writes into its own blocks and keeps references to large external data
+// (see GatherStream::writeRef()). the result is a list of segments that can be sent with vectored I/O.
+class GatherStreamBuf : public std::streambuf
+{
+friend class GatherStream;
+public:
+    static const size_t default_bufsize = 1024 * 64;
+
+    struct Segment
+    {
+        const char *data;
+        size_t size;
+    };
+
+    GatherStreamBuf();
+    int overflow(int c) override;
+    int sync() override;
+    void reset();
+    void addRef(const char *data, size_t size);
+
+    std::vector<Segment> segments;
+    uint64_t wcount = 0;
+
+private:
+    void closeSegment();
+
+    std::list<RawVector<char>> m_blocks; // segments point into these. std::list keeps the addresses stable.
+    std::list<RawVector<char>>::iterator m_current;
+    char *m_segment_begin = nullptr;
+};
+
+class GatherStream : public std::ostream
+{
+public:
+    using Segment = GatherStreamBuf::Segment;
+    static const size_t min_ref_size = 1024 * 16; // smaller data is cheaper to copy than to reference
+
+    GatherStream();
+    void reset();
+
+    // reference data in place instead of copying it.
+    // it must stay alive and unmodified until the segments are consumed.
+    void writeRef(const void *data, size_t size);
+
+    const std::vector<Segment>& getSegments(); // flushes
+    uint64_t size(); // flushes
+
+private:
+    GatherStreamBuf m_buf;
+};
+
 } // namespace mu
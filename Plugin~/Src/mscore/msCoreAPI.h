@@ -18,3 +18,4 @@
 #endif
 
 using msMessageHandler = void(*)(ms::Message::Type type, void *data);
+using msMessageBatchHandler = void(*)(int num_messages, const ms::Message::Type *types, void *const *data);
@@ -67,7 +67,7 @@ msAPI ms::QueryMessage::QueryType msQueryGetType(ms::QueryMessage *self)
 }
 msAPI void msQueryFinishRespond(ms::QueryMessage *self)
 {
-    self->ready = true;
+    self->ready.set();
 }
 msAPI void msQueryAddResponseText(ms::QueryMessage *self, const char *text)
 {
@@ -90,6 +90,15 @@ msAPI int msGetProtocolVersion() {
     return msProtocolVersion;
 }
 
+// C# has the settings up to import_settings. the rest keep their values
+static void CopySettings(ms::ServerSettings& dst, const ms::ServerSettings& src)
+{
+    dst.max_queue = src.max_queue;
+    dst.max_threads = src.max_threads;
+    dst.port = src.port;
+    dst.import_settings = src.import_settings;
+}
+
 msAPI ms::Server* msServerStart(const ms::ServerSettings *settings)
 {
     if (!settings)
@@ -97,12 +106,14 @@ msAPI ms::Server* msServerStart(const ms::ServerSettings *settings)
 
     auto& server = g_servers[settings->port];
     if (!server) {
-        server.reset(new ms::Server(*settings));
+        ms::ServerSettings s;
+        CopySettings(s, *settings);
+        server.reset(new ms::Server(s));
         server->start();
     }
     else {
         server->setServe(true);
-        server->getSettings() = *settings;
+        CopySettings(server->getSettings(), *settings);
     }
     return server.get();
 }
@@ -157,6 +168,15 @@ msAPI int msServerProcessMessages(ms::Server *server, msMessageHandler handler)
         });
 }
 
+msAPI int msServerProcessMessagesBatch(ms::Server *server, msMessageBatchHandler handler)
+{
+    if (!server || !handler)
+        return 0;
+    return server->processMessagesBatch([handler](int num_messages, const ms::Message::Type *types, ms::Message *const *messages) {
+        handler(num_messages, types, (void *const *)messages);
+        });
+}
+
 msAPI void msServerBeginServe(ms::Server *server)
 {
     if (!server) { return; }
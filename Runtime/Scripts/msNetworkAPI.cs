@@ -124,6 +124,7 @@ namespace Unity.MeshSync
         Screenshot,
         Query,
         Response,
+        Batch,
     }
 
     public struct GetMessage